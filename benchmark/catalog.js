@@ -0,0 +1,214 @@
+// Measures how long catalog queries take on worker threads while the main
+// thread keeps rebuilding the catalog with refreshCatalog, compared to an
+// idle catalog. Since refreshes build the new version off to the side,
+// both columns should be about the same. It also reports how much memory
+// the catalog takes, compared to storing a separate string per font, and how
+// long filtered findFonts queries over the catalog's columns take. Run it
+// with `npm run bench`, and set BENCH_DURATION (in ms) and BENCH_READERS to
+// change the defaults. On Linux, BENCH_FONTS sets up a temporary fontconfig
+// configuration with that many links to the installed fonts.
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var childProcess = require('child_process');
+var workerThreads = require('worker_threads');
+
+var DURATION = +process.env.BENCH_DURATION || 3000;
+var READERS = +process.env.BENCH_READERS || 4;
+var FONTS = +process.env.BENCH_FONTS || 0;
+
+// fonts per directory of the generated configuration, like a family's files
+var FONTS_PER_DIRECTORY = 8;
+
+// phases of the benchmark, shared with the readers through a SharedArrayBuffer
+var IDLE = 0;
+var REFRESHING = 1;
+var DONE = 2;
+
+// returns the percentiles of a list of latencies, in microseconds
+function summarize(latencies) {
+  latencies.sort(function(a, b) { return a - b; });
+  function percentile(p) {
+    return latencies.length ? latencies[Math.min(latencies.length - 1, Math.floor(latencies.length * p))] : 0;
+  }
+
+  return {
+    count: latencies.length,
+    p50: percentile(0.5),
+    p99: percentile(0.99),
+    p999: percentile(0.999),
+    max: percentile(1)
+  };
+}
+
+// looks fonts up by postscript name as fast as it can, and records the
+// latency of each lookup under the phase it was made in
+function runReader() {
+  var fontManager = require('../');
+  var phase = new Int32Array(workerThreads.workerData.phase);
+  var names = workerThreads.workerData.names;
+  var latencies = [[], []];
+
+  for (var i = 0; ; i++) {
+    var current = Atomics.load(phase, 0);
+    if (current === DONE)
+      break;
+
+    var start = process.hrtime();
+    fontManager.getFontByPostscriptNameSync(names[i % names.length]);
+    var time = process.hrtime(start);
+    latencies[current].push(time[0] * 1e6 + time[1] / 1e3);
+  }
+
+  workerThreads.parentPort.postMessage([summarize(latencies[IDLE]), summarize(latencies[REFRESHING])]);
+}
+
+// links the installed fonts over and over into a temporary directory until
+// there are count of them, and points fontconfig at it. this has to happen
+// before the addon is loaded, and the workers inherit the environment.
+function createFonts(count) {
+  var files = childProcess.execFileSync('fc-list', ['--format', '%{file}\n'], { maxBuffer: 64 * 1048576 }).toString().split('\n').filter(function(file, i, files) {
+    return file && files.indexOf(file) === i;
+  });
+
+  if (!files.length)
+    throw new Error('BENCH_FONTS needs some fonts installed');
+
+  var root = fs.mkdtempSync(path.join(os.tmpdir(), 'font-manager-bench-'));
+  for (var i = 0; i < count; i++) {
+    var dir = path.join(root, 'fonts', 'family-' + Math.floor(i / FONTS_PER_DIRECTORY));
+    if (i % FONTS_PER_DIRECTORY === 0)
+      fs.mkdirSync(dir, { recursive: true });
+
+    var file = files[i % files.length];
+    fs.symlinkSync(file, path.join(dir, i + '-' + path.basename(file)));
+  }
+
+  var config = path.join(root, 'fonts.conf');
+  fs.writeFileSync(config, '<?xml version="1.0"?>\n<fontconfig>\n' +
+    '  <dir>' + path.join(root, 'fonts') + '</dir>\n' +
+    '  <cachedir>' + path.join(root, 'cache') + '</cachedir>\n' +
+    '</fontconfig>\n');
+
+  process.env.FONTCONFIG_FILE = config;
+  process.on('exit', function() {
+    childProcess.execFileSync('rm', ['-rf', root]);
+  });
+}
+
+function formatSize(bytes) {
+  return (bytes / 1048576).toFixed(2) + ' MB';
+}
+
+// prints the size of the catalog, and what it would be with a separate
+// path and separate names for every font
+function reportMemory(stats) {
+  var raw = stats.size - stats.pathsSize - stats.namesSize + stats.rawPathsSize + stats.rawNamesSize;
+  console.log('catalog memory for ' + stats.fonts + ' fonts in ' + stats.paths + ' files');
+  console.log('  paths: ' + formatSize(stats.pathsSize) + ' front coded, ' + formatSize(stats.rawPathsSize) + ' as separate strings');
+  console.log('  names: ' + formatSize(stats.namesSize) + ' deduplicated, ' + formatSize(stats.rawNamesSize) + ' as separate strings');
+  console.log('  total: ' + formatSize(stats.size) + ', ' + formatSize(raw) + ' with separate strings');
+}
+
+// times findFontIdsSync for queries with ranges, a family list and a path
+// prefix, which scan the catalog instead of asking the platform. IDs keep
+// the cost of creating result objects out of the numbers.
+function reportQueries(fontManager) {
+  var fonts = fontManager.getAvailableFontsSync();
+  var families = fontManager.getFamilyNamesSync();
+  var queries = {
+    'weight range': { weight: { min: 300, max: 600 } },
+    'weight and width ranges, italic': { weight: { min: 500 }, width: { max: 5 }, italic: true },
+    'family list': { family: families.slice(0, 3) },
+    'path prefix': { pathPrefix: fonts.length ? path.dirname(fonts[0].path) + path.sep : '/' }
+  };
+
+  console.log('filtered queries over ' + fonts.length + ' fonts');
+  Object.keys(queries).forEach(function(name) {
+    var iterations = 1000;
+    var count = fontManager.findFontIdsSync(queries[name]).length;
+    var start = process.hrtime();
+    for (var i = 0; i < iterations; i++) {
+      fontManager.findFontIdsSync(queries[name]);
+    }
+
+    var time = process.hrtime(start);
+    console.log('  ' + name + ': ' + ((time[0] * 1e6 + time[1] / 1e3) / iterations).toFixed(1) + 'us, ' + count + ' fonts');
+  });
+}
+
+function formatRow(label, values) {
+  return label + values.map(function(value) {
+    var text = typeof value === 'number' ? value.toFixed(1) : String(value);
+    return new Array(Math.max(1, 14 - text.length)).join(' ') + text;
+  }).join('');
+}
+
+function runMain() {
+  if (FONTS && process.platform === 'linux')
+    createFonts(FONTS);
+  else if (FONTS)
+    console.log('BENCH_FONTS is only supported on Linux, using the installed fonts');
+
+  var fontManager = require('../');
+  var names = fontManager.getAvailableFontsSync().map(function(font) {
+    return font.postscriptName;
+  }).filter(Boolean);
+
+  var phase = new Int32Array(new SharedArrayBuffer(4));
+  var results = [];
+  var refreshes = [];
+
+  for (var i = 0; i < READERS; i++) {
+    var worker = new workerThreads.Worker(__filename, { workerData: { phase: phase.buffer, names: names } });
+    worker.on('error', function(err) {
+      throw err;
+    });
+
+    worker.on('message', function(result) {
+      results.push(result);
+      if (results.length === READERS)
+        report();
+    });
+  }
+
+  function refresh() {
+    if (Atomics.load(phase, 0) !== REFRESHING)
+      return;
+
+    var start = process.hrtime();
+    fontManager.refreshCatalog(function() {
+      var time = process.hrtime(start);
+      refreshes.push(time[0] * 1e3 + time[1] / 1e6);
+      refresh();
+    });
+  }
+
+  setTimeout(function() {
+    Atomics.store(phase, 0, REFRESHING);
+    refresh();
+
+    setTimeout(function() {
+      Atomics.store(phase, 0, DONE);
+    }, DURATION);
+  }, DURATION);
+
+  function report() {
+    reportMemory(fontManager.getCatalogStats());
+    reportQueries(fontManager);
+    console.log(names.length + ' fonts, ' + READERS + ' readers, ' + refreshes.length + ' refreshes' +
+      (refreshes.length ? ' taking ' + summarize(refreshes).p50.toFixed(1) + 'ms each' : ''));
+    console.log(formatRow('latency (us)', ['idle p50', 'idle p99', 'idle max', 'refresh p50', 'refresh p99', 'refresh max']));
+
+    results.forEach(function(result, i) {
+      var idle = result[IDLE];
+      var refreshing = result[REFRESHING];
+      console.log(formatRow('reader ' + i + '    ', [idle.p50, idle.p99, idle.max, refreshing.p50, refreshing.p99, refreshing.max]));
+    });
+  }
+}
+
+if (workerThreads.isMainThread)
+  runMain();
+else
+  runReader();
@@ -2,7 +2,11 @@
   "targets": [
     {
       "target_name": "fontmanager",
-      "sources": [ "src/FontManager.cc" ],
+      "variables": {
+        # build with -Dsanitize=thread or -Dsanitize=address to instrument the addon
+        "sanitize%": ""
+      },
+      "sources": [ "src/FontManager.cc", "src/StringCache.cc", "src/FontCatalog.cc", "src/SharedCatalog.cc", "src/RequestQueue.cc", "src/FontMetrics.cc", "src/FamilySearch.cc", "src/ResultCache.cc", "src/CatalogScan.cc" ],
       "include_dirs" : [
         "<!(node -e \"require('nan')\")"
       ],
@@ -16,13 +20,21 @@
         ['OS=="win"', {
           "sources": ["src/FontManagerWindows.cc"],
           "link_settings": {
-            "libraries": ["Dwrite.lib"]
+            "libraries": ["Dwrite.lib", "Advapi32.lib"]
           }
         }],
         ['OS=="linux"', {
           "sources": ["src/FontManagerLinux.cc"],
           "link_settings": {
-            "libraries": ["-lfontconfig"]
+            "libraries": ["-lfontconfig", "-lrt"]
+          }
+        }],
+        ['sanitize!=""', {
+          "cflags": ["-fsanitize=<(sanitize)", "-fno-omit-frame-pointer", "-g"],
+          "ldflags": ["-fsanitize=<(sanitize)"],
+          "xcode_settings": {
+            "OTHER_CFLAGS": ["-fsanitize=<(sanitize)", "-fno-omit-frame-pointer", "-g"],
+            "OTHER_LDFLAGS": ["-fsanitize=<(sanitize)"]
           }
         }]
       ]
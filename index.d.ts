@@ -8,6 +8,112 @@ declare module 'font-manager' {
         readonly italic: boolean;
         readonly monospace: boolean;
         readonly postscriptName: string;
+        readonly variations?: { readonly [tag: string]: number };
+    }
+
+    export interface FontFamily {
+        readonly family: string;
+        readonly faces: FontDescriptor[];
+    }
+
+    export interface FontFallback {
+        readonly codepoint: number;
+        readonly font: FontDescriptor | null;
+    }
+
+    export interface FontStackResult {
+        readonly family: string | null;
+        readonly font: FontDescriptor | null;
+        readonly fallbacks?: FontFallback[];
+    }
+
+    export interface FallbackFont {
+        readonly font: FontDescriptor;
+        readonly coverage: number;
+        readonly totalCoverage: number;
+    }
+
+    export interface RequestOptions {
+        readonly priority?: number;
+        readonly timeout?: number;
+        readonly signal?: AbortSignal;
+    }
+
+    export interface FallbackChainOptions extends RequestOptions {
+        readonly lang?: string;
+        readonly limit?: number;
+    }
+
+    export interface SearchFamiliesOptions extends RequestOptions {
+        readonly limit?: number;
+    }
+
+    export interface CacheLimits {
+        readonly maxEntries?: number;
+        readonly maxFonts?: number;
+        readonly maxStringBytes?: number;
+    }
+
+    export interface CacheStats {
+        readonly hits: number;
+        readonly misses: number;
+        readonly evictions: number;
+        readonly invalidations: number;
+        readonly entries: number;
+        readonly fonts: number;
+        readonly maxEntries: number;
+        readonly maxFonts: number;
+        readonly strings: number;
+        readonly stringBytes: number;
+        readonly stringEvictions: number;
+        readonly maxStringBytes: number;
+    }
+
+    export interface CatalogStats {
+        readonly generation: number;
+        readonly fonts: number;
+        readonly families: number;
+        readonly paths: number;
+        readonly size: number;
+        readonly pathsSize: number;
+        readonly rawPathsSize: number;
+        readonly namesSize: number;
+        readonly rawNamesSize: number;
+    }
+
+    export interface FontMetrics {
+        readonly unitsPerEm: number;
+        readonly ascent: number;
+        readonly descent: number;
+        readonly lineGap: number;
+        readonly capHeight: number;
+        readonly xHeight: number;
+        readonly italicAngle: number;
+    }
+
+    export interface FontAxis {
+        readonly tag: string;
+        readonly name: string;
+        readonly min: number;
+        readonly default: number;
+        readonly max: number;
+        readonly hidden: boolean;
+    }
+
+    export interface FontInstance {
+        readonly name: string;
+        readonly postscriptName: string | null;
+        readonly coordinates: { readonly [tag: string]: number };
+    }
+
+    export interface FontVariations {
+        readonly axes: FontAxis[];
+        readonly instances: FontInstance[];
+    }
+
+    export interface MeasureTextOptions extends RequestOptions {
+        readonly kerning?: boolean;
+        readonly advances?: boolean;
     }
 
     export interface QueryFontDescriptor {
@@ -19,6 +125,34 @@ declare module 'font-manager' {
         readonly italic?: boolean;
         readonly monospace?: boolean;
         readonly postscriptName?: string;
+        readonly lang?: string;
+        readonly script?: string;
+    }
+
+    /**
+     * An inclusive range of weights or widths. Either end may be left out
+     */
+    export interface FontRange {
+        readonly min?: number;
+        readonly max?: number;
+    }
+
+    /**
+     * A findFonts query, which can also match ranges of weights and widths,
+     * any of a list of families, and the start of the path
+     */
+    export interface FindFontsQuery {
+        readonly path?: string;
+        readonly style?: string;
+        readonly width?: number | FontRange;
+        readonly family?: string | string[];
+        readonly weight?: number | FontRange;
+        readonly italic?: boolean;
+        readonly monospace?: boolean;
+        readonly postscriptName?: string;
+        readonly lang?: string;
+        readonly script?: string;
+        readonly pathPrefix?: string;
     }
 
     /**
@@ -38,6 +172,7 @@ declare module 'font-manager' {
      * getAvailableFonts((fonts) => { ... });
      */
     export function getAvailableFonts(callback: (fonts: FontDescriptor[]) => void): void;
+    export function getAvailableFonts(options: RequestOptions, callback: (fonts: FontDescriptor[] | Error) => void): void;
 
     /**
      * Queries all the fonts in the system matching the given parameters
@@ -48,7 +183,7 @@ declare module 'font-manager' {
      * findFontsSync();
      * @returns All fonts descriptors matching query parameters
      */
-    export function findFontsSync(fontDescriptor: QueryFontDescriptor | undefined): FontDescriptor[];
+    export function findFontsSync(fontDescriptor: FindFontsQuery | undefined): FontDescriptor[];
 
     /**
      * Queries all the fonts in the system matching the given parameters
@@ -59,7 +194,8 @@ declare module 'font-manager' {
      * findFonts({ family: 'Arial' }, (fonts) => { ... });
      * findFonts((fonts) => { ... });
      */
-    export function findFonts(fontDescriptor: QueryFontDescriptor | undefined, callback: (fonts: FontDescriptor[]) => void);
+    export function findFonts(fontDescriptor: FindFontsQuery | undefined, callback: (fonts: FontDescriptor[]) => void);
+    export function findFonts(fontDescriptor: FindFontsQuery | undefined, options: RequestOptions, callback: (fonts: FontDescriptor[] | Error) => void);
 
     /**
      * Find only one font matching the given query. This function always returns
@@ -86,6 +222,7 @@ declare module 'font-manager' {
      * @returns Only one font description matching those query parameters
      */
     export function findFont(fontDescriptor: QueryFontDescriptor | undefined, callback: (font: FontDescriptor) => void);
+    export function findFont(fontDescriptor: QueryFontDescriptor | undefined, options: RequestOptions, callback: (font: FontDescriptor | Error) => void);
 
     /**
      * Substitutes the font with the given post script name with another font
@@ -115,4 +252,399 @@ declare module 'font-manager' {
      * @param text Characters for matching
      */
     export function substituteFont(postscriptName: string, text: string, callback: (font: FontDescriptor) => void);
+    export function substituteFont(postscriptName: string, text: string, options: RequestOptions, callback: (font: FontDescriptor | Error) => void);
+
+    /**
+     * Fetches the font families in the system, each with its faces sorted
+     * by weight, width and slant
+     *
+     * @example
+     * getFontFamiliesSync();
+     * @returns All font families available
+     */
+    export function getFontFamiliesSync(): FontFamily[];
+
+    /**
+     * Returns trough a callback the font families in the system, each with
+     * its faces sorted by weight, width and slant
+     *
+     * @param callback Contains the font families
+     * @example
+     * getFontFamilies((families) => { ... });
+     */
+    export function getFontFamilies(callback: (families: FontFamily[]) => void): void;
+    export function getFontFamilies(options: RequestOptions, callback: (families: FontFamily[] | Error) => void): void;
+
+    /**
+     * Fetches the names of the font families in the system
+     *
+     * @example
+     * getFamilyNamesSync();
+     * @returns All font family names, sorted
+     */
+    export function getFamilyNamesSync(): string[];
+
+    /**
+     * Returns trough a callback the names of the font families in the system
+     *
+     * @param callback Contains the family names
+     * @example
+     * getFamilyNames((names) => { ... });
+     */
+    export function getFamilyNames(callback: (names: string[]) => void): void;
+    export function getFamilyNames(options: RequestOptions, callback: (names: string[] | Error) => void): void;
+
+    /**
+     * Finds the font families whose names match a query typed so far,
+     * ignoring case and diacritics, best matches first
+     *
+     * @param query The text to search for
+     * @param options The maximum number of families to return
+     * @example
+     * searchFamiliesSync('helv', { limit: 5 });
+     * @returns The names of the matching families
+     */
+    export function searchFamiliesSync(query: string, options?: SearchFamiliesOptions): string[];
+
+    /**
+     * Finds the font families whose names match a query typed so far,
+     * ignoring case and diacritics, best matches first
+     *
+     * @param query The text to search for
+     * @param options The maximum number of families to return
+     * @example
+     * searchFamilies('helv', (names) => { ... });
+     */
+    export function searchFamilies(query: string, callback: (names: string[]) => void): void;
+    export function searchFamilies(query: string, options: SearchFamiliesOptions, callback: (names: string[] | Error) => void): void;
+
+    /**
+     * Resolves a CSS font-family list to the first family in it that exists.
+     * Generic families such as sans-serif are resolved to the fonts the
+     * system uses for them. If text is given, a fallback font is also found
+     * for each code point in it that the resolved font does not support
+     *
+     * @param families Font family names, in order of preference
+     * @param fontDescriptor Traits (weight, width, italic...) to match
+     * @param text Characters that need to be displayed
+     * @example
+     * resolveFontStackSync(['Brand Sans', 'Helvetica', 'sans-serif'], { weight: 700 });
+     * @returns The resolved family and font, and fallbacks if text was given
+     */
+    export function resolveFontStackSync(families: string[], fontDescriptor: QueryFontDescriptor, text?: string): FontStackResult;
+
+    /**
+     * Resolves a CSS font-family list to the first family in it that exists.
+     * Generic families such as sans-serif are resolved to the fonts the
+     * system uses for them. If text is given, a fallback font is also found
+     * for each code point in it that the resolved font does not support
+     *
+     * @param families Font family names, in order of preference
+     * @param fontDescriptor Traits (weight, width, italic...) to match
+     * @param text Characters that need to be displayed
+     * @example
+     * resolveFontStack(['Brand Sans', 'Helvetica', 'sans-serif'], { weight: 700 }, (result) => { ... });
+     */
+    export function resolveFontStack(families: string[], fontDescriptor: QueryFontDescriptor, callback: (result: FontStackResult) => void): void;
+    export function resolveFontStack(families: string[], fontDescriptor: QueryFontDescriptor, options: RequestOptions, callback: (result: FontStackResult | Error) => void): void;
+    export function resolveFontStack(families: string[], fontDescriptor: QueryFontDescriptor, text: string, callback: (result: FontStackResult) => void): void;
+    export function resolveFontStack(families: string[], fontDescriptor: QueryFontDescriptor, text: string, options: RequestOptions, callback: (result: FontStackResult | Error) => void): void;
+
+    /**
+     * Returns the ordered list of fonts to fall back to for the font with the
+     * given post script name, starting with the font itself. Fonts that don't
+     * support any characters the fonts before them lack are left out. Chains
+     * are cached until the installed fonts change. Returns null if there is
+     * no font with the name
+     *
+     * @param postscriptName Name of the primary font
+     * @param options Language to prefer fonts for, and maximum number of fonts to return
+     * @example
+     * getFallbackChainSync('LiberationSans', { lang: 'ja', limit: 5 });
+     * @returns The fallback fonts, with the number of characters each one adds
+     */
+    export function getFallbackChainSync(postscriptName: string, options?: FallbackChainOptions): FallbackFont[] | null;
+
+    /**
+     * Returns the ordered list of fonts to fall back to for the font with the
+     * given post script name, starting with the font itself. Fonts that don't
+     * support any characters the fonts before them lack are left out. Chains
+     * are cached until the installed fonts change. Returns null if there is
+     * no font with the name
+     *
+     * @param postscriptName Name of the primary font
+     * @param options Language to prefer fonts for, and maximum number of fonts to return
+     * @example
+     * getFallbackChain('LiberationSans', { lang: 'ja', limit: 5 }, (chain) => { ... });
+     */
+    export function getFallbackChain(postscriptName: string, callback: (chain: FallbackFont[] | null) => void): void;
+    export function getFallbackChain(postscriptName: string, options: FallbackChainOptions, callback: (chain: FallbackFont[] | null | Error) => void): void;
+
+    /**
+     * Returns the font with the given post script name, or null if there is
+     * no such font. Unlike findFont, a different font is never returned
+     *
+     * @param postscriptName Name of the font, or an array of names
+     * @example
+     * getFontByPostscriptNameSync('Arial-BoldMT');
+     * @returns The font, or an array with a font or null for each name
+     */
+    export function getFontByPostscriptNameSync(postscriptName: string): FontDescriptor | null;
+    export function getFontByPostscriptNameSync(postscriptNames: string[]): (FontDescriptor | null)[];
+
+    /**
+     * Returns the font with the given post script name, or null if there is
+     * no such font. Unlike findFont, a different font is never returned
+     *
+     * @param postscriptName Name of the font, or an array of names
+     * @example
+     * getFontByPostscriptName('Arial-BoldMT', (font) => { ... });
+     */
+    export function getFontByPostscriptName(postscriptName: string, callback: (font: FontDescriptor | null) => void): void;
+    export function getFontByPostscriptName(postscriptName: string, options: RequestOptions, callback: (font: FontDescriptor | null | Error) => void): void;
+    export function getFontByPostscriptName(postscriptNames: string[], callback: (fonts: (FontDescriptor | null)[]) => void): void;
+    export function getFontByPostscriptName(postscriptNames: string[], options: RequestOptions, callback: (fonts: (FontDescriptor | null)[] | Error) => void): void;
+
+    /**
+     * Returns the font stored in the file at the given path, or null if it
+     * is not one of the available fonts
+     *
+     * @param path Path to the font file, or an array of paths
+     * @example
+     * getFontByPathSync('/Library/Fonts/Arial Bold.ttf');
+     * @returns The font, or an array with a font or null for each path
+     */
+    export function getFontByPathSync(path: string): FontDescriptor | null;
+    export function getFontByPathSync(paths: string[]): (FontDescriptor | null)[];
+
+    /**
+     * Returns the font stored in the file at the given path, or null if it
+     * is not one of the available fonts
+     *
+     * @param path Path to the font file, or an array of paths
+     * @example
+     * getFontByPath('/Library/Fonts/Arial Bold.ttf', (font) => { ... });
+     */
+    export function getFontByPath(path: string, callback: (font: FontDescriptor | null) => void): void;
+    export function getFontByPath(path: string, options: RequestOptions, callback: (font: FontDescriptor | null | Error) => void): void;
+    export function getFontByPath(paths: string[], callback: (fonts: (FontDescriptor | null)[]) => void): void;
+    export function getFontByPath(paths: string[], options: RequestOptions, callback: (fonts: (FontDescriptor | null)[] | Error) => void): void;
+
+    /**
+     * Finds the fonts matching the query like findFontsSync, and returns
+     * their IDs. IDs are derived from the path and face index of a font, so
+     * they stay the same when the font list is refreshed. A font keeps its
+     * ID for as long as the process runs, but if its ID collided with a font
+     * whose path sorts first, another process may give it a different one
+     *
+     * @param fontDescriptor Query parameters
+     * @returns The IDs of the matching fonts
+     */
+    export function findFontIdsSync(fontDescriptor: FindFontsQuery): Uint32Array;
+
+    /**
+     * Finds the fonts matching the query like findFonts, and returns
+     * their IDs
+     *
+     * @param fontDescriptor Query parameters
+     */
+    export function findFontIds(fontDescriptor: FindFontsQuery, callback: (ids: Uint32Array) => void): void;
+    export function findFontIds(fontDescriptor: FindFontsQuery, options: RequestOptions, callback: (ids: Uint32Array | Error) => void): void;
+
+    /**
+     * Substitutes a font like substituteFontSync, and returns the ID of the
+     * font, or null if it is not in the font list
+     *
+     * @param postscriptName Name of the font to be replaced
+     * @param text Characters for matching
+     */
+    export function substituteFontIdSync(postscriptName: string, text: string): number | null;
+
+    /**
+     * Substitutes a font like substituteFont, and returns the ID of the
+     * font, or null if it is not in the font list
+     *
+     * @param postscriptName Name of the font to be replaced
+     * @param text Characters for matching
+     */
+    export function substituteFontId(postscriptName: string, text: string, callback: (id: number | null) => void): void;
+    export function substituteFontId(postscriptName: string, text: string, options: RequestOptions, callback: (id: number | null | Error) => void): void;
+
+    /**
+     * Returns the font with the given ID, or null if there is no such font
+     *
+     * @param id A font ID, or an array of IDs
+     * @example
+     * getFontsByIdSync(findFontIdsSync({ family: 'Arial' }));
+     * @returns The font, or an array with a font or null for each ID
+     */
+    export function getFontsByIdSync(id: number): FontDescriptor | null;
+    export function getFontsByIdSync(ids: number[] | Uint32Array): (FontDescriptor | null)[];
+
+    /**
+     * Returns the font with the given ID, or null if there is no such font
+     *
+     * @param id A font ID, or an array of IDs
+     */
+    export function getFontsById(id: number, callback: (font: FontDescriptor | null) => void): void;
+    export function getFontsById(id: number, options: RequestOptions, callback: (font: FontDescriptor | null | Error) => void): void;
+    export function getFontsById(ids: number[] | Uint32Array, callback: (fonts: (FontDescriptor | null)[]) => void): void;
+    export function getFontsById(ids: number[] | Uint32Array, options: RequestOptions, callback: (fonts: (FontDescriptor | null)[] | Error) => void): void;
+
+    /**
+     * Returns the vertical metrics of a font, read from its head, hhea, OS/2
+     * and post tables. Metrics are cached until the font file is modified
+     *
+     * @param font Post script name or font descriptor, or an array of them
+     * @example
+     * getFontMetricsSync('ArialMT');
+     * @returns The metrics, or null if the font can't be found or read
+     */
+    export function getFontMetricsSync(font: string | QueryFontDescriptor): FontMetrics | null;
+    export function getFontMetricsSync(fonts: (string | QueryFontDescriptor)[]): (FontMetrics | null)[];
+
+    /**
+     * Returns the vertical metrics of a font, read from its head, hhea, OS/2
+     * and post tables. Metrics are cached until the font file is modified
+     *
+     * @param font Post script name or font descriptor, or an array of them
+     * @example
+     * getFontMetrics('ArialMT', (metrics) => { ... });
+     */
+    export function getFontMetrics(font: string | QueryFontDescriptor, callback: (metrics: FontMetrics | null) => void): void;
+    export function getFontMetrics(font: string | QueryFontDescriptor, options: RequestOptions, callback: (metrics: FontMetrics | null | Error) => void): void;
+    export function getFontMetrics(fonts: (string | QueryFontDescriptor)[], callback: (metrics: (FontMetrics | null)[]) => void): void;
+    export function getFontMetrics(fonts: (string | QueryFontDescriptor)[], options: RequestOptions, callback: (metrics: (FontMetrics | null)[] | Error) => void): void;
+
+    /**
+     * Returns the axes and named instances of a variable font, read from its
+     * fvar table. Static fonts have no axes or instances
+     *
+     * @param font Post script name or font descriptor
+     * @example
+     * getFontVariationsSync('Bahnschrift');
+     * @returns The variations, or null if the font can't be found or read
+     */
+    export function getFontVariationsSync(font: string | QueryFontDescriptor): FontVariations | null;
+
+    /**
+     * Returns the axes and named instances of a variable font, read from its
+     * fvar table. Static fonts have no axes or instances
+     *
+     * @param font Post script name or font descriptor
+     * @example
+     * getFontVariations('Bahnschrift', (variations) => { ... });
+     */
+    export function getFontVariations(font: string | QueryFontDescriptor, callback: (variations: FontVariations | null) => void): void;
+    export function getFontVariations(font: string | QueryFontDescriptor, options: RequestOptions, callback: (variations: FontVariations | null | Error) => void): void;
+
+    /**
+     * Measures the width of text set in a font from the advances in its hmtx
+     * table, adjusted by the pair kerning in its GPOS or kern table. Glyph
+     * data is cached until the font file is modified
+     *
+     * @param font Post script name or font descriptor
+     * @param text String to measure, or an array of strings
+     * @param size Font size to measure at
+     * @param options Whether to apply kerning, and whether to return the advance of each code point
+     * @example
+     * measureTextSync('ArialMT', 'Hello world', 16);
+     * @returns The width, or the widths or advances, or null if the font can't be found or read
+     */
+    export function measureTextSync(font: string | QueryFontDescriptor, text: string, size: number, options?: MeasureTextOptions & { advances?: false }): number | null;
+    export function measureTextSync(font: string | QueryFontDescriptor, text: string[], size: number, options?: MeasureTextOptions): Float32Array | null;
+    export function measureTextSync(font: string | QueryFontDescriptor, text: string, size: number, options: MeasureTextOptions & { advances: true }): Float32Array | null;
+    export function measureTextSync(font: string | QueryFontDescriptor, text: string[], size: number, options: MeasureTextOptions & { advances: true }): Float32Array[] | null;
+
+    /**
+     * Measures the width of text set in a font from the advances in its hmtx
+     * table, adjusted by the pair kerning in its GPOS or kern table. Glyph
+     * data is cached until the font file is modified
+     *
+     * @param font Post script name or font descriptor
+     * @param text String to measure, or an array of strings
+     * @param size Font size to measure at
+     * @param options Whether to apply kerning, and whether to return the advance of each code point
+     * @example
+     * measureText('ArialMT', 'Hello world', 16, (width) => { ... });
+     */
+    export function measureText(font: string | QueryFontDescriptor, text: string, size: number, callback: (width: number | null) => void): void;
+    export function measureText(font: string | QueryFontDescriptor, text: string[], size: number, callback: (widths: Float32Array | null) => void): void;
+    export function measureText(font: string | QueryFontDescriptor, text: string | string[], size: number, options: MeasureTextOptions, callback: (result: number | Float32Array | Float32Array[] | null | Error) => void): void;
+
+    /**
+     * Starts building the catalog of available fonts in the background.
+     * Requests made in the meantime wait for it instead of building their own
+     *
+     * @example
+     * prewarm().then(() => { ... });
+     * @returns A promise that resolves once the catalog is ready
+     */
+    export function prewarm(): Promise<void>;
+
+    /**
+     * Rebuilds the catalog of available fonts now, rather than when the
+     * platform next reports that fonts changed. Queries keep using the
+     * previous catalog until the new one is ready
+     *
+     * @returns The generation of the new catalog
+     */
+    export function refreshCatalogSync(): number;
+
+    /**
+     * Changes the limits of the cache of findFont and findFonts results,
+     * and the size of the calling thread's cache of result strings.
+     * Setting either result limit to 0 disables the result cache
+     *
+     * @param limits The maximum number of cached queries, of fonts in them,
+     * and of bytes of cached strings
+     */
+    export function configureCache(limits: CacheLimits): void;
+
+    /**
+     * Returns how often the cache of findFont and findFonts results was
+     * used, and how much it and the calling thread's string cache hold
+     */
+    export function getCacheStats(): CacheStats;
+
+    /**
+     * Returns the size of the catalog of available fonts in bytes, and the
+     * size its paths and names would take as a separate string per font
+     */
+    export function getCatalogStats(): CatalogStats;
+
+    /**
+     * Rebuilds the catalog of available fonts now, rather than when the
+     * platform next reports that fonts changed. Queries keep using the
+     * previous catalog until the new one is ready
+     */
+    export function refreshCatalog(callback: (generation: number) => void): void;
+    export function refreshCatalog(options: RequestOptions, callback: (generation: number | Error) => void): void;
+
+    /**
+     * Publishes the catalog of available fonts to shared memory under the
+     * given name, so other processes can attach to it instead of enumerating
+     * the fonts themselves. Not supported on Windows
+     *
+     * @param name Name of the shared memory segment
+     * @example
+     * publishCatalog('font-manager');
+     * @returns The generation of the published catalog
+     */
+    export function publishCatalog(name: string): number;
+
+    /**
+     * Switches this process over to the catalog published under the given name
+     *
+     * @param name Name the catalog was published under
+     * @example
+     * attachCatalog('font-manager');
+     * @returns The generation of the shared catalog
+     */
+    export function attachCatalog(name: string): number;
+
+    /**
+     * Stops publishing or reading a shared catalog
+     */
+    export function detachCatalog(): void;
 }
@@ -0,0 +1,152 @@
+#include <string.h>
+#include "CatalogScan.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CATALOG_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+// a value is in [min, max] if it is at most max - min after subtracting
+// min, with unsigned wraparound, so each range takes a single comparison
+template<typename T>
+static uint32_t matchRange(const T *values, T min, T span) {
+  uint32_t bits = 0;
+  for (int i = 0; i < 32; i++) {
+    bits |= (uint32_t) ((T) (values[i] - min) <= span) << i;
+  }
+
+  return bits;
+}
+
+#ifdef CATALOG_SCAN_SSE2
+
+// SSE2 has no unsigned comparisons, but a saturating subtraction of the
+// span leaves zero exactly for the values that are at most the span
+static inline uint32_t matchRange8(const uint8_t *values, __m128i min, __m128i span) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = _mm_subs_epu8(_mm_sub_epi8(_mm_loadu_si128((const __m128i *) values), min), span);
+  __m128i b = _mm_subs_epu8(_mm_sub_epi8(_mm_loadu_si128((const __m128i *) (values + 16)), min), span);
+  return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) |
+    (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(b, zero)) << 16;
+}
+
+// compares 16 values, and packs the 16 bit results into a byte each
+static inline uint32_t matchRange16(const uint16_t *values, __m128i min, __m128i span) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = _mm_subs_epu16(_mm_sub_epi16(_mm_loadu_si128((const __m128i *) values), min), span);
+  __m128i b = _mm_subs_epu16(_mm_sub_epi16(_mm_loadu_si128((const __m128i *) (values + 8)), min), span);
+  return (uint32_t) _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(b, zero)));
+}
+
+// finds the 16 values above the span, comparing them as signed numbers
+// with their sign bits flipped, and packs the results into a byte each
+static inline uint32_t matchRange32(const uint32_t *values, __m128i min, __m128i span) {
+  __m128i sign = _mm_set1_epi32((int) 0x80000000);
+  __m128i above[4];
+  for (int i = 0; i < 4; i++) {
+    __m128i value = _mm_sub_epi32(_mm_loadu_si128((const __m128i *) (values + i * 4)), min);
+    above[i] = _mm_cmpgt_epi32(_mm_xor_si128(value, sign), span);
+  }
+
+  __m128i packed = _mm_packs_epi16(_mm_packs_epi32(above[0], above[1]), _mm_packs_epi32(above[2], above[3]));
+  return ~(uint32_t) _mm_movemask_epi8(packed) & 0xffff;
+}
+
+#endif
+
+void selectRange(const uint8_t *values, uint32_t words, uint8_t min, uint8_t max, uint32_t *selection) {
+  if (min > max) {
+    memset(selection, 0, words * sizeof(uint32_t));
+    return;
+  }
+
+#ifdef CATALOG_SCAN_SSE2
+  __m128i vmin = _mm_set1_epi8((char) min);
+  __m128i vspan = _mm_set1_epi8((char) (max - min));
+#endif
+
+  for (uint32_t i = 0; i < words; i++) {
+    if (!selection[i])
+      continue;
+
+#ifdef CATALOG_SCAN_SSE2
+    selection[i] &= matchRange8(values + i * 32, vmin, vspan);
+#else
+    selection[i] &= matchRange<uint8_t>(values + i * 32, min, max - min);
+#endif
+  }
+}
+
+void selectRange(const uint16_t *values, uint32_t words, uint16_t min, uint16_t max, uint32_t *selection) {
+  if (min > max) {
+    memset(selection, 0, words * sizeof(uint32_t));
+    return;
+  }
+
+#ifdef CATALOG_SCAN_SSE2
+  __m128i vmin = _mm_set1_epi16((short) min);
+  __m128i vspan = _mm_set1_epi16((short) (max - min));
+#endif
+
+  for (uint32_t i = 0; i < words; i++) {
+    if (!selection[i])
+      continue;
+
+#ifdef CATALOG_SCAN_SSE2
+    const uint16_t *p = values + i * 32;
+    selection[i] &= matchRange16(p, vmin, vspan) | matchRange16(p + 16, vmin, vspan) << 16;
+#else
+    selection[i] &= matchRange<uint16_t>(values + i * 32, min, max - min);
+#endif
+  }
+}
+
+void selectRange(const uint32_t *values, uint32_t words, uint32_t min, uint32_t max, uint32_t *selection) {
+  if (min > max) {
+    memset(selection, 0, words * sizeof(uint32_t));
+    return;
+  }
+
+#ifdef CATALOG_SCAN_SSE2
+  __m128i vmin = _mm_set1_epi32((int) min);
+  __m128i vspan = _mm_set1_epi32((int) ((max - min) ^ 0x80000000));
+#endif
+
+  for (uint32_t i = 0; i < words; i++) {
+    if (!selection[i])
+      continue;
+
+#ifdef CATALOG_SCAN_SSE2
+    const uint32_t *p = values + i * 32;
+    selection[i] &= matchRange32(p, vmin, vspan) | matchRange32(p + 16, vmin, vspan) << 16;
+#else
+    selection[i] &= matchRange<uint32_t>(values + i * 32, min, max - min);
+#endif
+  }
+}
+
+void selectFlags(const uint8_t *values, uint32_t words, uint8_t mask, uint32_t *selection) {
+#ifdef CATALOG_SCAN_SSE2
+  __m128i vmask = _mm_set1_epi8((char) mask);
+#endif
+
+  for (uint32_t i = 0; i < words; i++) {
+    if (!selection[i])
+      continue;
+
+    const uint8_t *p = values + i * 32;
+#ifdef CATALOG_SCAN_SSE2
+    __m128i a = _mm_loadu_si128((const __m128i *) p);
+    __m128i b = _mm_loadu_si128((const __m128i *) (p + 16));
+    selection[i] &= (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(a, vmask), vmask)) |
+      (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(b, vmask), vmask)) << 16;
+#else
+    uint32_t bits = 0;
+    for (int j = 0; j < 32; j++) {
+      bits |= (uint32_t) ((p[j] & mask) == mask) << j;
+    }
+
+    selection[i] &= bits;
+#endif
+  }
+}
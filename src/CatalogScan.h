@@ -0,0 +1,19 @@
+#ifndef CATALOG_SCAN_H
+#define CATALOG_SCAN_H
+#include <stdint.h>
+
+// Scans over the columns of the catalog, which hold one field of every font
+// in catalog order. Each scan reads words * 32 values and clears the bits
+// of the fonts that don't match in selection, a bitset with 32 fonts per
+// word. Words with no fonts left are skipped. The scans compare 16 or 32
+// values at a time with SSE2 on x86, and one at a time elsewhere.
+
+// keeps the fonts whose values are between min and max, inclusive
+void selectRange(const uint8_t *values, uint32_t words, uint8_t min, uint8_t max, uint32_t *selection);
+void selectRange(const uint16_t *values, uint32_t words, uint16_t min, uint16_t max, uint32_t *selection);
+void selectRange(const uint32_t *values, uint32_t words, uint32_t min, uint32_t max, uint32_t *selection);
+
+// keeps the fonts whose values have all the bits of mask set
+void selectFlags(const uint8_t *values, uint32_t words, uint8_t mask, uint32_t *selection);
+
+#endif
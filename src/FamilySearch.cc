@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <string.h>
+#include <unordered_set>
+#include "FamilySearch.h"
+#include "FontCatalog.h"
+#include "Unicode.h"
+
+// latin letters with diacritics and the letters they fold to
+static const struct {
+  uint16_t first;
+  uint16_t last;
+  const char *folded;
+} latinLetters[] = {
+  { 0x00c0, 0x00c5, "a" }, { 0x00c6, 0x00c6, "ae" }, { 0x00c7, 0x00c7, "c" },
+  { 0x00c8, 0x00cb, "e" }, { 0x00cc, 0x00cf, "i" }, { 0x00d0, 0x00d0, "d" },
+  { 0x00d1, 0x00d1, "n" }, { 0x00d2, 0x00d6, "o" }, { 0x00d8, 0x00d8, "o" },
+  { 0x00d9, 0x00dc, "u" }, { 0x00dd, 0x00dd, "y" }, { 0x00de, 0x00de, "th" },
+  { 0x00df, 0x00df, "ss" }, { 0x00e0, 0x00e5, "a" }, { 0x00e6, 0x00e6, "ae" },
+  { 0x00e7, 0x00e7, "c" }, { 0x00e8, 0x00eb, "e" }, { 0x00ec, 0x00ef, "i" },
+  { 0x00f0, 0x00f0, "d" }, { 0x00f1, 0x00f1, "n" }, { 0x00f2, 0x00f6, "o" },
+  { 0x00f8, 0x00f8, "o" }, { 0x00f9, 0x00fc, "u" }, { 0x00fd, 0x00fd, "y" },
+  { 0x00fe, 0x00fe, "th" }, { 0x00ff, 0x00ff, "y" }, { 0x0100, 0x0105, "a" },
+  { 0x0106, 0x010d, "c" }, { 0x010e, 0x0111, "d" }, { 0x0112, 0x011b, "e" },
+  { 0x011c, 0x0123, "g" }, { 0x0124, 0x0127, "h" }, { 0x0128, 0x0131, "i" },
+  { 0x0132, 0x0133, "ij" }, { 0x0134, 0x0135, "j" }, { 0x0136, 0x0138, "k" },
+  { 0x0139, 0x0142, "l" }, { 0x0143, 0x014b, "n" }, { 0x014c, 0x0151, "o" },
+  { 0x0152, 0x0153, "oe" }, { 0x0154, 0x0159, "r" }, { 0x015a, 0x0161, "s" },
+  { 0x0162, 0x0167, "t" }, { 0x0168, 0x0173, "u" }, { 0x0174, 0x0175, "w" },
+  { 0x0176, 0x0178, "y" }, { 0x0179, 0x017e, "z" }, { 0x017f, 0x017f, "s" }
+};
+
+// whether a code point separates the words of a name
+static bool isSeparator(uint32_t c) {
+  if (c < 0x80)
+    return !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'));
+
+  return c == 0x00a0 || (c >= 0x2000 && c <= 0x206f) || c == 0x3000;
+}
+
+// appends the folded form of a code point to a string
+static void appendFolded(std::string &str, uint32_t c) {
+  if (c >= 'A' && c <= 'Z') {
+    str.push_back((char) (c + 32));
+    return;
+  }
+
+  if (c >= 0x00c0 && c <= 0x017f) {
+    for (size_t i = 0; i < sizeof(latinLetters) / sizeof(latinLetters[0]); i++) {
+      if (c >= latinLetters[i].first && c <= latinLetters[i].last) {
+        str.append(latinLetters[i].folded);
+        return;
+      }
+    }
+  }
+
+  // greek and cyrillic capitals
+  if ((c >= 0x0391 && c <= 0x03a9) || (c >= 0x0410 && c <= 0x042f))
+    c += 0x20;
+  else if (c >= 0x0400 && c <= 0x040f)
+    c += 0x50;
+
+  char buf[5];
+  str.append(buf, encodeUtf8(c, buf));
+}
+
+std::string foldSearchString(const char *str) {
+  std::string res;
+  int length = strlen(str);
+  bool space = false;
+
+  for (int i = 0; i < length;) {
+    uint32_t c;
+    i += decodeUtf8(str + i, length - i, &c);
+    if (isSeparator(c)) {
+      space = !res.empty();
+      continue;
+    }
+
+    if (space) {
+      res.push_back(' ');
+      space = false;
+    }
+
+    appendFolded(res, c);
+  }
+
+  return res;
+}
+
+// orders words by the text from each of them on
+struct FamilySearch::CompareWords {
+  const char *text;
+
+  CompareWords(const char *text) : text(text) {}
+
+  bool operator()(const Word &a, const Word &b) const {
+    return strcmp(text + a.offset, text + b.offset) < 0;
+  }
+
+  bool operator()(const Word &a, const char *query) const {
+    return strcmp(text + a.offset, query) < 0;
+  }
+};
+
+// returns the distinct trigrams of a string
+static std::vector<uint32_t> getTrigrams(const std::string &str) {
+  std::vector<uint32_t> res;
+  for (size_t i = 0; i + 2 < str.size(); i++) {
+    res.push_back((uint8_t) str[i] << 16 | (uint8_t) str[i + 1] << 8 | (uint8_t) str[i + 2]);
+  }
+
+  std::sort(res.begin(), res.end());
+  res.erase(std::unique(res.begin(), res.end()), res.end());
+  return res;
+}
+
+FamilySearch::FamilySearch(const FontCatalog *catalog) {
+  uint32_t count = catalog->familyCount();
+  names.resize(count);
+  lengths.resize(count);
+  trigramCounts.resize(count);
+
+  for (uint32_t i = 0; i < count; i++) {
+    const CatalogFamily &family = catalog->family(i);
+    std::string name = foldSearchString(catalog->string(family.name));
+    names[i] = text.size();
+    lengths[i] = name.size();
+    addName(name, i, name.size());
+
+    std::vector<uint32_t> keys = getTrigrams(" " + name + " ");
+    trigramCounts[i] = std::min(keys.size(), (size_t) 0xffff);
+    for (size_t j = 0; j < keys.size(); j++) {
+      trigrams[keys[j]].push_back(i);
+    }
+
+    // faces with the same style (in different formats, say) share a full name
+    std::unordered_set<std::string> styles;
+    for (uint32_t j = 0; j < family.faceCount; j++) {
+      const char *style = catalog->string(catalog->font(catalog->face(family.firstFace + j)).style);
+      if (!style)
+        continue;
+
+      std::string folded = foldSearchString(style);
+      if (!folded.empty() && styles.insert(folded).second)
+        addName(name + " " + folded, i, name.size());
+    }
+  }
+
+  if (!words.empty())
+    std::sort(words.begin(), words.end(), CompareWords(&text[0]));
+}
+
+// adds a folded name to the text, and indexes its words. full names are
+// only indexed from their start and by the words of their style, since the
+// other words are those of the family name.
+void FamilySearch::addName(const std::string &name, uint32_t family, size_t familyLength) {
+  uint32_t offset = text.size();
+  text.insert(text.end(), name.begin(), name.end());
+  text.push_back('\0');
+
+  bool isFamily = familyLength == name.size();
+  for (size_t i = 0; i < name.size(); i++) {
+    if (i > 0 && name[i - 1] != ' ')
+      continue;
+
+    Word word;
+    word.offset = offset + i;
+    word.family = family;
+    if (i == 0)
+      word.kind = MatchPrefix;
+    else if (isFamily)
+      word.kind = MatchWord;
+    else if (i > familyLength)
+      word.kind = MatchStyle;
+    else
+      continue;
+
+    words.push_back(word);
+  }
+}
+
+// orders matches by kind, then by name length so that the closest names
+// come first, then in catalog order
+struct CompareMatches {
+  const std::vector<uint8_t> &kinds;
+  const std::vector<uint32_t> &lengths;
+
+  CompareMatches(const std::vector<uint8_t> &kinds, const std::vector<uint32_t> &lengths) : kinds(kinds), lengths(lengths) {}
+
+  bool operator()(uint32_t a, uint32_t b) const {
+    if (kinds[a] != kinds[b])
+      return kinds[a] < kinds[b];
+
+    if (lengths[a] != lengths[b])
+      return lengths[a] < lengths[b];
+
+    return a < b;
+  }
+};
+
+void FamilySearch::search(const char *query, uint32_t limit, std::vector<uint32_t> &res) const {
+  std::string folded = foldSearchString(query);
+  if (folded.empty()) {
+    for (uint32_t i = 0; i < names.size() && i < limit; i++) {
+      res.push_back(i);
+    }
+
+    return;
+  }
+
+  std::vector<uint8_t> kinds(names.size(), MatchNone);
+  std::vector<uint32_t> matches;
+  const char *base = text.empty() ? "" : &text[0];
+
+  std::vector<Word>::const_iterator it = std::lower_bound(words.begin(), words.end(), folded.c_str(), CompareWords(base));
+  for (; it != words.end() && strncmp(base + it->offset, folded.c_str(), folded.size()) == 0; it++) {
+    uint8_t kind = it->kind;
+    if (it->offset == names[it->family] && lengths[it->family] == folded.size())
+      kind = MatchExact;
+
+    if (kinds[it->family] == MatchNone)
+      matches.push_back(it->family);
+
+    if (kind < kinds[it->family])
+      kinds[it->family] = kind;
+  }
+
+  size_t count = std::min(matches.size(), (size_t) limit);
+  std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), CompareMatches(kinds, lengths));
+  matches.resize(count);
+
+  if (matches.size() < limit)
+    findSimilar(folded, kinds, matches);
+
+  for (size_t i = 0; i < matches.size() && i < limit; i++) {
+    res.push_back(matches[i]);
+  }
+}
+
+// a family name sharing trigrams with a query
+struct SimilarName {
+  uint32_t family;
+  uint32_t shared;  // the number of the query's trigrams in the name
+  double score;     // the Dice coefficient of the trigram sets
+
+  bool operator<(const SimilarName &other) const {
+    if (shared != other.shared)
+      return shared > other.shared;
+
+    if (score != other.score)
+      return score > other.score;
+
+    return family < other.family;
+  }
+};
+
+// appends the families whose names have at least half of the trigrams of
+// the query, most similar first
+void FamilySearch::findSimilar(const std::string &query, std::vector<uint8_t> &kinds, std::vector<uint32_t> &res) const {
+  // the query may end in the middle of a word, so only its start is padded
+  std::vector<uint32_t> keys = getTrigrams(" " + query);
+  if (keys.size() < 2)
+    return;
+
+  std::vector<uint16_t> counts(names.size(), 0);
+  std::vector<uint32_t> candidates;
+  for (size_t i = 0; i < keys.size(); i++) {
+    std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator it = trigrams.find(keys[i]);
+    if (it == trigrams.end())
+      continue;
+
+    for (size_t j = 0; j < it->second.size(); j++) {
+      uint32_t family = it->second[j];
+      if (counts[family]++ == 0)
+        candidates.push_back(family);
+    }
+  }
+
+  std::vector<SimilarName> similar;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    uint32_t family = candidates[i];
+    if (kinds[family] != MatchNone || counts[family] < 2 || counts[family] * 2 < keys.size())
+      continue;
+
+    SimilarName name;
+    name.family = family;
+    name.shared = counts[family];
+    name.score = 2.0 * counts[family] / (keys.size() + trigramCounts[family]);
+    similar.push_back(name);
+  }
+
+  std::sort(similar.begin(), similar.end());
+  for (size_t i = 0; i < similar.size(); i++) {
+    kinds[similar[i].family] = MatchSimilar;
+    res.push_back(similar[i].family);
+  }
+}
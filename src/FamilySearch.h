@@ -0,0 +1,61 @@
+#ifndef FAMILY_SEARCH_H
+#define FAMILY_SEARCH_H
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class FontCatalog;
+
+// folds a string for searching. letters are lowercased and latin letters
+// lose their diacritics, and runs of spaces and punctuation become a single
+// space, so that "Gill Sans MT" and "gill-sans mt" fold to the same string.
+std::string foldSearchString(const char *str);
+
+// An index of the family names in a catalog, and the full names (family
+// and style) of their faces, for typeahead searches. Every word of a name
+// is indexed by the folded text from that word on, sorted so that the words
+// starting with a query are next to each other, and each family name is
+// also indexed by its trigrams to find names with typos in them.
+class FamilySearch {
+public:
+  FamilySearch(const FontCatalog *catalog);
+
+  // finds the families matching a query, best first: exact matches, then
+  // names starting with the query, names with a word starting with it,
+  // full names with a style starting with it, and then similar names.
+  // appends at most limit family indices to res.
+  void search(const char *query, uint32_t limit, std::vector<uint32_t> &res) const;
+
+private:
+  // how well a family matches a query, from best to worst
+  enum MatchKind {
+    MatchExact,
+    MatchPrefix,
+    MatchWord,
+    MatchStyle,
+    MatchSimilar,
+    MatchNone
+  };
+
+  // a word of a family or full name
+  struct Word {
+    uint32_t offset;  // the start of the word in text
+    uint32_t family;
+    uint8_t kind;     // the match kind of a query starting with the word
+  };
+
+  struct CompareWords;
+
+  void addName(const std::string &name, uint32_t family, size_t familyLength);
+  void findSimilar(const std::string &query, std::vector<uint8_t> &kinds, std::vector<uint32_t> &res) const;
+
+  std::vector<char> text;           // folded names, each null terminated
+  std::vector<uint32_t> names;      // the offset of each family's folded name in text
+  std::vector<uint32_t> lengths;    // the length of each family's folded name
+  std::vector<Word> words;          // sorted by the text from each word on
+  std::unordered_map<uint32_t, std::vector<uint32_t> > trigrams; // the families with each trigram
+  std::vector<uint16_t> trigramCounts; // the number of distinct trigrams in each family name
+};
+
+#endif
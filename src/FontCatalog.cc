@@ -0,0 +1,1405 @@
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <uv.h>
+#include "CatalogScan.h"
+#include "FontCatalog.h"
+#include "SharedCatalog.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// these functions are implemented by the platform
+ResultSet *getAvailableFonts();
+bool fontsChanged();
+FallbackChain *getFallbackChain(char *, char *);
+
+// how often (in nanoseconds) to ask the backend whether the fonts changed
+#define CATALOG_CHECK_INTERVAL (5 * (uint64_t) 1e9)
+
+// the maximum number of memoized fallback chains
+#define MAX_FALLBACK_CHAINS 256
+
+// the catalog is read by every query, from every worker, and replaced as a
+// whole when the fonts change. a new version is built off to the side and
+// swapped in with an atomic store, so readers never take a lock once there
+// is a version to read, and keep using the one they loaded while a refresh
+// is running. a version is freed once the last query holding it is done.
+// catalog and shared are only read and written with std::atomic_load and
+// std::atomic_store, and only replaced with the refresh lock held.
+static uv_once_t catalogOnce = UV_ONCE_INIT;
+static uv_mutex_t refreshLock;
+static std::shared_ptr<FontCatalog> catalog;
+static std::atomic<unsigned int> generation(1);
+static std::atomic<uint64_t> lastCheck(0);
+
+// counts the times this process attached to or detached from a shared
+// catalog. the shared generations are numbered independently of ours, so
+// the epoch tells results from the two sources apart.
+static std::atomic<unsigned int> epoch(0);
+
+// the shared catalog this process publishes or is attached to, if any
+static std::shared_ptr<SharedCatalog> shared;
+
+// the memoized fallback chains of the current generation, and their keys
+// from the most to the least recently used
+typedef std::list<std::string> FallbackChainList;
+struct FallbackChainEntry {
+  std::shared_ptr<FallbackChain> chain;
+  FallbackChainList::iterator position;  // in fallbackChainOrder
+};
+
+typedef std::unordered_map<std::string, FallbackChainEntry> FallbackChainMap;
+static FallbackChainMap fallbackChains;
+static FallbackChainList fallbackChainOrder;
+static uint64_t fallbackChainsGeneration = 0;
+static uv_mutex_t fallbackChainsLock;
+
+static void initCatalogLocks() {
+  uv_mutex_init(&refreshLock);
+  uv_mutex_init(&fallbackChainsLock);
+}
+
+// compares two strings ignoring ASCII case
+static int compareIgnoreCase(const char *a, const char *b) {
+  for (;; a++, b++) {
+    int ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : (unsigned char) *a;
+    int cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : (unsigned char) *b;
+    if (ca != cb || ca == 0)
+      return ca - cb;
+  }
+}
+
+// compares two family names ignoring ASCII case and spaces, like fontconfig
+static bool equalFamilies(const char *a, const char *b) {
+  for (;; a++, b++) {
+    while (*a == ' ')
+      a++;
+
+    while (*b == ' ')
+      b++;
+
+    int ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : (unsigned char) *a;
+    int cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : (unsigned char) *b;
+    if (ca != cb)
+      return false;
+
+    if (ca == 0)
+      return true;
+  }
+}
+
+// lowercases a language tag and uses dashes between its subtags, so that
+// "zh_TW" and "zh-tw" are the same
+static std::string normalizeLanguage(const char *lang, size_t length) {
+  std::string res(lang, length);
+  for (size_t i = 0; i < res.size(); i++) {
+    if (res[i] >= 'A' && res[i] <= 'Z')
+      res[i] += 32;
+    else if (res[i] == '_')
+      res[i] = '-';
+  }
+
+  return res;
+}
+
+// returns the index of the lowest set bit
+static inline uint32_t lowestBit(uint32_t bits) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return index;
+#else
+  return __builtin_ctz(bits);
+#endif
+}
+
+// orders faces by family, then weight, width, slant and style name
+static bool compareFaces(FontDescriptor *a, FontDescriptor *b) {
+  int cmp = compareIgnoreCase(a->family, b->family);
+  if (cmp == 0)
+    cmp = strcmp(a->family, b->family);
+
+  if (cmp != 0)
+    return cmp < 0;
+
+  if (a->weight != b->weight)
+    return a->weight < b->weight;
+
+  if (a->width != b->width)
+    return a->width < b->width;
+
+  if (a->italic != b->italic)
+    return !a->italic;
+
+  return strcmp(a->style ? a->style : "", b->style ? b->style : "") < 0;
+}
+
+// builds the string table of a catalog, storing each distinct string once
+class StringTableBuilder {
+public:
+  uint32_t add(const char *str) {
+    if (!str)
+      return CATALOG_NULL;
+
+    std::unordered_map<std::string, uint32_t>::iterator it = offsets.find(str);
+    if (it != offsets.end())
+      return it->second;
+
+    uint32_t offset = data.size();
+    data.insert(data.end(), str, str + strlen(str) + 1);
+    offsets[str] = offset;
+    return offset;
+  }
+
+  std::vector<char> data;
+
+private:
+  std::unordered_map<std::string, uint32_t> offsets;
+};
+
+// hashes a string with FNV-1a
+static uint32_t hashString(const char *str) {
+  uint32_t hash = 2166136261u;
+  for (; *str; str++) {
+    hash ^= (unsigned char) *str;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+// builds a hash table of font indices by postscript name. strings are
+// deduplicated, so fonts with the same name have the same string offset,
+// and the first of them wins. the table is kept at most half full.
+static std::vector<uint32_t> buildIndex(std::vector<CatalogFont> &records, std::vector<char> &strings, uint32_t size) {
+  std::vector<uint32_t> table(size, CATALOG_NULL);
+  for (uint32_t i = 0; i < records.size(); i++) {
+    uint32_t offset = records[i].postscriptName;
+    if (offset == CATALOG_NULL)
+      continue;
+
+    uint32_t bucket = hashString(&strings[offset]) & (size - 1);
+    while (table[bucket] != CATALOG_NULL && records[table[bucket]].postscriptName != offset)
+      bucket = (bucket + 1) & (size - 1);
+
+    if (table[bucket] == CATALOG_NULL)
+      table[bucket] = i;
+  }
+
+  return table;
+}
+
+uint32_t getFontId(const char *path, uint32_t faceIndex, const char *postscriptName, uint32_t attempt) {
+  // FNV-1a over the path, then the face index or postscript name
+  uint32_t hash = 2166136261u;
+  for (const char *p = path ? path : ""; ; p++) {
+    hash ^= (unsigned char) *p;
+    hash *= 16777619u;
+    if (!*p)
+      break;
+  }
+
+  if (faceIndex != CATALOG_NULL) {
+    for (int i = 0; i < 4; i++) {
+      hash ^= (faceIndex >> (i * 8)) & 0xff;
+      hash *= 16777619u;
+    }
+  } else {
+    for (const char *p = postscriptName ? postscriptName : ""; *p; p++) {
+      hash ^= (unsigned char) *p;
+      hash *= 16777619u;
+    }
+  }
+
+  for (uint32_t i = 0; i < attempt; i++) {
+    hash ^= 0xff;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+// orders fonts by path, face index and postscript name, which decides
+// which of two fonts with colliding IDs keeps its ID. path numbers follow
+// the order of the sorted paths, and fonts without a path come first.
+struct CompareFontKeys {
+  const std::vector<CatalogFont> &records;
+  const std::vector<std::string> &paths;
+  const std::vector<char> &strings;
+
+  CompareFontKeys(const std::vector<CatalogFont> &records, const std::vector<std::string> &paths, const std::vector<char> &strings)
+    : records(records), paths(paths), strings(strings) {}
+
+  const char *path(uint32_t number) const {
+    return number == CATALOG_NULL ? "" : paths[number].c_str();
+  }
+
+  const char *string(uint32_t offset) const {
+    return offset == CATALOG_NULL ? "" : &strings[offset];
+  }
+
+  bool operator()(uint32_t a, uint32_t b) const {
+    const CatalogFont &fa = records[a], &fb = records[b];
+    if (fa.path != fb.path)
+      return fa.path + 1 < fb.path + 1;
+
+    if (fa.faceIndex != fb.faceIndex)
+      return fa.faceIndex < fb.faceIndex;
+
+    int cmp = strcmp(string(fa.postscriptName), string(fb.postscriptName));
+    return cmp != 0 ? cmp < 0 : a < b;
+  }
+};
+
+// assigns each font its ID, and builds a hash table of font indices by ID.
+// fonts that are in the previous version of the catalog keep their IDs, so
+// that installing a font never takes the ID of another one. the others
+// resolve collisions in the order of their keys. attempts is set to the
+// number of attempts findFont has to follow.
+static std::vector<uint32_t> assignIds(std::vector<CatalogFont> &records, std::vector<std::string> &paths, std::vector<char> &strings,
+                                       uint32_t size, ResultSet *fonts, const FontCatalog *previous, uint32_t &attempts) {
+  std::vector<uint32_t> order(records.size());
+  for (uint32_t i = 0; i < records.size(); i++) {
+    order[i] = i;
+    records[i].id = CATALOG_NULL;
+  }
+
+  CompareFontKeys compare(records, paths, strings);
+  std::sort(order.begin(), order.end(), compare);
+
+  std::unordered_set<uint32_t> used;
+  attempts = 1;
+  for (uint32_t i = 0; previous && i < order.size(); i++) {
+    CatalogFont &record = records[order[i]];
+    uint32_t index = previous->findFont((*fonts)[order[i]]);
+    if (index == CATALOG_NULL)
+      continue;
+
+    uint32_t id = previous->font(index).id;
+    const char *path = compare.path(record.path);
+    const char *postscriptName = compare.string(record.postscriptName);
+    for (uint32_t attempt = 0; attempt < previous->header->idAttempts; attempt++) {
+      if (getFontId(path, record.faceIndex, postscriptName, attempt) == id && used.insert(id).second) {
+        record.id = id;
+        attempts = std::max(attempts, attempt + 1);
+        break;
+      }
+    }
+  }
+
+  std::vector<uint32_t> table(size, CATALOG_NULL);
+  for (uint32_t i = 0; i < order.size(); i++) {
+    CatalogFont &record = records[order[i]];
+    const char *path = compare.path(record.path);
+    const char *postscriptName = compare.string(record.postscriptName);
+
+    // CATALOG_NULL is never used as an ID so that it can mean no font
+    for (uint32_t attempt = 0; record.id == CATALOG_NULL; attempt++) {
+      uint32_t id = getFontId(path, record.faceIndex, postscriptName, attempt);
+      if (id != CATALOG_NULL && used.insert(id).second) {
+        record.id = id;
+        attempts = std::max(attempts, attempt + 1);
+      }
+    }
+
+    uint32_t id = record.id;
+    uint32_t bucket = id & (size - 1);
+    while (table[bucket] != CATALOG_NULL)
+      bucket = (bucket + 1) & (size - 1);
+
+    table[bucket] = order[i];
+  }
+
+  return table;
+}
+
+// appends a number to a buffer as a LEB128 varint
+static void appendVarint(std::vector<char> &data, uint32_t value) {
+  while (value >= 0x80) {
+    data.push_back((char) ((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+
+  data.push_back((char) value);
+}
+
+// reads a LEB128 varint and advances past it
+static uint32_t readVarint(const char *&p) {
+  uint32_t value = 0;
+  for (int shift = 0; ; shift += 7) {
+    uint8_t byte = *p++;
+    value |= (uint32_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80) || shift >= 28)
+      return value;
+  }
+}
+
+// front codes sorted paths in blocks of CATALOG_PATH_BLOCK, appending the
+// offset of each block to blocks
+static void encodePaths(const std::vector<std::string> &paths, std::vector<char> &data, std::vector<uint32_t> &blocks) {
+  for (size_t i = 0; i < paths.size(); i++) {
+    const std::string &path = paths[i];
+    size_t shared = 0;
+    if (i % CATALOG_PATH_BLOCK == 0) {
+      blocks.push_back(data.size());
+    } else {
+      const std::string &previous = paths[i - 1];
+      while (shared < path.size() && shared < previous.size() && path[shared] == previous[shared])
+        shared++;
+
+      appendVarint(data, shared);
+    }
+
+    data.insert(data.end(), path.begin() + shared, path.end());
+    data.push_back('\0');
+  }
+}
+
+// rounds a size up to keep the sections of the image aligned
+static uint32_t align(uint32_t size) {
+  return (size + 3) & ~3;
+}
+
+FontCatalog *FontCatalog::create(ResultSet *fonts, unsigned int generation, const FontCatalog *previous) {
+  StringTableBuilder strings;
+  std::vector<CatalogFont> records(fonts->size());
+  std::vector<FontDescriptor *> faces;
+  std::vector<std::string> paths;
+  uint32_t rawPathsSize = 0, rawStringsSize = 0;
+
+  // languages are numbered as they are found, and sorted once all are known
+  std::unordered_map<std::string, uint32_t> languageIds;
+  std::vector<std::string> languages;
+  std::vector<std::pair<uint32_t, uint32_t> > fontLanguages; // (language, font) pairs
+
+  for (size_t i = 0; i < fonts->size(); i++) {
+    FontDescriptor *desc = (*fonts)[i];
+    CatalogFont &record = records[i];
+    record.path = CATALOG_NULL;
+    record.postscriptName = strings.add(desc->postscriptName);
+    record.family = strings.add(desc->family);
+    record.style = strings.add(desc->style);
+    record.faceIndex = desc->faceIndex < 0 ? CATALOG_NULL : desc->faceIndex;
+    record.weight = desc->weight;
+    record.width = desc->width;
+    record.flags = (desc->italic ? CatalogItalic : 0) | (desc->monospace ? CatalogMonospace : 0);
+
+    if (desc->path) {
+      paths.push_back(desc->path);
+      rawPathsSize += strlen(desc->path) + 1;
+    }
+
+    const char *names[] = { desc->postscriptName, desc->family, desc->style, desc->languages };
+    for (size_t j = 0; j < sizeof(names) / sizeof(names[0]); j++) {
+      if (names[j])
+        rawStringsSize += strlen(names[j]) + 1;
+    }
+
+    if (desc->family)
+      faces.push_back(desc);
+
+    for (const char *lang = desc->languages; lang && *lang;) {
+      const char *end = strchr(lang, '|');
+      if (!end)
+        end = lang + strlen(lang);
+
+      if (end > lang) {
+        std::string name = normalizeLanguage(lang, end - lang);
+        std::unordered_map<std::string, uint32_t>::iterator it = languageIds.find(name);
+        if (it == languageIds.end()) {
+          it = languageIds.insert(std::make_pair(name, (uint32_t) languages.size())).first;
+          languages.push_back(name);
+        }
+
+        fontLanguages.push_back(std::make_pair(it->second, (uint32_t) i));
+      }
+
+      lang = *end ? end + 1 : end;
+    }
+  }
+
+  // sort the languages so that lookups can binary search them, and set the
+  // bit of each font in the bitsets of the languages it supports
+  std::vector<std::pair<std::string, uint32_t> > sortedLanguages;
+  for (uint32_t i = 0; i < languages.size(); i++) {
+    sortedLanguages.push_back(std::make_pair(languages[i], i));
+  }
+
+  std::sort(sortedLanguages.begin(), sortedLanguages.end());
+
+  std::vector<uint32_t> languageRanks(languages.size());
+  std::vector<uint32_t> languageTable(languages.size());
+  for (uint32_t i = 0; i < sortedLanguages.size(); i++) {
+    languageRanks[sortedLanguages[i].second] = i;
+    languageTable[i] = strings.add(sortedLanguages[i].first.c_str());
+  }
+
+  uint32_t languageWords = (records.size() + 31) / 32;
+  std::vector<uint32_t> languageFonts((size_t) languages.size() * languageWords, 0);
+  for (size_t i = 0; i < fontLanguages.size(); i++) {
+    uint32_t font = fontLanguages[i].second;
+    languageFonts[(size_t) languageRanks[fontLanguages[i].first] * languageWords + font / 32] |= 1u << (font % 32);
+  }
+
+  // number the distinct paths in sorted order, and front code them
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+  std::vector<uint32_t> pathFonts(paths.size(), CATALOG_NULL);
+  for (size_t i = 0; i < fonts->size(); i++) {
+    const char *path = (*fonts)[i]->path;
+    if (!path)
+      continue;
+
+    uint32_t number = std::lower_bound(paths.begin(), paths.end(), path) - paths.begin();
+    records[i].path = number;
+    if (pathFonts[number] == CATALOG_NULL)
+      pathFonts[number] = i;
+  }
+
+  std::vector<char> pathData;
+  std::vector<uint32_t> pathBlocks;
+  encodePaths(paths, pathData, pathBlocks);
+
+  // group the faces by family. equal strings share an offset in the string table.
+  std::sort(faces.begin(), faces.end(), compareFaces);
+
+  std::unordered_map<FontDescriptor *, uint32_t> indices;
+  for (size_t i = 0; i < fonts->size(); i++) {
+    indices[(*fonts)[i]] = i;
+  }
+
+  std::vector<uint32_t> faceIndices(faces.size());
+  std::vector<CatalogFamily> families;
+  for (size_t i = 0; i < faces.size(); i++) {
+    uint32_t index = indices[faces[i]];
+    faceIndices[i] = index;
+
+    if (families.empty() || families.back().name != records[index].family) {
+      CatalogFamily family;
+      family.name = records[index].family;
+      family.firstFace = i;
+      family.faceCount = 0;
+      families.push_back(family);
+    }
+
+    families.back().faceCount++;
+  }
+
+  uint32_t indexSize = 1;
+  while (indexSize < records.size() * 2)
+    indexSize <<= 1;
+
+  // copy the fields queries scan into columns, padded to whole bitset words
+  size_t columnSize = (size_t) languageWords * 32;
+  std::vector<uint32_t> fontPaths(columnSize, CATALOG_NULL);
+  std::vector<uint16_t> weights(columnSize, 0);
+  std::vector<uint8_t> widths(columnSize, 0);
+  std::vector<uint8_t> flags(columnSize, 0);
+  for (size_t i = 0; i < records.size(); i++) {
+    fontPaths[i] = records[i].path;
+    weights[i] = records[i].weight;
+    widths[i] = records[i].width;
+    flags[i] = records[i].flags;
+  }
+
+  std::vector<uint32_t> postscriptNameIndex = buildIndex(records, strings.data, indexSize);
+  uint32_t idAttempts;
+  std::vector<uint32_t> idIndex = assignIds(records, paths, strings.data, indexSize, fonts, previous, idAttempts);
+
+  CatalogHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CATALOG_MAGIC;
+  header.version = CATALOG_VERSION;
+  header.generation = generation;
+  header.fontCount = records.size();
+  header.fontsOffset = sizeof(CatalogHeader);
+  header.familyCount = families.size();
+  header.familiesOffset = align(header.fontsOffset + records.size() * sizeof(CatalogFont));
+  header.faceCount = faceIndices.size();
+  header.facesOffset = align(header.familiesOffset + families.size() * sizeof(CatalogFamily));
+  header.indexSize = indexSize;
+  header.postscriptNameIndexOffset = align(header.facesOffset + faceIndices.size() * sizeof(uint32_t));
+  header.idIndexOffset = header.postscriptNameIndexOffset + indexSize * sizeof(uint32_t);
+  header.idAttempts = idAttempts;
+  header.languageCount = languageTable.size();
+  header.languagesOffset = header.idIndexOffset + indexSize * sizeof(uint32_t);
+  header.languageWords = languageWords;
+  header.languageFontsOffset = header.languagesOffset + languageTable.size() * sizeof(uint32_t);
+  header.fontPathsOffset = header.languageFontsOffset + languageFonts.size() * sizeof(uint32_t);
+  header.weightsOffset = header.fontPathsOffset + columnSize * sizeof(uint32_t);
+  header.widthsOffset = header.weightsOffset + columnSize * sizeof(uint16_t);
+  header.flagsOffset = header.widthsOffset + columnSize;
+  header.pathCount = paths.size();
+  header.pathFontsOffset = header.flagsOffset + columnSize;
+  header.pathBlocksOffset = header.pathFontsOffset + pathFonts.size() * sizeof(uint32_t);
+  header.pathsOffset = header.pathBlocksOffset + pathBlocks.size() * sizeof(uint32_t);
+  header.pathsSize = pathData.size();
+  header.stringsOffset = header.pathsOffset + header.pathsSize;
+  header.stringsSize = strings.data.size();
+  header.rawPathsSize = rawPathsSize;
+  header.rawStringsSize = rawStringsSize;
+  header.size = align(header.stringsOffset + header.stringsSize);
+
+  char *data = new char[header.size];
+  memset(data, 0, header.size);
+  memcpy(data, &header, sizeof(header));
+
+  if (!records.empty())
+    memcpy(data + header.fontsOffset, &records[0], records.size() * sizeof(CatalogFont));
+
+  if (!families.empty())
+    memcpy(data + header.familiesOffset, &families[0], families.size() * sizeof(CatalogFamily));
+
+  if (!faceIndices.empty())
+    memcpy(data + header.facesOffset, &faceIndices[0], faceIndices.size() * sizeof(uint32_t));
+
+  memcpy(data + header.postscriptNameIndexOffset, &postscriptNameIndex[0], indexSize * sizeof(uint32_t));
+  memcpy(data + header.idIndexOffset, &idIndex[0], indexSize * sizeof(uint32_t));
+
+  if (!languageTable.empty()) {
+    memcpy(data + header.languagesOffset, &languageTable[0], languageTable.size() * sizeof(uint32_t));
+    memcpy(data + header.languageFontsOffset, &languageFonts[0], languageFonts.size() * sizeof(uint32_t));
+  }
+
+  if (columnSize) {
+    memcpy(data + header.fontPathsOffset, &fontPaths[0], columnSize * sizeof(uint32_t));
+    memcpy(data + header.weightsOffset, &weights[0], columnSize * sizeof(uint16_t));
+    memcpy(data + header.widthsOffset, &widths[0], columnSize);
+    memcpy(data + header.flagsOffset, &flags[0], columnSize);
+  }
+
+  if (!paths.empty()) {
+    memcpy(data + header.pathFontsOffset, &pathFonts[0], pathFonts.size() * sizeof(uint32_t));
+    memcpy(data + header.pathBlocksOffset, &pathBlocks[0], pathBlocks.size() * sizeof(uint32_t));
+    memcpy(data + header.pathsOffset, &pathData[0], pathData.size());
+  }
+
+  if (!strings.data.empty())
+    memcpy(data + header.stringsOffset, &strings.data[0], strings.data.size());
+
+  delete fonts;
+  return new FontCatalog(data, false);
+}
+
+FontCatalog::FontCatalog(const char *data, bool mapped) {
+  this->data = data;
+  this->header = (const CatalogHeader *) data;
+  this->generation = header->generation;
+  this->epoch = ::epoch;
+  this->mapped = mapped;
+  this->search = NULL;
+  uv_mutex_init(&searchLock);
+}
+
+FontCatalog::~FontCatalog() {
+  delete search;
+  uv_mutex_destroy(&searchLock);
+
+  if (mapped)
+    SharedCatalog::unmap(data, header->size);
+  else
+    delete[] data;
+}
+
+// whether an offset is CATALOG_NULL (if allowed) or the start of a string
+// in the string table, whose last string is checked to be terminated
+static bool validString(const CatalogHeader *header, uint32_t offset, bool nullable) {
+  return offset == CATALOG_NULL ? nullable : offset < header->stringsSize;
+}
+
+// checks the tables of an image whose sections were checked to fit in it,
+// so that every index and offset queries follow stays within the image
+static bool validateTables(const char *data) {
+  const CatalogHeader *header = (const CatalogHeader *) data;
+  if (header->stringsSize > 0 && data[header->stringsOffset + header->stringsSize - 1] != '\0')
+    return false;
+
+  const CatalogFont *fonts = (const CatalogFont *) (data + header->fontsOffset);
+  for (uint32_t i = 0; i < header->fontCount; i++) {
+    if ((fonts[i].path != CATALOG_NULL && fonts[i].path >= header->pathCount) ||
+        !validString(header, fonts[i].postscriptName, true) ||
+        !validString(header, fonts[i].family, true) ||
+        !validString(header, fonts[i].style, true))
+      return false;
+  }
+
+  const CatalogFamily *families = (const CatalogFamily *) (data + header->familiesOffset);
+  for (uint32_t i = 0; i < header->familyCount; i++) {
+    if (!validString(header, families[i].name, false) ||
+        (uint64_t) families[i].firstFace + families[i].faceCount > header->faceCount)
+      return false;
+  }
+
+  const uint32_t *faces = (const uint32_t *) (data + header->facesOffset);
+  for (uint32_t i = 0; i < header->faceCount; i++) {
+    if (faces[i] >= header->fontCount)
+      return false;
+  }
+
+  // lookups probe until they reach an empty bucket, so each table needs one.
+  // postscript name lookups compare the name of the font in each bucket.
+  const uint32_t *indexes[2] = {
+    (const uint32_t *) (data + header->postscriptNameIndexOffset),
+    (const uint32_t *) (data + header->idIndexOffset)
+  };
+
+  for (int i = 0; i < 2; i++) {
+    bool empty = false;
+    for (uint32_t j = 0; j < header->indexSize; j++) {
+      uint32_t font = indexes[i][j];
+      if (font == CATALOG_NULL)
+        empty = true;
+      else if (font >= header->fontCount || (i == 0 && fonts[font].postscriptName == CATALOG_NULL))
+        return false;
+    }
+
+    if (!empty)
+      return false;
+  }
+
+  const uint32_t *languages = (const uint32_t *) (data + header->languagesOffset);
+  for (uint32_t i = 0; i < header->languageCount; i++) {
+    if (!validString(header, languages[i], false))
+      return false;
+  }
+
+  const uint32_t *fontPaths = (const uint32_t *) (data + header->fontPathsOffset);
+  const uint32_t *pathFonts = (const uint32_t *) (data + header->pathFontsOffset);
+  for (uint32_t i = 0; i < header->fontCount; i++) {
+    if (fontPaths[i] != fonts[i].path)
+      return false;
+  }
+
+  for (uint32_t i = 0; i < header->pathCount; i++) {
+    if (pathFonts[i] >= header->fontCount)
+      return false;
+  }
+
+  // decode every block the way path() does, making sure it stays within
+  // the path table. the table ends with a null, so strings and varints
+  // in it are terminated.
+  const uint32_t *blocks = (const uint32_t *) (data + header->pathBlocksOffset);
+  const char *end = data + header->pathsOffset + header->pathsSize;
+  for (uint32_t i = 0; i < header->pathCount; i += CATALOG_PATH_BLOCK) {
+    if (blocks[i / CATALOG_PATH_BLOCK] >= header->pathsSize)
+      return false;
+
+    const char *p = data + header->pathsOffset + blocks[i / CATALOG_PATH_BLOCK];
+    p += strlen(p) + 1;
+
+    for (uint32_t j = i + 1; j < header->pathCount && j % CATALOG_PATH_BLOCK != 0; j++) {
+      if (p >= end)
+        return false;
+
+      readVarint(p);
+      if (p >= end)
+        return false;
+
+      p += strlen(p) + 1;
+    }
+  }
+
+  return true;
+}
+
+bool FontCatalog::validate(const char *data, size_t size) {
+  const CatalogHeader *header = (const CatalogHeader *) data;
+  if (size < sizeof(CatalogHeader) || header->magic != CATALOG_MAGIC || header->version != CATALOG_VERSION)
+    return false;
+
+  bool fits = header->size <= size &&
+    (uint64_t) header->fontsOffset + (uint64_t) header->fontCount * sizeof(CatalogFont) <= header->size &&
+    (uint64_t) header->familiesOffset + (uint64_t) header->familyCount * sizeof(CatalogFamily) <= header->size &&
+    header->faceCount <= header->fontCount &&
+    (uint64_t) header->facesOffset + (uint64_t) header->faceCount * sizeof(uint32_t) <= header->size &&
+    header->indexSize != 0 && (header->indexSize & (header->indexSize - 1)) == 0 &&
+    (uint64_t) header->postscriptNameIndexOffset + (uint64_t) header->indexSize * sizeof(uint32_t) <= header->size &&
+    (uint64_t) header->idIndexOffset + (uint64_t) header->indexSize * sizeof(uint32_t) <= header->size &&
+    header->idAttempts >= 1 && header->idAttempts <= header->fontCount + 1 &&
+    (uint64_t) header->languagesOffset + (uint64_t) header->languageCount * sizeof(uint32_t) <= header->size &&
+    header->languageWords == (header->fontCount + 31) / 32 &&
+    (uint64_t) header->languageFontsOffset + (uint64_t) header->languageCount * header->languageWords * sizeof(uint32_t) <= header->size &&
+    (uint64_t) header->fontPathsOffset + (uint64_t) header->languageWords * 32 * sizeof(uint32_t) <= header->size &&
+    (uint64_t) header->weightsOffset + (uint64_t) header->languageWords * 32 * sizeof(uint16_t) <= header->size &&
+    (uint64_t) header->widthsOffset + (uint64_t) header->languageWords * 32 <= header->size &&
+    (uint64_t) header->flagsOffset + (uint64_t) header->languageWords * 32 <= header->size &&
+    (uint64_t) header->pathFontsOffset + (uint64_t) header->pathCount * sizeof(uint32_t) <= header->size &&
+    (uint64_t) header->pathBlocksOffset + (uint64_t) (header->pathCount + CATALOG_PATH_BLOCK - 1) / CATALOG_PATH_BLOCK * sizeof(uint32_t) <= header->size &&
+    (uint64_t) header->pathsOffset + header->pathsSize <= header->size &&
+    (header->pathsSize == 0 || data[header->pathsOffset + header->pathsSize - 1] == '\0') &&
+    (uint64_t) header->stringsOffset + header->stringsSize <= header->size;
+
+  return fits && validateTables(data);
+}
+
+const char *FontCatalog::path(uint32_t number, std::string &buffer) const {
+  if (number == CATALOG_NULL)
+    return NULL;
+
+  const uint32_t *blocks = (const uint32_t *) (data + header->pathBlocksOffset);
+  const char *p = data + header->pathsOffset + blocks[number / CATALOG_PATH_BLOCK];
+  buffer.assign(p);
+  p += buffer.size() + 1;
+
+  for (uint32_t i = number % CATALOG_PATH_BLOCK; i > 0; i--) {
+    uint32_t shared = readVarint(p);
+    size_t length = strlen(p);
+    buffer.resize(std::min((size_t) shared, buffer.size()));
+    buffer.append(p, length);
+    p += length + 1;
+  }
+
+  return buffer.c_str();
+}
+
+uint32_t FontCatalog::lowerBoundPath(const char *value, std::string &buffer) const {
+  // find the last block starting at or before the path, whose first path
+  // is stored in full, then decode the block up to it
+  const uint32_t *blocks = (const uint32_t *) (data + header->pathBlocksOffset);
+  const char *paths = data + header->pathsOffset;
+  uint32_t begin = 0, end = (header->pathCount + CATALOG_PATH_BLOCK - 1) / CATALOG_PATH_BLOCK;
+  while (begin < end) {
+    uint32_t middle = begin + (end - begin) / 2;
+    if (strcmp(paths + blocks[middle], value) <= 0)
+      begin = middle + 1;
+    else
+      end = middle;
+  }
+
+  // the path sorts before the first one
+  if (begin == 0) {
+    if (header->pathCount)
+      path(0, buffer);
+
+    return 0;
+  }
+
+  uint32_t number = (begin - 1) * CATALOG_PATH_BLOCK;
+  const char *p = paths + blocks[begin - 1];
+  buffer.assign(p);
+  p += buffer.size() + 1;
+
+  while (strcmp(buffer.c_str(), value) < 0) {
+    // the path is after the last one of the block, so the next block's is next
+    if (++number == header->pathCount || number % CATALOG_PATH_BLOCK == 0) {
+      if (number < header->pathCount)
+        path(number, buffer);
+
+      return number;
+    }
+
+    uint32_t shared = readVarint(p);
+    size_t length = strlen(p);
+    buffer.resize(std::min((size_t) shared, buffer.size()));
+    buffer.append(p, length);
+    p += length + 1;
+  }
+
+  return number;
+}
+
+uint32_t FontCatalog::findPath(const char *value) const {
+  std::string buffer;
+  uint32_t number = lowerBoundPath(value, buffer);
+  return number < header->pathCount && buffer == value ? number : CATALOG_NULL;
+}
+
+uint32_t FontCatalog::find(CatalogIndex index, const char *value) const {
+  if (index == CatalogPathIndex) {
+    uint32_t number = findPath(value);
+    return number == CATALOG_NULL ? CATALOG_NULL : pathFont(number);
+  }
+
+  const uint32_t *table = (const uint32_t *) (data + header->postscriptNameIndexOffset);
+  uint32_t mask = header->indexSize - 1;
+
+  for (uint32_t bucket = hashString(value) & mask; table[bucket] != CATALOG_NULL; bucket = (bucket + 1) & mask) {
+    if (strcmp(string(font(table[bucket]).postscriptName), value) == 0)
+      return table[bucket];
+  }
+
+  return CATALOG_NULL;
+}
+
+// intersects a selection of fonts with the fonts that support a language,
+// or a more specific form of it ("zh" includes "zh-cn" and "zh-tw")
+static void selectLanguage(const FontCatalog *catalog, const char *lang, std::vector<uint32_t> &selection) {
+  std::string query = normalizeLanguage(lang, strlen(lang));
+  std::vector<uint32_t> mask(selection.size(), 0);
+
+  // the languages are sorted, so the ones the query is a prefix of follow it
+  uint32_t begin = 0, end = catalog->languageCount();
+  while (begin < end) {
+    uint32_t middle = begin + (end - begin) / 2;
+    if (strcmp(catalog->language(middle), query.c_str()) < 0)
+      begin = middle + 1;
+    else
+      end = middle;
+  }
+
+  for (uint32_t i = begin; i < catalog->languageCount(); i++) {
+    const char *language = catalog->language(i);
+    if (strncmp(language, query.c_str(), query.size()) != 0)
+      break;
+
+    if (language[query.size()] != '\0' && language[query.size()] != '-')
+      continue;
+
+    const uint32_t *fonts = catalog->languageFonts(i);
+    for (size_t j = 0; j < mask.size(); j++) {
+      mask[j] |= fonts[j];
+    }
+  }
+
+  for (size_t i = 0; i < selection.size(); i++) {
+    selection[i] &= mask[i];
+  }
+}
+
+// narrows a selection of fonts down by scanning the columns of the catalog
+// for the weight, width, italic and monospace fields of a query, and for
+// its path prefix, which matches a range of the sorted path numbers
+static void selectColumns(const FontCatalog *catalog, FontDescriptor *desc, std::vector<uint32_t> &selection) {
+  uint32_t words = selection.size();
+  if (words == 0)
+    return;
+
+  uint32_t *bits = &selection[0];
+  int minWeight = desc->minWeight, maxWeight = desc->maxWeight;
+  if (desc->weight) {
+    minWeight = std::max(minWeight, (int) desc->weight);
+    maxWeight = std::min(maxWeight, (int) desc->weight);
+  }
+
+  if (minWeight > maxWeight)
+    std::fill(selection.begin(), selection.end(), 0);
+  else if (minWeight > 0 || maxWeight < FONT_RANGE_MAX)
+    selectRange(catalog->weights(), words, (uint16_t) minWeight, (uint16_t) maxWeight, bits);
+
+  int minWidth = desc->minWidth, maxWidth = std::min(desc->maxWidth, 0xff);
+  if (desc->width) {
+    minWidth = std::max(minWidth, (int) desc->width);
+    maxWidth = std::min(maxWidth, (int) desc->width);
+  }
+
+  if (minWidth > maxWidth)
+    std::fill(selection.begin(), selection.end(), 0);
+  else if (minWidth > 0 || maxWidth < 0xff)
+    selectRange(catalog->widths(), words, (uint8_t) minWidth, (uint8_t) maxWidth, bits);
+
+  uint8_t flags = (desc->italic ? CatalogItalic : 0) | (desc->monospace ? CatalogMonospace : 0);
+  if (flags)
+    selectFlags(catalog->flags(), words, flags, bits);
+
+  if (desc->pathPrefix) {
+    // no path has a 0xff byte in it, so every path starting with the prefix
+    // sorts before the prefix followed by one
+    std::string buffer;
+    uint32_t begin = catalog->lowerBoundPath(desc->pathPrefix, buffer);
+    uint32_t end = catalog->lowerBoundPath((std::string(desc->pathPrefix) + '\xff').c_str(), buffer);
+    if (begin < end)
+      selectRange(catalog->fontPaths(), words, begin, end - 1, bits);
+    else
+      std::fill(selection.begin(), selection.end(), 0);
+  }
+}
+
+// intersects a selection of fonts with the faces of any of a list of families
+static void selectFamilies(const FontCatalog *catalog, const std::vector<std::string> &names, std::vector<uint32_t> &selection) {
+  std::vector<uint32_t> mask(selection.size(), 0);
+  for (uint32_t i = 0; i < catalog->familyCount(); i++) {
+    const CatalogFamily &family = catalog->family(i);
+    const char *name = catalog->string(family.name);
+    for (size_t j = 0; j < names.size(); j++) {
+      if (!equalFamilies(name, names[j].c_str()))
+        continue;
+
+      for (uint32_t k = 0; k < family.faceCount; k++) {
+        uint32_t font = catalog->face(family.firstFace + k);
+        mask[font / 32] |= 1u << (font % 32);
+      }
+
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < selection.size(); i++) {
+    selection[i] &= mask[i];
+  }
+}
+
+// checks a font against the names in a query, like fontconfig matches them
+// when listing fonts. the other fields are matched by the column scans.
+static bool matchesQuery(const FontCatalog *catalog, const CatalogFont &font, FontDescriptor *desc) {
+  if (desc->postscriptName && (font.postscriptName == CATALOG_NULL || strcmp(catalog->string(font.postscriptName), desc->postscriptName) != 0))
+    return false;
+
+  if (desc->family && (font.family == CATALOG_NULL || !equalFamilies(catalog->string(font.family), desc->family)))
+    return false;
+
+  if (desc->style && (font.style == CATALOG_NULL || compareIgnoreCase(catalog->string(font.style), desc->style) != 0))
+    return false;
+
+  return true;
+}
+
+// whether a family name is the name of a family in the catalog
+static bool hasFamily(const FontCatalog *catalog, const char *name) {
+  for (uint32_t i = 0; i < catalog->familyCount(); i++) {
+    if (equalFamilies(catalog->string(catalog->family(i).name), name))
+      return true;
+  }
+
+  return false;
+}
+
+bool FontCatalog::hasNames(FontDescriptor *desc) const {
+  if (desc->family && !hasFamily(this, desc->family))
+    return false;
+
+  for (size_t i = 0; i < desc->families.size(); i++) {
+    if (!hasFamily(this, desc->families[i].c_str()))
+      return false;
+  }
+
+  if (!desc->style)
+    return true;
+
+  for (uint32_t i = 0; i < fontCount(); i++) {
+    if (font(i).style != CATALOG_NULL && compareIgnoreCase(string(font(i).style), desc->style) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+void FontCatalog::findFonts(FontDescriptor *desc, std::vector<uint32_t> &res, const std::vector<uint32_t> *named) const {
+  std::vector<uint32_t> selection(header->languageWords, 0xffffffff);
+  if (named) {
+    std::fill(selection.begin(), selection.end(), 0);
+    for (size_t i = 0; i < named->size(); i++) {
+      selection[(*named)[i] / 32] |= 1u << ((*named)[i] % 32);
+    }
+  } else if (fontCount() % 32) {
+    selection.back() = (1u << (fontCount() % 32)) - 1;
+  }
+
+  if (desc->lang)
+    selectLanguage(this, desc->lang, selection);
+
+  if (desc->script) {
+    const char *lang = getScriptLanguage(desc->script);
+    if (lang)
+      selectLanguage(this, lang, selection);
+    else
+      selection.assign(selection.size(), 0);
+  }
+
+  selectColumns(this, desc, selection);
+
+  if (!desc->families.empty() && !named)
+    selectFamilies(this, desc->families, selection);
+
+  for (uint32_t i = 0; i < selection.size(); i++) {
+    for (uint32_t bits = selection[i]; bits; bits &= bits - 1) {
+      uint32_t index = i * 32 + lowestBit(bits);
+      if (named || matchesQuery(this, font(index), desc))
+        res.push_back(index);
+    }
+  }
+}
+
+const char *getScriptLanguage(const char *script) {
+  // a widely spoken language written in each script, whose fontconfig
+  // orthography covers the common letters of the script
+  static const char *scripts[][2] = {
+    { "arab", "ar" },
+    { "armn", "hy" },
+    { "beng", "bn" },
+    { "cyrl", "ru" },
+    { "deva", "hi" },
+    { "ethi", "am" },
+    { "geor", "ka" },
+    { "grek", "el" },
+    { "gujr", "gu" },
+    { "guru", "pa" },
+    { "hang", "ko" },
+    { "hani", "zh" },
+    { "hans", "zh-cn" },
+    { "hant", "zh-tw" },
+    { "hebr", "he" },
+    { "jpan", "ja" },
+    { "khmr", "km" },
+    { "knda", "kn" },
+    { "kore", "ko" },
+    { "laoo", "lo" },
+    { "latn", "en" },
+    { "mlym", "ml" },
+    { "mong", "mn" },
+    { "mymr", "my" },
+    { "orya", "or" },
+    { "sinh", "si" },
+    { "taml", "ta" },
+    { "telu", "te" },
+    { "thaa", "dv" },
+    { "thai", "th" },
+    { "tibt", "bo" }
+  };
+
+  for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++) {
+    if (compareIgnoreCase(script, scripts[i][0]) == 0)
+      return scripts[i][1];
+  }
+
+  return NULL;
+}
+
+uint32_t FontCatalog::findById(uint32_t id) const {
+  const uint32_t *table = (const uint32_t *) (data + header->idIndexOffset);
+  uint32_t mask = header->indexSize - 1;
+
+  for (uint32_t bucket = id & mask; table[bucket] != CATALOG_NULL; bucket = (bucket + 1) & mask) {
+    if (font(table[bucket]).id == id)
+      return table[bucket];
+  }
+
+  return CATALOG_NULL;
+}
+
+uint32_t FontCatalog::findFont(FontDescriptor *desc) const {
+  uint32_t faceIndex = desc->faceIndex < 0 ? CATALOG_NULL : desc->faceIndex;
+  const char *path = desc->path ? desc->path : "";
+  const char *postscriptName = desc->postscriptName ? desc->postscriptName : "";
+
+  uint32_t pathNumber = desc->path ? findPath(desc->path) : CATALOG_NULL;
+  if (desc->path && pathNumber == CATALOG_NULL)
+    return CATALOG_NULL;
+
+  // follow the IDs a font would get when its ID collides with other fonts.
+  // a font that kept its ID from an earlier version may have skipped IDs
+  // that are free now, so every attempt any font used is checked.
+  for (uint32_t attempt = 0; attempt < header->idAttempts; attempt++) {
+    uint32_t id = getFontId(path, faceIndex, postscriptName, attempt);
+    uint32_t index = id == CATALOG_NULL ? CATALOG_NULL : findById(id);
+    if (index == CATALOG_NULL)
+      continue;
+
+    const CatalogFont &record = font(index);
+    const char *recordPostscriptName = string(record.postscriptName);
+    if (record.faceIndex == faceIndex && record.path == pathNumber &&
+        (faceIndex != CATALOG_NULL || strcmp(recordPostscriptName ? recordPostscriptName : "", postscriptName) == 0))
+      return index;
+  }
+
+  return CATALOG_NULL;
+}
+
+FontDescriptor *FontCatalog::createFontDescriptor(uint32_t index) const {
+  const CatalogFont &record = font(index);
+  std::string buffer;
+  FontDescriptor *res = new FontDescriptor(
+    path(record.path, buffer),
+    string(record.postscriptName),
+    string(record.family),
+    string(record.style),
+    (FontWeight) record.weight,
+    (FontWidth) record.width,
+    (record.flags & CatalogItalic) != 0,
+    (record.flags & CatalogMonospace) != 0
+  );
+
+  res->faceIndex = record.faceIndex == CATALOG_NULL ? -1 : record.faceIndex;
+  return res;
+}
+
+const FamilySearch *FontCatalog::familySearch() {
+  uv_mutex_lock(&searchLock);
+  if (!search)
+    search = new FamilySearch(this);
+
+  uv_mutex_unlock(&searchLock);
+  return search;
+}
+
+const FamilySearch *FontCatalog::builtFamilySearch() {
+  // the index is being built if the lock is taken
+  if (uv_mutex_trylock(&searchLock) != 0)
+    return NULL;
+
+  FamilySearch *res = search;
+  uv_mutex_unlock(&searchLock);
+  return res;
+}
+
+// polls the backend for font changes (at most once per interval) and
+// returns the current generation. the refresh lock must be held.
+static unsigned int checkGeneration() {
+  uint64_t now = uv_hrtime();
+  uint64_t last = lastCheck;
+  if (now - last > CATALOG_CHECK_INTERVAL) {
+    // the first check lets the backend note the fonts the first catalog
+    // is built from
+    if (fontsChanged() && last)
+      generation++;
+
+    lastCheck = now;
+  }
+
+  return generation;
+}
+
+// whether the backend was polled recently enough to skip polling it again
+static bool checkedRecently() {
+  uint64_t last = lastCheck;
+  return last && uv_hrtime() - last <= CATALOG_CHECK_INTERVAL;
+}
+
+// whether a version of the catalog can be used without looking for changes
+static bool isCurrent(const std::shared_ptr<FontCatalog> &current, SharedCatalog *attached) {
+  if (!current)
+    return false;
+
+  if (attached && !attached->publisher)
+    return current->generation == attached->generation();
+
+  return checkedRecently() && current->generation == generation;
+}
+
+// builds a new version of the catalog if the fonts changed, or maps the
+// latest image from the attached shared catalog, and swaps it in. the
+// refresh lock must be held.
+static void updateCatalog() {
+  std::shared_ptr<FontCatalog> current = std::atomic_load(&catalog);
+  std::shared_ptr<SharedCatalog> attached = std::atomic_load(&shared);
+
+  if (attached && !attached->publisher) {
+    if (current && current->generation == attached->generation())
+      return;
+
+    // if the new image can't be mapped, keep using the one we have
+    const char *data = attached->map();
+    if (data)
+      std::atomic_store(&catalog, std::shared_ptr<FontCatalog>(new FontCatalog(data, true)));
+
+    return;
+  }
+
+  unsigned int latest = checkGeneration();
+  if (current && current->generation == latest)
+    return;
+
+  std::shared_ptr<FontCatalog> next(FontCatalog::create(getAvailableFonts(), latest, current.get()));
+
+  // let the processes attached to our catalog know about the new one
+  if (attached)
+    attached->publish(next->data, next->header->size);
+
+  std::atomic_store(&catalog, next);
+}
+
+// stops publishing or reading the shared catalog. the refresh lock must be held.
+static void releaseSharedCatalog() {
+  std::shared_ptr<SharedCatalog> current = std::atomic_load(&shared);
+  if (!current)
+    return;
+
+  // readers go back to building their own catalog
+  if (current->publisher) {
+    current->unlink();
+  } else {
+    epoch++;
+    std::atomic_store(&catalog, std::shared_ptr<FontCatalog>());
+  }
+
+  std::atomic_store(&shared, std::shared_ptr<SharedCatalog>());
+}
+
+// returns the generation of the catalog source this process currently reads
+static unsigned int getSourceGeneration() {
+  std::shared_ptr<SharedCatalog> attached = std::atomic_load(&shared);
+  if (attached && !attached->publisher)
+    return attached->generation();
+
+  // if another thread is polling or refreshing, the generation it
+  // is working on is not ready yet
+  if (checkedRecently() || uv_mutex_trylock(&refreshLock) != 0)
+    return generation;
+
+  unsigned int res = checkGeneration();
+  uv_mutex_unlock(&refreshLock);
+  return res;
+}
+
+uint64_t getCatalogGeneration() {
+  uv_once(&catalogOnce, initCatalogLocks);
+
+  // read the generation again if we attached or detached in between
+  for (;;) {
+    unsigned int current = epoch;
+    unsigned int res = getSourceGeneration();
+    if (epoch == current)
+      return (uint64_t) current << 32 | res;
+  }
+}
+
+std::shared_ptr<FontCatalog> getReadyCatalog() {
+  uv_once(&catalogOnce, initCatalogLocks);
+  std::shared_ptr<FontCatalog> res = std::atomic_load(&catalog);
+  std::shared_ptr<SharedCatalog> attached = std::atomic_load(&shared);
+  return isCurrent(res, attached.get()) ? res : std::shared_ptr<FontCatalog>();
+}
+
+std::shared_ptr<FontCatalog> getCatalog() {
+  uv_once(&catalogOnce, initCatalogLocks);
+
+  // most calls find an up to date version, which any number of threads can share
+  std::shared_ptr<FontCatalog> res = std::atomic_load(&catalog);
+  std::shared_ptr<SharedCatalog> attached = std::atomic_load(&shared);
+  if (isCurrent(res, attached.get()))
+    return res;
+
+  // one thread brings the catalog up to date. the others keep using the
+  // version they loaded, and only wait for it if there is none yet.
+  if (!res)
+    uv_mutex_lock(&refreshLock);
+  else if (uv_mutex_trylock(&refreshLock) != 0)
+    return res;
+
+  updateCatalog();
+  res = std::atomic_load(&catalog);
+  uv_mutex_unlock(&refreshLock);
+  return res;
+}
+
+unsigned int refreshCatalog() {
+  uv_once(&catalogOnce, initCatalogLocks);
+  uv_mutex_lock(&refreshLock);
+
+  std::shared_ptr<SharedCatalog> attached = std::atomic_load(&shared);
+  if (!attached || attached->publisher) {
+    // the backend may not notice changes by itself, so always start a new generation
+    fontsChanged();
+    generation++;
+    lastCheck = uv_hrtime();
+  }
+
+  updateCatalog();
+  unsigned int res = std::atomic_load(&catalog)->generation;
+  uv_mutex_unlock(&refreshLock);
+  return res;
+}
+
+unsigned int publishCatalog(const char *name) {
+  uv_once(&catalogOnce, initCatalogLocks);
+  uv_mutex_lock(&refreshLock);
+
+  // keep the segments readers are attached to when publishing the same name again
+  std::shared_ptr<SharedCatalog> publisher = std::atomic_load(&shared);
+  if (!publisher || !publisher->publisher || !publisher->hasName(name)) {
+    releaseSharedCatalog();
+    publisher.reset();
+  }
+
+  updateCatalog();
+  std::shared_ptr<FontCatalog> current = std::atomic_load(&catalog);
+
+  unsigned int res = 0;
+  if (publisher) {
+    res = publisher->publish(current->data, current->header->size);
+  } else {
+    publisher.reset(SharedCatalog::open(name, true));
+    res = publisher ? publisher->publish(current->data, current->header->size) : 0;
+    if (res)
+      std::atomic_store(&shared, publisher);
+  }
+
+  uv_mutex_unlock(&refreshLock);
+  return res;
+}
+
+bool attachCatalog(const char *name) {
+  uv_once(&catalogOnce, initCatalogLocks);
+  uv_mutex_lock(&refreshLock);
+  releaseSharedCatalog();
+
+  std::shared_ptr<SharedCatalog> reader(SharedCatalog::open(name, false));
+  const char *data = reader ? reader->map() : NULL;
+  if (data) {
+    epoch++;
+    std::atomic_store(&catalog, std::shared_ptr<FontCatalog>(new FontCatalog(data, true)));
+    std::atomic_store(&shared, reader);
+  }
+
+  uv_mutex_unlock(&refreshLock);
+  return data != NULL;
+}
+
+void detachCatalog() {
+  uv_once(&catalogOnce, initCatalogLocks);
+  uv_mutex_lock(&refreshLock);
+  releaseSharedCatalog();
+  uv_mutex_unlock(&refreshLock);
+}
+
+std::shared_ptr<FallbackChain> getCachedFallbackChain(const char *postscriptName, const char *lang) {
+  uint64_t current = getCatalogGeneration();
+
+  // a language, even an empty one, is marked by a byte so that it can't be
+  // confused with no language at all
+  std::string key(postscriptName);
+  key.push_back('\0');
+  if (lang) {
+    key.push_back('\1');
+    key.append(lang);
+  }
+
+  uv_mutex_lock(&fallbackChainsLock);
+  if (fallbackChainsGeneration == current) {
+    FallbackChainMap::iterator it = fallbackChains.find(key);
+    if (it != fallbackChains.end()) {
+      fallbackChainOrder.splice(fallbackChainOrder.begin(), fallbackChainOrder, it->second.position);
+      std::shared_ptr<FallbackChain> res = it->second.chain;
+      uv_mutex_unlock(&fallbackChainsLock);
+      return res;
+    }
+  }
+
+  uv_mutex_unlock(&fallbackChainsLock);
+
+  // sorting fonts is expensive, so don't hold the lock while doing it
+  std::shared_ptr<FallbackChain> res(getFallbackChain((char *) postscriptName, (char *) lang));
+
+  // like the result cache, only keep chains of the generation that is still
+  // current, so a request that raced a refresh doesn't drop the new ones
+  bool stillCurrent = getCatalogGeneration() == current;
+  uv_mutex_lock(&fallbackChainsLock);
+  if (stillCurrent) {
+    if (fallbackChainsGeneration != current) {
+      fallbackChains.clear();
+      fallbackChainOrder.clear();
+      fallbackChainsGeneration = current;
+    }
+
+    if (fallbackChains.find(key) == fallbackChains.end()) {
+      fallbackChainOrder.push_front(key);
+      FallbackChainEntry &entry = fallbackChains[key];
+      entry.chain = res;
+      entry.position = fallbackChainOrder.begin();
+    }
+
+    // evict the least recently used chains
+    while (fallbackChains.size() > MAX_FALLBACK_CHAINS) {
+      fallbackChains.erase(fallbackChainOrder.back());
+      fallbackChainOrder.pop_back();
+    }
+  }
+
+  uv_mutex_unlock(&fallbackChainsLock);
+  return res;
+}
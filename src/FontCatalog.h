@@ -0,0 +1,316 @@
+#ifndef FONT_CATALOG_H
+#define FONT_CATALOG_H
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <uv.h>
+#include "FontDescriptor.h"
+#include "FamilySearch.h"
+
+#define CATALOG_MAGIC 0x54434d46 // 'FMCT'
+#define CATALOG_VERSION 8
+
+// the number of paths in each front coded block of the path table
+#define CATALOG_PATH_BLOCK 16
+
+// marks a missing string in the catalog
+#define CATALOG_NULL 0xffffffff
+
+enum CatalogFlags {
+  CatalogItalic    = 1 << 0,
+  CatalogMonospace = 1 << 1
+};
+
+// the fields of a font the catalog can look fonts up by
+enum CatalogIndex {
+  CatalogPostscriptNameIndex,
+  CatalogPathIndex
+};
+
+// a font in the catalog. path is the number of its path in the path
+// table, and the other strings are offsets into the string table.
+struct CatalogFont {
+  uint32_t path;
+  uint32_t postscriptName;
+  uint32_t family;
+  uint32_t style;
+  uint32_t id;          // the stable ID of the font
+  uint32_t faceIndex;   // the index of the face in its file, or CATALOG_NULL
+  uint16_t weight;
+  uint8_t width;
+  uint8_t flags;
+};
+
+// a family name and the range of its faces in the face table
+struct CatalogFamily {
+  uint32_t name;
+  uint32_t firstFace;
+  uint32_t faceCount;
+};
+
+// The catalog is stored as a single flat image that only uses offsets
+// relative to its start, so that it can be shared with other processes
+// through shared memory and queried in place:
+//
+//   header | fonts | families | faces | indexes | languages | language fonts |
+//   font paths | weights | widths | flags | path fonts | path blocks | paths |
+//   strings
+//
+// faces lists the indices of the faceCount fonts that have a family,
+// grouped by family (in family order), sorted by weight, width and slant.
+// indexes holds two open addressing hash tables of font indices (by
+// postscript name, then by ID) with indexSize buckets each. languages lists
+// the (lowercase) language tags supported by any font, sorted, and language
+// fonts holds a bitset of the fonts that support each of them,
+// languageWords 32 bit words each.
+//
+// font paths, weights, widths and flags copy those fields of the fonts into
+// columns, so that queries on them can scan packed arrays a word of the
+// language bitsets at a time. they are padded to languageWords * 32 fonts.
+//
+// paths holds the distinct font paths, sorted and front coded in blocks of
+// CATALOG_PATH_BLOCK, since paths share long directory prefixes. the first
+// path of a block is stored in full, and each of the others as the length
+// of the prefix it shares with the one before (a LEB128 varint) followed
+// by the rest of it, null terminated. path blocks holds the offset of each
+// block in paths, and path fonts the first font with each path. strings
+// holds each distinct name (and language tag) once.
+struct CatalogHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  uint32_t generation;
+  uint32_t fontCount;
+  uint32_t fontsOffset;
+  uint32_t familyCount;
+  uint32_t familiesOffset;
+  uint32_t faceCount;       // the fonts that have a family, which may be fewer than fontCount
+  uint32_t facesOffset;
+  uint32_t indexSize;
+  uint32_t postscriptNameIndexOffset;
+  uint32_t idIndexOffset;
+  uint32_t languageCount;
+  uint32_t languagesOffset;
+  uint32_t languageWords;
+  uint32_t languageFontsOffset;
+  uint32_t fontPathsOffset;
+  uint32_t weightsOffset;
+  uint32_t widthsOffset;
+  uint32_t flagsOffset;
+  uint32_t pathCount;
+  uint32_t pathFontsOffset;
+  uint32_t pathBlocksOffset;
+  uint32_t pathsOffset;
+  uint32_t pathsSize;
+  uint32_t stringsOffset;
+  uint32_t stringsSize;
+  uint32_t rawPathsSize;    // the size of the paths of all fonts as separate strings
+  uint32_t rawStringsSize;  // ditto for the names of all fonts
+  uint32_t idAttempts;      // one more than the last attempt any font's ID took (see getFontId)
+};
+
+// The catalog holds every font available on the system, enumerated once
+// through the platform backend and reused by later queries. Data derived
+// from it (such as the family grouping) is computed when the catalog is
+// built, so it is dropped and rebuilt together with the catalog whenever
+// the backend reports that the installed fonts changed.
+class FontCatalog {
+public:
+  // builds a catalog image from the fonts returned by the backend. fonts
+  // that are in the previous version (if any) keep their IDs.
+  static FontCatalog *create(ResultSet *fonts, unsigned int generation, const FontCatalog *previous = NULL);
+
+  // wraps an existing image. mapped images are unmapped when the catalog
+  // is destroyed, others are deleted.
+  FontCatalog(const char *data, bool mapped);
+  ~FontCatalog();
+
+  // checks that an image of the given size is a valid catalog
+  static bool validate(const char *data, size_t size);
+
+  const char *data;
+  const CatalogHeader *header;
+  unsigned int generation;
+  unsigned int epoch;     // see getCatalogGeneration
+
+  // the generation and epoch of the catalog, as getCatalogGeneration
+  // returned them while it was current
+  uint64_t cacheGeneration() const {
+    return (uint64_t) epoch << 32 | generation;
+  }
+
+  uint32_t fontCount() const {
+    return header->fontCount;
+  }
+
+  const CatalogFont &font(uint32_t index) const {
+    return ((const CatalogFont *) (data + header->fontsOffset))[index];
+  }
+
+  uint32_t familyCount() const {
+    return header->familyCount;
+  }
+
+  const CatalogFamily &family(uint32_t index) const {
+    return ((const CatalogFamily *) (data + header->familiesOffset))[index];
+  }
+
+  // returns the index of a font in the face table
+  uint32_t face(uint32_t index) const {
+    return ((const uint32_t *) (data + header->facesOffset))[index];
+  }
+
+  // returns a string from the string table, or NULL
+  const char *string(uint32_t offset) const {
+    return offset == CATALOG_NULL ? NULL : data + header->stringsOffset + offset;
+  }
+
+  uint32_t pathCount() const {
+    return header->pathCount;
+  }
+
+  // decodes the path with the given number into buffer, and returns it, or
+  // NULL for CATALOG_NULL. this walks its block from the start, so it takes
+  // at most CATALOG_PATH_BLOCK steps.
+  const char *path(uint32_t number, std::string &buffer) const;
+
+  // returns the number of a path in the path table, or CATALOG_NULL
+  uint32_t findPath(const char *path) const;
+
+  // returns the number of the first path that sorts at or after the given
+  // one (or pathCount() if there is none), and decodes it into buffer
+  uint32_t lowerBoundPath(const char *path, std::string &buffer) const;
+
+  // returns the index of the first font with the path with the given number
+  uint32_t pathFont(uint32_t number) const {
+    return ((const uint32_t *) (data + header->pathFontsOffset))[number];
+  }
+
+  // returns the index of the first font with the given postscript name or
+  // path, or CATALOG_NULL if there is none
+  uint32_t find(CatalogIndex index, const char *value) const;
+
+  // returns the index of the font with the given ID, or CATALOG_NULL
+  uint32_t findById(uint32_t id) const;
+
+  // returns the index of the font a descriptor returned by the platform
+  // refers to, by its path and face index, or CATALOG_NULL
+  uint32_t findFont(FontDescriptor *desc) const;
+
+  uint32_t languageCount() const {
+    return header->languageCount;
+  }
+
+  // returns a language tag from the language table
+  const char *language(uint32_t index) const {
+    return string(((const uint32_t *) (data + header->languagesOffset))[index]);
+  }
+
+  // returns the bitset of fonts that support a language
+  const uint32_t *languageFonts(uint32_t index) const {
+    return (const uint32_t *) (data + header->languageFontsOffset) + (size_t) index * header->languageWords;
+  }
+
+  // the columns of the path numbers, weights, widths and flags of the fonts
+  const uint32_t *fontPaths() const {
+    return (const uint32_t *) (data + header->fontPathsOffset);
+  }
+
+  const uint16_t *weights() const {
+    return (const uint16_t *) (data + header->weightsOffset);
+  }
+
+  const uint8_t *widths() const {
+    return (const uint8_t *) (data + header->widthsOffset);
+  }
+
+  const uint8_t *flags() const {
+    return (const uint8_t *) (data + header->flagsOffset);
+  }
+
+  // finds the fonts matching a query with a language, script, range, family
+  // list or path prefix, in catalog order. the fonts are selected with a
+  // bitset, by intersecting the language bitsets, scanning the columns for
+  // the numeric fields, flags and path prefix, and marking the faces of the
+  // families in the list, and then checked against the names in the query.
+  // if named is given, it holds the fonts the platform found for the family
+  // and style names of the query, which are then not checked again.
+  void findFonts(FontDescriptor *desc, std::vector<uint32_t> &res, const std::vector<uint32_t> *named = NULL) const;
+
+  // whether the catalog has all the family names and the style of a query.
+  // it keeps one name of each, so the platform may know others (such as
+  // localized ones) that findFonts can't match.
+  bool hasNames(FontDescriptor *desc) const;
+
+  // creates a standalone copy of a font in the catalog
+  FontDescriptor *createFontDescriptor(uint32_t index) const;
+
+  // returns the index for searching family names, which is built the first
+  // time it is needed and dropped together with the catalog
+  const FamilySearch *familySearch();
+
+  // returns the index for searching family names if it was built already, or NULL
+  const FamilySearch *builtFamilySearch();
+
+private:
+  bool mapped;
+  FamilySearch *search;
+  uv_mutex_t searchLock;
+};
+
+// Computes the ID of a font from its path and face index, or its postscript
+// name if the platform does not report face indices. IDs don't depend on
+// anything else, so they are the same in every process. The few faces whose
+// IDs collide with another face's are given the ID of a later attempt
+// instead: faces that were in the previous version of the catalog keep
+// their IDs, and the others take turns in the order of their paths.
+uint32_t getFontId(const char *path, uint32_t faceIndex, const char *postscriptName, uint32_t attempt);
+
+// returns the language that stands for an ISO 15924 script code (e.g.
+// "ja" for "Jpan") in language queries, or NULL if the script is unknown
+const char *getScriptLanguage(const char *script);
+
+// returns the current catalog, building it if needed. the catalog never
+// changes once built; when the fonts change, a new version replaces it, and
+// callers keep the version they got until they let go of it. while another
+// thread builds the new version, this returns the previous one rather than
+// waiting for it.
+std::shared_ptr<FontCatalog> getCatalog();
+
+// returns the current catalog if it is up to date and can be returned
+// without polling the backend or building anything, or NULL. this lets the
+// event loop thread answer requests from the catalog when it is ready.
+std::shared_ptr<FontCatalog> getReadyCatalog();
+
+// builds a new version of the catalog now, rather than when the backend
+// next reports a change, and returns its generation. queries keep using
+// the previous version until the new one is ready.
+unsigned int refreshCatalog();
+
+// returns the generation of the installed fonts. it changes whenever the
+// backend reports that fonts were added or removed, which invalidates the
+// catalog and anything else derived from the installed fonts. the shared
+// catalog is numbered separately, so the high 32 bits hold an epoch that
+// changes whenever this process attaches to or detaches from one, and
+// generations should only be compared for equality.
+uint64_t getCatalogGeneration();
+
+// returns the fallback chain for a font and language (which may be NULL),
+// memoized until the installed fonts change. returns NULL (also memoized)
+// if no font has the postscript name
+std::shared_ptr<FallbackChain> getCachedFallbackChain(const char *postscriptName, const char *lang);
+
+// publishes the catalog to shared memory under the given name, and keeps
+// republishing it whenever it is rebuilt. returns the shared generation,
+// or 0 if the catalog could not be published.
+unsigned int publishCatalog(const char *name);
+
+// switches this process over to the catalog published under the given
+// name. returns false if there is no such catalog.
+bool attachCatalog(const char *name);
+
+// stops publishing or reading a shared catalog
+void detachCatalog();
+
+#endif
@@ -5,7 +5,11 @@
 #include <nan.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <string>
 #include <vector>
+#include <unordered_map>
+#include "StringCache.h"
 
 using namespace v8;
 
@@ -35,6 +39,9 @@ enum FontWidth {
   FontWidthUltraExpanded  = 9
 };
 
+// the upper bound of weight and width ranges that don't set a maximum
+#define FONT_RANGE_MAX 0xffff
+
 struct FontDescriptor {
 public:
   const char *path;
@@ -45,9 +52,24 @@ public:
   FontWidth width;
   bool italic;
   bool monospace;
+  const char *variations; // axis positions of a variable font, as "wght=550,wdth=100"
+  const char *lang;       // a language the font must support (for queries)
+  const char *script;     // an ISO 15924 script the font must support (for queries)
+  const char *languages;  // the languages the font supports, as "en|fr|ja"
+  int faceIndex;          // the index of the face in its file, or -1 if the platform does not say
+  const char *pathPrefix; // what the path of the font must start with (for queries)
+  std::vector<std::string> families; // families the font may be in (for queries)
+  int minWeight;          // the range of weights the font must be in (for queries),
+  int maxWeight;          // 0 to FONT_RANGE_MAX when there is no range
+  int minWidth;           // ditto for widths
+  int maxWidth;
+
 
   FontDescriptor(Local<Object> obj) {
     path = NULL;
+    variations = NULL;
+    languages = NULL;
+    faceIndex = -1;
     postscriptName = getString(obj, "postscriptName");
     family = getString(obj, "family");
     style = getString(obj, "style");
@@ -55,10 +77,24 @@ public:
     width = (FontWidth) getNumber(obj, "width");
     italic = getBool(obj, "italic");
     monospace = getBool(obj, "monospace");
+    lang = getString(obj, "lang");
+    script = getString(obj, "script");
+    pathPrefix = getString(obj, "pathPrefix");
+    families = getStrings(obj, "family");
+    getRange(obj, "weight", &minWeight, &maxWeight);
+    getRange(obj, "width", &minWidth, &maxWidth);
   }
 
   FontDescriptor() {
     path = NULL;
+    variations = NULL;
+    lang = NULL;
+    script = NULL;
+    languages = NULL;
+    faceIndex = -1;
+    pathPrefix = NULL;
+    minWeight = minWidth = 0;
+    maxWeight = maxWidth = FONT_RANGE_MAX;
     postscriptName = NULL;
     family = NULL;
     style = NULL;
@@ -78,6 +114,14 @@ public:
     this->width = width;
     this->italic = italic;
     this->monospace = monospace;
+    this->variations = NULL;
+    this->lang = NULL;
+    this->script = NULL;
+    this->languages = NULL;
+    this->faceIndex = -1;
+    this->pathPrefix = NULL;
+    this->minWeight = this->minWidth = 0;
+    this->maxWeight = this->maxWidth = FONT_RANGE_MAX;
   }
 
   FontDescriptor(FontDescriptor *desc) {
@@ -89,50 +133,130 @@ public:
     width = desc->width;
     italic = desc->italic;
     monospace = desc->monospace;
+    variations = copyString(desc->variations);
+    lang = copyString(desc->lang);
+    script = copyString(desc->script);
+    languages = copyString(desc->languages);
+    faceIndex = desc->faceIndex;
+    pathPrefix = copyString(desc->pathPrefix);
+    families = desc->families;
+    minWeight = desc->minWeight;
+    maxWeight = desc->maxWeight;
+    minWidth = desc->minWidth;
+    maxWidth = desc->maxWidth;
   }
 
   ~FontDescriptor() {
     if (path)
-      delete path;
+      delete[] path;
 
     if (postscriptName)
-      delete postscriptName;
+      delete[] postscriptName;
 
     if (family)
-      delete family;
+      delete[] family;
 
     if (style)
-      delete style;
+      delete[] style;
+
+    if (variations)
+      delete[] variations;
+
+    if (lang)
+      delete[] lang;
+
+    if (script)
+      delete[] script;
+
+    if (languages)
+      delete[] languages;
+
+    if (pathPrefix)
+      delete[] pathPrefix;
 
     postscriptName = NULL;
     family = NULL;
     style = NULL;
   }
 
-  Local<Object> toJSObject() {
+  // whether a query has a range, list or prefix, which only the catalog can match
+  bool hasPredicates() const {
+    return pathPrefix || !families.empty() || minWeight > 0 || maxWeight < FONT_RANGE_MAX ||
+      minWidth > 0 || maxWidth < FONT_RANGE_MAX;
+  }
+
+  Local<Object> toJSObject(StringCache *strings) {
+    Nan::EscapableHandleScope scope;
+    Local<Object> res = toJSObject(strings, path, postscriptName, family, style, weight, width, italic, monospace);
+    if (variations) {
+      Nan::Set(res, strings->get("variations"), variationsToJSObject(strings, variations));
+    }
+
+    return scope.Escape(res);
+  }
+
+  void setVariations(const char *variations) {
+    if (this->variations)
+      delete[] this->variations;
+
+    this->variations = copyString(variations);
+  }
+
+  void setLanguages(const char *languages) {
+    if (this->languages)
+      delete[] this->languages;
+
+    this->languages = copyString(languages);
+  }
+
+  // creates a JavaScript font descriptor from its fields
+  static Local<Object> toJSObject(StringCache *strings, const char *path, const char *postscriptName, const char *family,
+                                  const char *style, int weight, int width, bool italic, bool monospace) {
     Nan::EscapableHandleScope scope;
     Local<Object> res = Nan::New<Object>();
 
     if (path) {
-      Nan::Set(res, Nan::New<String>("path").ToLocalChecked(), Nan::New<String>(path).ToLocalChecked());
+      Nan::Set(res, strings->get("path"), strings->get(path));
     }
     
     if (postscriptName) {
-      Nan::Set(res, Nan::New<String>("postscriptName").ToLocalChecked(), Nan::New<String>(postscriptName).ToLocalChecked());
+      Nan::Set(res, strings->get("postscriptName"), strings->get(postscriptName));
     }
     
     if (family) {
-      Nan::Set(res, Nan::New<String>("family").ToLocalChecked(), Nan::New<String>(family).ToLocalChecked());
+      Nan::Set(res, strings->get("family"), strings->get(family));
     }
     
     if (style) {
-      Nan::Set(res, Nan::New<String>("style").ToLocalChecked(), Nan::New<String>(style).ToLocalChecked());
+      Nan::Set(res, strings->get("style"), strings->get(style));
     }
     
-    Nan::Set(res, Nan::New<String>("weight").ToLocalChecked(), Nan::New<Number>(weight));
-    Nan::Set(res, Nan::New<String>("width").ToLocalChecked(), Nan::New<Number>(width));
-    Nan::Set(res, Nan::New<String>("italic").ToLocalChecked(), Nan::New<v8::Boolean>(italic));
-    Nan::Set(res, Nan::New<String>("monospace").ToLocalChecked(), Nan::New<v8::Boolean>(monospace));
+    Nan::Set(res, strings->get("weight"), Nan::New<Number>(weight));
+    Nan::Set(res, strings->get("width"), Nan::New<Number>(width));
+    Nan::Set(res, strings->get("italic"), Nan::New<v8::Boolean>(italic));
+    Nan::Set(res, strings->get("monospace"), Nan::New<v8::Boolean>(monospace));
+    return scope.Escape(res);
+  }
+
+  // converts "wght=550,wdth=100" to an object mapping axis tags to positions
+  static Local<Object> variationsToJSObject(StringCache *strings, const char *variations) {
+    Nan::EscapableHandleScope scope;
+    Local<Object> res = Nan::New<Object>();
+
+    for (const char *p = variations; *p;) {
+      const char *end = strchr(p, ',');
+      if (!end)
+        end = p + strlen(p);
+
+      const char *equals = (const char *) memchr(p, '=', end - p);
+      if (equals) {
+        std::string tag(p, equals - p);
+        Nan::Set(res, strings->get(tag.c_str()), Nan::New<Number>(strtod(equals + 1, NULL)));
+      }
+
+      p = *end ? end + 1 : end;
+    }
+
     return scope.Escape(res);
   }
 
@@ -168,6 +292,44 @@ private:
     return 0;
   }
 
+  // reads an array of strings, or an empty list if the field is not an array
+  std::vector<std::string> getStrings(Local<Object> obj, const char *name) {
+    Nan::HandleScope scope;
+    MaybeLocal<Value> value = Nan::Get(obj, Nan::New<String>(name).ToLocalChecked());
+    std::vector<std::string> res;
+
+    if (!value.IsEmpty() && value.ToLocalChecked()->IsArray()) {
+      Local<Array> array = value.ToLocalChecked().As<Array>();
+      for (uint32_t i = 0; i < array->Length(); i++) {
+        Local<Value> item = Nan::Get(array, i).ToLocalChecked();
+        if (item->IsString())
+          res.push_back(*Nan::Utf8String(item));
+      }
+    }
+
+    return res;
+  }
+
+  // reads a { min, max } range, either of which may be left out. the range
+  // is 0 to FONT_RANGE_MAX if the field is not an object.
+  void getRange(Local<Object> obj, const char *name, int *min, int *max) {
+    Nan::HandleScope scope;
+    MaybeLocal<Value> value = Nan::Get(obj, Nan::New<String>(name).ToLocalChecked());
+    *min = 0;
+    *max = FONT_RANGE_MAX;
+
+    if (!value.IsEmpty() && value.ToLocalChecked()->IsObject()) {
+      Local<Object> range = value.ToLocalChecked().As<Object>();
+      if (range->IsArray() || range->IsFunction())
+        return;
+
+      *min = std::max(getNumber(range, "min"), 0);
+      MaybeLocal<Value> limit = Nan::Get(range, Nan::New<String>("max").ToLocalChecked());
+      if (!limit.IsEmpty() && limit.ToLocalChecked()->IsNumber())
+        *max = std::min(getNumber(range, "max"), FONT_RANGE_MAX);
+    }
+  }
+
   bool getBool(Local<Object> obj, const char *name) {
     Nan::HandleScope scope;
     MaybeLocal<Value> value = Nan::Get(obj, Nan::New<String>(name).ToLocalChecked());
@@ -189,4 +351,139 @@ public:
   }
 };
 
+// a font in a fallback chain, along with the number of code points it adds
+// to the coverage of the fonts before it, and the total coverage so far
+struct FallbackFont {
+  FontDescriptor *font;
+  unsigned int coverage;
+  unsigned int totalCoverage;
+};
+
+class FallbackChain : public std::vector<FallbackFont> {
+public:
+  ~FallbackChain() {
+    for (FallbackChain::iterator it = this->begin(); it != this->end(); it++) {
+      delete it->font;
+    }
+  }
+
+  void add(FontDescriptor *font, unsigned int coverage) {
+    FallbackFont entry;
+    entry.font = font;
+    entry.coverage = coverage;
+    entry.totalCoverage = coverage + (this->empty() ? 0 : this->back().totalCoverage);
+    this->push_back(entry);
+  }
+
+  // converts the first limit entries of the chain to a JavaScript array
+  Local<Array> toJSArray(StringCache *strings, size_t limit) {
+    Nan::EscapableHandleScope scope;
+    size_t count = limit && limit < this->size() ? limit : this->size();
+    Local<Array> res = Nan::New<Array>(count);
+
+    for (size_t i = 0; i < count; i++) {
+      FallbackFont &entry = (*this)[i];
+      Local<Object> obj = Nan::New<Object>();
+      Nan::Set(obj, strings->get("font"), entry.font->toJSObject(strings));
+      Nan::Set(obj, strings->get("coverage"), Nan::New<Number>(entry.coverage));
+      Nan::Set(obj, strings->get("totalCoverage"), Nan::New<Number>(entry.totalCoverage));
+      Nan::Set(res, i, obj);
+    }
+
+    return scope.Escape(res);
+  }
+};
+
+// the result of resolving a CSS style list of font families
+struct FontStackResult {
+public:
+  char *family;                   // the entry in the stack that was resolved, if any
+  FontDescriptor *font;           // the font used for the text
+  std::vector<uint32_t> codepoints; // code points the font does not support
+  std::vector<FontDescriptor *> fallbacks; // the font used for each of them
+  ResultSet fallbackFonts;        // owns the fallback fonts
+  bool hasText;
+
+  FontStackResult() {
+    family = NULL;
+    font = NULL;
+    hasText = false;
+  }
+
+  ~FontStackResult() {
+    if (family)
+      delete[] family;
+
+    if (font)
+      delete font;
+  }
+
+  // copies the entry of the stack that was resolved, so the string is
+  // allocated and released in the same place
+  void setFamily(const char *name) {
+    if (family)
+      delete[] family;
+
+    family = new char[strlen(name) + 1];
+    strcpy(family, name);
+  }
+
+  // records the fallback font for a code point. the font may be NULL if no
+  // font supports it, or one previously passed to addFallbackFont.
+  void addFallback(uint32_t codepoint, FontDescriptor *fallback) {
+    codepoints.push_back(codepoint);
+    fallbacks.push_back(fallback);
+  }
+
+  // takes ownership of a font used for fallbacks
+  FontDescriptor *addFallbackFont(FontDescriptor *fallback) {
+    fallbackFonts.push_back(fallback);
+    return fallback;
+  }
+
+  Local<Object> toJSObject(StringCache *strings) {
+    Nan::EscapableHandleScope scope;
+    Local<Object> res = Nan::New<Object>();
+
+    if (family) {
+      Nan::Set(res, strings->get("family"), strings->get(family));
+    } else {
+      Nan::Set(res, strings->get("family"), Nan::Null());
+    }
+
+    // share objects between fallbacks that use the same font
+    std::unordered_map<FontDescriptor *, Local<Object> > objects;
+    if (font) {
+      objects[font] = font->toJSObject(strings);
+      Nan::Set(res, strings->get("font"), objects[font]);
+    } else {
+      Nan::Set(res, strings->get("font"), Nan::Null());
+    }
+
+    if (hasText) {
+      Local<Array> list = Nan::New<Array>(codepoints.size());
+      for (size_t i = 0; i < codepoints.size(); i++) {
+        Local<Object> entry = Nan::New<Object>();
+        Nan::Set(entry, strings->get("codepoint"), Nan::New<Number>(codepoints[i]));
+
+        FontDescriptor *fallback = fallbacks[i];
+        if (fallback) {
+          if (objects.count(fallback) == 0)
+            objects[fallback] = fallback->toJSObject(strings);
+
+          Nan::Set(entry, strings->get("font"), objects[fallback]);
+        } else {
+          Nan::Set(entry, strings->get("font"), Nan::Null());
+        }
+
+        Nan::Set(list, i, entry);
+      }
+
+      Nan::Set(res, strings->get("fallbacks"), list);
+    }
+
+    return scope.Escape(res);
+  }
+};
+
 #endif
@@ -1,62 +1,453 @@
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <string>
 #include <node.h>
 #include <uv.h>
 #include <v8.h>
 #include <nan.h>
 #include "FontDescriptor.h"
+#include "FontCatalog.h"
+#include "FontMetrics.h"
+#include "RequestQueue.h"
+#include "ResultCache.h"
 
 using namespace v8;
 
 // these functions are implemented by the platform
-ResultSet *getAvailableFonts();
 ResultSet *findFonts(FontDescriptor *);
 FontDescriptor *findFont(FontDescriptor *);
 FontDescriptor *substituteFont(char *, char *);
+FontStackResult *resolveFontStack(std::vector<std::string> &, FontDescriptor *, char *);
 
 // converts a ResultSet to a JavaScript array
-Local<Array> collectResults(ResultSet *results) {
+Local<Array> collectResults(StringCache *strings, ResultSet *results) {
   Nan::EscapableHandleScope scope;
   Local<Array> res = Nan::New<Array>(results->size());
 
   int i = 0;
   for (ResultSet::iterator it = results->begin(); it != results->end(); it++) {
-    Nan::Set(res, i++, (*it)->toJSObject());
+    Nan::Set(res, i++, (*it)->toJSObject(strings));
   }
 
   delete results;
   return scope.Escape(res);
 }
 
+// converts a font in the catalog to a JavaScript object
+Local<Object> catalogFontToJSObject(StringCache *strings, FontCatalog *catalog, uint32_t index) {
+  const CatalogFont &font = catalog->font(index);
+  std::string path;
+  return FontDescriptor::toJSObject(
+    strings,
+    catalog->path(font.path, path),
+    catalog->string(font.postscriptName),
+    catalog->string(font.family),
+    catalog->string(font.style),
+    font.weight,
+    font.width,
+    (font.flags & CatalogItalic) != 0,
+    (font.flags & CatalogMonospace) != 0
+  );
+}
+
+// converts the fonts in the catalog to a JavaScript array
+Local<Array> collectCatalogFonts(StringCache *strings, FontCatalog *catalog) {
+  Nan::EscapableHandleScope scope;
+  Local<Array> res = Nan::New<Array>(catalog->fontCount());
+
+  for (uint32_t i = 0; i < catalog->fontCount(); i++) {
+    Nan::Set(res, i, catalogFontToJSObject(strings, catalog, i));
+  }
+
+  return scope.Escape(res);
+}
+
+// converts the families in the catalog to a JavaScript array of
+// { family, faces } objects
+Local<Array> collectFamilies(StringCache *strings, FontCatalog *catalog) {
+  Nan::EscapableHandleScope scope;
+  Local<Array> res = Nan::New<Array>(catalog->familyCount());
+
+  for (uint32_t i = 0; i < catalog->familyCount(); i++) {
+    const CatalogFamily &family = catalog->family(i);
+    Local<Array> faces = Nan::New<Array>(family.faceCount);
+    for (uint32_t j = 0; j < family.faceCount; j++) {
+      Nan::Set(faces, j, catalogFontToJSObject(strings, catalog, catalog->face(family.firstFace + j)));
+    }
+
+    Local<Object> obj = Nan::New<Object>();
+    Nan::Set(obj, strings->get("family"), strings->get(catalog->string(family.name)));
+    Nan::Set(obj, strings->get("faces"), faces);
+    Nan::Set(res, i, obj);
+  }
+
+  return scope.Escape(res);
+}
+
+// converts the family names in the catalog to a JavaScript array of strings
+Local<Array> collectFamilyNames(StringCache *strings, FontCatalog *catalog) {
+  Nan::EscapableHandleScope scope;
+  Local<Array> res = Nan::New<Array>(catalog->familyCount());
+
+  for (uint32_t i = 0; i < catalog->familyCount(); i++) {
+    Nan::Set(res, i, strings->get(catalog->string(catalog->family(i).name)));
+  }
+
+  return scope.Escape(res);
+}
+
+// converts the names of some of the families in the catalog to a JavaScript array
+Local<Array> collectFamilyNames(StringCache *strings, FontCatalog *catalog, std::vector<uint32_t> &indices) {
+  Nan::EscapableHandleScope scope;
+  Local<Array> res = Nan::New<Array>(indices.size());
+
+  for (size_t i = 0; i < indices.size(); i++) {
+    Nan::Set(res, i, strings->get(catalog->string(catalog->family(indices[i]).name)));
+  }
+
+  return scope.Escape(res);
+}
+
+// converts the result of a catalog lookup to a JavaScript object, or null
+Local<Value> wrapCatalogFont(StringCache *strings, FontCatalog *catalog, uint32_t index) {
+  Nan::EscapableHandleScope scope;
+  if (index == CATALOG_NULL)
+    return scope.Escape(Nan::Null());
+
+  return scope.Escape(catalogFontToJSObject(strings, catalog, index));
+}
+
+// converts the results of a batch of catalog lookups to a JavaScript array
+Local<Array> collectCatalogFonts(StringCache *strings, FontCatalog *catalog, std::vector<uint32_t> &indices) {
+  Nan::EscapableHandleScope scope;
+  Local<Array> res = Nan::New<Array>(indices.size());
+
+  for (size_t i = 0; i < indices.size(); i++) {
+    Nan::Set(res, i, wrapCatalogFont(strings, catalog, indices[i]));
+  }
+
+  return scope.Escape(res);
+}
+
+// converts font metrics to a JavaScript object, or null
+Local<Value> wrapMetrics(StringCache *strings, const FontMetrics *metrics) {
+  Nan::EscapableHandleScope scope;
+  if (metrics == NULL)
+    return scope.Escape(Nan::Null());
+
+  Local<Object> res = Nan::New<Object>();
+  Nan::Set(res, strings->get("unitsPerEm"), Nan::New<Number>(metrics->unitsPerEm));
+  Nan::Set(res, strings->get("ascent"), Nan::New<Number>(metrics->ascent));
+  Nan::Set(res, strings->get("descent"), Nan::New<Number>(metrics->descent));
+  Nan::Set(res, strings->get("lineGap"), Nan::New<Number>(metrics->lineGap));
+  Nan::Set(res, strings->get("capHeight"), Nan::New<Number>(metrics->capHeight));
+  Nan::Set(res, strings->get("xHeight"), Nan::New<Number>(metrics->xHeight));
+  Nan::Set(res, strings->get("italicAngle"), Nan::New<Number>(metrics->italicAngle));
+  return scope.Escape(res);
+}
+
+typedef std::vector<std::shared_ptr<const FontMetrics> > MetricsList;
+
+// converts the metrics of several fonts to a JavaScript array
+Local<Array> collectMetrics(StringCache *strings, MetricsList &metrics) {
+  Nan::EscapableHandleScope scope;
+  Local<Array> res = Nan::New<Array>(metrics.size());
+
+  for (size_t i = 0; i < metrics.size(); i++) {
+    Nan::Set(res, i, wrapMetrics(strings, metrics[i].get()));
+  }
+
+  return scope.Escape(res);
+}
+
+// converts the axes and named instances of a font to a JavaScript object, or null
+Local<Value> wrapVariations(StringCache *strings, const FontVariations *variations) {
+  Nan::EscapableHandleScope scope;
+  if (variations == NULL)
+    return scope.Escape(Nan::Null());
+
+  Local<Array> axes = Nan::New<Array>(variations->axes.size());
+  for (size_t i = 0; i < variations->axes.size(); i++) {
+    const FontAxis &axis = variations->axes[i];
+    Local<Object> obj = Nan::New<Object>();
+    Nan::Set(obj, strings->get("tag"), Nan::New<String>(axis.tag).ToLocalChecked());
+    Nan::Set(obj, strings->get("name"), Nan::New<String>(axis.name).ToLocalChecked());
+    Nan::Set(obj, strings->get("min"), Nan::New<Number>(axis.min));
+    Nan::Set(obj, strings->get("default"), Nan::New<Number>(axis.defaultValue));
+    Nan::Set(obj, strings->get("max"), Nan::New<Number>(axis.max));
+    Nan::Set(obj, strings->get("hidden"), Nan::New<Boolean>(axis.hidden));
+    Nan::Set(axes, i, obj);
+  }
+
+  Local<Array> instances = Nan::New<Array>(variations->instances.size());
+  for (size_t i = 0; i < variations->instances.size(); i++) {
+    const FontInstance &instance = variations->instances[i];
+    Local<Object> coordinates = Nan::New<Object>();
+    for (size_t j = 0; j < instance.coordinates.size() && j < variations->axes.size(); j++) {
+      Nan::Set(coordinates, Nan::New<String>(variations->axes[j].tag).ToLocalChecked(), Nan::New<Number>(instance.coordinates[j]));
+    }
+
+    Local<Object> obj = Nan::New<Object>();
+    Nan::Set(obj, strings->get("name"), Nan::New<String>(instance.name).ToLocalChecked());
+    if (instance.postscriptName.empty())
+      Nan::Set(obj, strings->get("postscriptName"), Nan::Null());
+    else
+      Nan::Set(obj, strings->get("postscriptName"), Nan::New<String>(instance.postscriptName).ToLocalChecked());
+    Nan::Set(obj, strings->get("coordinates"), coordinates);
+    Nan::Set(instances, i, obj);
+  }
+
+  Local<Object> res = Nan::New<Object>();
+  Nan::Set(res, strings->get("axes"), axes);
+  Nan::Set(res, strings->get("instances"), instances);
+  return scope.Escape(res);
+}
+
+// copies floats into a new Float32Array
+Local<Float32Array> createFloat32Array(const std::vector<float> &values) {
+  Nan::EscapableHandleScope scope;
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(Isolate::GetCurrent(), values.size() * sizeof(float));
+  Local<Float32Array> res = Float32Array::New(buffer, 0, values.size());
+  if (!values.empty()) {
+    Nan::TypedArrayContents<float> contents(res);
+    memcpy(*contents, &values[0], values.size() * sizeof(float));
+  }
+
+  return scope.Escape(res);
+}
+
+// copies font IDs into a new Uint32Array
+Local<Uint32Array> createUint32Array(const std::vector<uint32_t> &values) {
+  Nan::EscapableHandleScope scope;
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(Isolate::GetCurrent(), values.size() * sizeof(uint32_t));
+  Local<Uint32Array> res = Uint32Array::New(buffer, 0, values.size());
+  if (!values.empty()) {
+    Nan::TypedArrayContents<uint32_t> contents(res);
+    memcpy(*contents, &values[0], values.size() * sizeof(uint32_t));
+  }
+
+  return scope.Escape(res);
+}
+
+// converts font IDs to a Uint32Array for batches, or a single ID or null
+Local<Value> wrapIds(std::vector<uint32_t> &ids, bool batch) {
+  Nan::EscapableHandleScope scope;
+  if (batch)
+    return scope.Escape(createUint32Array(ids));
+
+  if (ids.empty() || ids[0] == CATALOG_NULL)
+    return scope.Escape(Nan::Null());
+
+  return scope.Escape(Nan::New<Number>(ids[0]));
+}
+
+// the results of measuring one or more strings
+struct TextMeasurements {
+  bool found;                              // whether the font was found
+  std::vector<double> widths;              // the width of each string
+  std::vector<std::vector<float> > advances; // the advance of each codepoint of each string, if requested
+};
+
+// converts text measurements to a width, a Float32Array of advances, or an
+// array of them for batches
+Local<Value> wrapMeasurements(TextMeasurements &measurements, bool batch, bool advances) {
+  Nan::EscapableHandleScope scope;
+  if (!measurements.found)
+    return scope.Escape(Nan::Null());
+
+  if (!batch && advances)
+    return scope.Escape(createFloat32Array(measurements.advances[0]));
+
+  if (!batch)
+    return scope.Escape(Nan::New<Number>(measurements.widths[0]));
+
+  if (!advances) {
+    std::vector<float> widths(measurements.widths.begin(), measurements.widths.end());
+    return scope.Escape(createFloat32Array(widths));
+  }
+
+  Local<Array> res = Nan::New<Array>(measurements.advances.size());
+  for (size_t i = 0; i < measurements.advances.size(); i++) {
+    Nan::Set(res, i, createFloat32Array(measurements.advances[i]));
+  }
+
+  return scope.Escape(res);
+}
+
 // converts a FontDescriptor to a JavaScript object
-Local<Value> wrapResult(FontDescriptor *result) {
+Local<Value> wrapResult(StringCache *strings, FontDescriptor *result) {
   Nan::EscapableHandleScope scope;
   if (result == NULL)
     return scope.Escape(Nan::Null());
 
-  Local<Object> res = result->toJSObject();
+  Local<Object> res = result->toJSObject(strings);
+  delete result;
+  return scope.Escape(res);
+}
+
+// converts a FontStackResult to a JavaScript object
+Local<Value> wrapResult(StringCache *strings, FontStackResult *result) {
+  Nan::EscapableHandleScope scope;
+  Local<Object> res = result->toJSObject(strings);
   delete result;
   return scope.Escape(res);
 }
 
+// the parts of the catalog a request can return
+enum CatalogResult {
+  CatalogFonts,
+  CatalogFamilies,
+  CatalogFamilyNames
+};
+
+// what a request passes to its callback, and the fields of the request
+// that hold it
+enum ResultKind {
+  ResultNone,           // null
+  ResultFont,           // result, or null
+  ResultFonts,          // results
+  ResultFontStack,      // stack
+  ResultFallbackChain,  // chain, or null
+  ResultCatalog,        // the catalogResult part of catalog
+  ResultCatalogFonts,   // the fonts of catalog at indices (an array if batch)
+  ResultFamilyNames,    // the names of the families of catalog at indices
+  ResultIds,            // ids (an array if batch)
+  ResultMetrics,        // metrics (an array if batch)
+  ResultVariations,     // variations
+  ResultMeasurements,   // measurements (an array if batch)
+  ResultGeneration      // generation
+};
+
+// why a request was dropped instead of running
+enum RequestError {
+  RequestOk,
+  RequestAborted,
+  RequestTimedOut
+};
+
+// whether the catalog was built ahead of the first call
+enum PrewarmState {
+  PrewarmIdle,
+  PrewarmRunning,
+  PrewarmDone
+};
+
+struct AsyncRequest;
+
+// async cleanup hooks let an environment that is shutting down wait for the
+// work an addon still has in flight
+#if NODE_MAJOR_VERSION > 14 || (NODE_MAJOR_VERSION == 14 && NODE_MINOR_VERSION >= 8) || \
+  (NODE_MAJOR_VERSION == 12 && NODE_MINOR_VERSION >= 19)
+#define ASYNC_CLEANUP_HOOKS
+#endif
+
+// the state of the addon for one Node.js environment (the main thread or a
+// worker). the catalog and caches are shared by the whole process, but
+// requests have to call back on the event loop of the isolate that made them.
+struct AddonData {
+  Isolate *isolate;
+  uv_loop_t *loop;          // the event loop requests call back on
+  RequestQueue queue;       // the requests waiting for a thread
+  unsigned int pending;     // work items and timers that have not finished or closed yet
+  bool closing;             // whether the environment is shutting down
+  PrewarmState prewarmState;
+  Nan::Persistent<Promise::Resolver> prewarmResolver;
+  uv_async_t *flush;        // calls back the requests answered without the threadpool
+  StringCache strings;      // the strings results are built from
+  std::vector<AsyncRequest *> answered; // the requests waiting for the next flush
+#ifdef ASYNC_CLEANUP_HOOKS
+  node::AsyncCleanupHookHandle cleanupHook;
+#endif
+  void (*cleanupDone)(void *); // tells the environment it can go once nothing is pending
+  void *cleanupDoneArg;
+
+  AddonData(Isolate *isolate) {
+    this->isolate = isolate;
+    loop = Nan::GetCurrentEventLoop();
+    pending = 0;
+    closing = false;
+    prewarmState = PrewarmIdle;
+    flush = NULL;
+    cleanupDone = NULL;
+    cleanupDoneArg = NULL;
+  }
+};
+
+void releaseAddon(AddonData *addon);
+
+// returns the state of the environment a method was called from
+AddonData *getAddonData(NAN_METHOD_ARGS_TYPE info) {
+  return (AddonData *) info.Data().As<External>()->Value();
+}
+
 // holds data about an operation that will be
 // performed on a background thread
 struct AsyncRequest {
   uv_work_t work;
-  FontDescriptor *desc;     // used by findFont and findFonts
-  char *postscriptName;     // used by substituteFont
-  char *substitutionString; // ditto
+  AddonData *addon;         // the environment that made the request
+  uv_work_cb execute;       // performs the operation on the threadpool
+  int priority;             // requests with a higher priority run first
+  uint64_t deadline;        // time (from uv_hrtime) after which the request is dropped, or 0
+  uv_timer_t *timer;        // cancels the request at the deadline
+  Nan::Persistent<Object> signal;           // the AbortSignal for the request
+  Nan::Persistent<Function> abortListener;  // listens for abort events on the signal
+  std::atomic<int> error;   // set when the request is aborted or times out
+  bool done;                // whether the callback was called
+  FontDescriptor *desc;     // used by findFont, findFonts and resolveFontStack
+  char *postscriptName;     // used by substituteFont and getFallbackChain
+  char *substitutionString; // used by substituteFont and resolveFontStack
+  std::vector<std::string> families; // used by resolveFontStack
+  FontStackResult *stack;   // for resolveFontStack
+  char *lang;               // used by getFallbackChain
+  unsigned int limit;       // used by getFallbackChain and searchFamilies
+  std::shared_ptr<FallbackChain> chain; // for getFallbackChain
   FontDescriptor *result;   // for functions with a single result
   ResultSet *results;       // for functions with multiple results
+  std::shared_ptr<FontCatalog> catalog; // for functions that read the catalog
+  CatalogResult catalogResult;          // which part of the catalog to return
+  std::vector<std::string> keys;        // used by catalog lookups and searchFamilies
+  std::vector<uint32_t> indices;        // for catalog lookups
+  std::vector<uint32_t> ids;            // used by getFontsById, and for findFontIds and substituteFontId
+  unsigned int generation;              // for refreshCatalog
+  std::vector<FontDescriptor *> queries;  // used by getFontMetrics
+  MetricsList metrics;                    // for getFontMetrics
+  std::shared_ptr<const FontVariations> variations; // for getFontVariations
+  std::vector<std::string> texts;         // used by measureText
+  double size;                            // the font size measureText uses
+  bool kerning;                           // whether measureText applies kerning
+  bool advances;                          // whether measureText returns the advance of each glyph
+  TextMeasurements measurements;          // for measureText
+  ResultKind kind;          // what the callback is called with
+  bool batch;               // whether the result is an array, for the kinds that say so
   Nan::Callback *callback;  // the actual JS callback to call when we are done
 
-  AsyncRequest(Local<Value> v) {
+  AsyncRequest(AddonData *addon, Local<Value> v) {
     work.data = (void *)this;
+    this->addon = addon;
     callback = new Nan::Callback(v.As<Function>());
     desc = NULL;
     postscriptName = NULL;
     substitutionString = NULL;
     result = NULL;
     results = NULL;
+    stack = NULL;
+    lang = NULL;
+    limit = 0;
+    catalogResult = CatalogFonts;
+    generation = 0;
+    size = 0;
+    kerning = true;
+    advances = false;
+    kind = ResultNone;
+    batch = false;
+    execute = NULL;
+    priority = 0;
+    deadline = 0;
+    timer = NULL;
+    error = RequestOk;
+    done = false;
   }
 
   ~AsyncRequest() {
@@ -66,159 +457,1689 @@ struct AsyncRequest {
       delete desc;
 
     if (postscriptName)
-      delete postscriptName;
+      delete[] postscriptName;
 
     if (substitutionString)
-      delete substitutionString;
+      delete[] substitutionString;
+
+    if (lang)
+      delete[] lang;
+
+    for (size_t i = 0; i < queries.size(); i++) {
+      delete queries[i];
+    }
 
-    // result/results deleted by wrapResult/collectResults respectively
+    // result/results/stack are normally deleted by wrapResult/collectResults,
+    // unless the request was cancelled while it was running
+    delete result;
+    delete results;
+    delete stack;
+
+    signal.Reset();
+    abortListener.Reset();
   }
 };
 
-// calls the JavaScript callback for a request
-void asyncCallback(uv_work_t *work) {
+// converts the requested part of the catalog to a JavaScript array
+Local<Array> collectCatalog(StringCache *strings, FontCatalog *catalog, CatalogResult type) {
+  switch (type) {
+    case CatalogFamilies:
+      return collectFamilies(strings, catalog);
+    case CatalogFamilyNames:
+      return collectFamilyNames(strings, catalog);
+    default:
+      return collectCatalogFonts(strings, catalog);
+  }
+}
+
+// creates the error a cancelled request's callback is called with
+Local<Value> requestError(int error) {
+  Nan::EscapableHandleScope scope;
+  bool aborted = error == RequestAborted;
+  Local<Object> err = Nan::Error(aborted ? "The operation was aborted" : "The operation timed out").As<Object>();
+  Nan::Set(err, Nan::New<String>("name").ToLocalChecked(), Nan::New<String>(aborted ? "AbortError" : "TimeoutError").ToLocalChecked());
+  Nan::Set(err, Nan::New<String>("code").ToLocalChecked(), Nan::New<String>(aborted ? "ABORT_ERR" : "ETIMEDOUT").ToLocalChecked());
+  return scope.Escape(err);
+}
+
+void closeTimer(uv_handle_t *handle) {
+  AddonData *addon = (AddonData *) handle->data;
+  delete (uv_timer_t *) handle;
+  addon->pending--;
+  releaseAddon(addon);
+}
+
+// releases a request after its callback was called and it is no longer running
+void finishRequest(AsyncRequest *req) {
+  if (req->timer) {
+    uv_timer_stop(req->timer);
+    req->timer->data = req->addon;
+    uv_close((uv_handle_t *) req->timer, closeTimer);
+  }
+
+  // JavaScript can't run anymore once the environment is shutting down
+  if (!req->signal.IsEmpty() && !req->addon->closing) {
+    Nan::HandleScope scope;
+    Local<Object> signal = Nan::New(req->signal);
+    Local<Value> remove = Nan::Get(signal, Nan::New<String>("removeEventListener").ToLocalChecked()).ToLocalChecked();
+    if (remove->IsFunction()) {
+      Local<Value> args[] = { Nan::New<String>("abort").ToLocalChecked(), Nan::New(req->abortListener) };
+      Nan::Call(remove.As<Function>(), signal, 2, args);
+    }
+  }
+
+  delete req;
+}
+
+// calls the callback of a request that has not finished yet with an error.
+// requests that are still queued are dropped, and the results of requests
+// that are already running are discarded once they finish.
+void cancelRequest(AsyncRequest *req, int error) {
+  if (req->done || req->addon->closing)
+    return;
+
+  int expected = RequestOk;
+  req->error.compare_exchange_strong(expected, error);
+  req->done = true;
+  bool queued = req->addon->queue.remove(req);
+
   Nan::HandleScope scope;
-  AsyncRequest *req = (AsyncRequest *) work->data;
   Nan::AsyncResource async("asyncCallback");
-  Local<Value> info[1];
+  Local<Value> info[] = { requestError(req->error) };
+  req->callback->Call(1, info, &async);
 
-  if (req->results) {
-    info[0] = collectResults(req->results);
-  } else if (req->result) {
-    info[0] = wrapResult(req->result);
-  } else {
-    info[0] = Nan::Null();
+  if (queued)
+    finishRequest(req);
+}
+
+void onRequestTimeout(uv_timer_t *timer) {
+  cancelRequest((AsyncRequest *) timer->data, RequestTimedOut);
+}
+
+NAN_METHOD(onRequestAbort) {
+  cancelRequest((AsyncRequest *) info.Data().As<External>()->Value(), RequestAborted);
+}
+
+// the longest request timeout, in milliseconds. like JavaScript timers,
+// longer timeouts are shortened to it.
+#define MAX_REQUEST_TIMEOUT 0x7fffffff
+
+// checks the scheduling options of an async request, and throws a
+// TypeError if they are invalid
+bool checkRequestOptions(Local<Object> options) {
+  Local<Value> timeout = Nan::Get(options, Nan::New<String>("timeout").ToLocalChecked()).ToLocalChecked();
+  if (timeout->IsUndefined())
+    return true;
+
+  double ms = timeout->IsNumber() ? Nan::To<double>(timeout).FromJust() : -1;
+  if (!isfinite(ms) || ms < 0) {
+    Nan::ThrowTypeError("Expected timeout to be a non-negative number");
+    return false;
   }
 
-  req->callback->Call(1, info, &async);
-  delete req;
+  return true;
 }
 
-void getAvailableFontsAsync(uv_work_t *work) {
-  AsyncRequest *req = (AsyncRequest *) work->data;
-  req->results = getAvailableFonts();
+// reads the scheduling options of an async request
+void setRequestOptions(AsyncRequest *req, Local<Object> options) {
+  Local<Value> priority = Nan::Get(options, Nan::New<String>("priority").ToLocalChecked()).ToLocalChecked();
+  Local<Value> timeout = Nan::Get(options, Nan::New<String>("timeout").ToLocalChecked()).ToLocalChecked();
+  Local<Value> signal = Nan::Get(options, Nan::New<String>("signal").ToLocalChecked()).ToLocalChecked();
+
+  if (priority->IsNumber())
+    req->priority = Nan::To<int32_t>(priority).FromJust();
+
+  if (timeout->IsNumber() && Nan::To<double>(timeout).FromJust() > 0) {
+    uint64_t ms = (uint64_t) std::min(Nan::To<double>(timeout).FromJust(), (double) MAX_REQUEST_TIMEOUT);
+    req->deadline = uv_hrtime() + ms * 1000000;
+    req->timer = new uv_timer_t;
+    req->timer->data = req;
+    req->addon->pending++;
+    uv_timer_init(req->addon->loop, req->timer);
+    uv_timer_start(req->timer, onRequestTimeout, ms, 0);
+  }
+
+  if (signal->IsObject()) {
+    Local<Object> obj = signal.As<Object>();
+    Local<Value> aborted = Nan::Get(obj, Nan::New<String>("aborted").ToLocalChecked()).ToLocalChecked();
+    Local<Value> add = Nan::Get(obj, Nan::New<String>("addEventListener").ToLocalChecked()).ToLocalChecked();
+
+    // requests with a signal that was already aborted are dropped before they run
+    if (Nan::To<bool>(aborted).FromJust()) {
+      req->error = RequestAborted;
+    } else if (add->IsFunction()) {
+      Local<Function> listener = Nan::New<Function>(onRequestAbort, Nan::New<External>(req));
+      Local<Value> args[] = { Nan::New<String>("abort").ToLocalChecked(), listener };
+      Nan::Call(add.As<Function>(), obj, 2, args);
+      req->signal.Reset(obj);
+      req->abortListener.Reset(listener);
+    }
+  }
 }
 
-template<bool async>
-NAN_METHOD(getAvailableFonts) {
-  if (async) {
-    if (info.Length() < 1 || !info[0]->IsFunction())
-      return Nan::ThrowTypeError("Expected a callback");
+// creates a request for an async method. the callback is at the given index,
+// optionally preceded by an object with scheduling options (priority,
+// timeout and signal). throws a TypeError and returns NULL if there is no
+// callback or the options are invalid.
+AsyncRequest *createRequest(NAN_METHOD_ARGS_TYPE info, int index) {
+  Local<Object> options;
+  if (info.Length() > index && info[index]->IsObject() && !info[index]->IsFunction())
+    options = info[index++].As<Object>();
+
+  if (info.Length() <= index || !info[index]->IsFunction()) {
+    Nan::ThrowTypeError("Expected a callback");
+    return NULL;
+  }
+
+  if (!options.IsEmpty() && !checkRequestOptions(options))
+    return NULL;
+
+  AsyncRequest *req = new AsyncRequest(getAddonData(info), info[index]);
+  if (!options.IsEmpty())
+    setRequestOptions(req, options);
+
+  return req;
+}
 
-    AsyncRequest *req = new AsyncRequest(info[0]);
-    uv_queue_work(uv_default_loop(), &req->work, getAvailableFontsAsync, (uv_after_work_cb) asyncCallback);
+// a work item on the threadpool. every queued request gets one, but the work
+// items always run whichever request has the highest priority, so urgent
+// requests don't have to wait behind earlier bulk requests.
+struct RequestWork {
+  uv_work_t work;
+  AddonData *addon;
+  AsyncRequest *req;        // the request that ran, or NULL if it was cancelled while queued
+};
 
+// runs on the threadpool
+void runRequest(uv_work_t *work) {
+  RequestWork *item = (RequestWork *) work->data;
+  AsyncRequest *req = (AsyncRequest *) item->addon->queue.pop();
+  item->req = req;
+  if (!req)
     return;
-  } else {
-    info.GetReturnValue().Set(collectResults(getAvailableFonts()));
+
+  int expected = RequestOk;
+  if (req->deadline && uv_hrtime() >= req->deadline)
+    req->error.compare_exchange_strong(expected, RequestTimedOut);
+
+  if (req->error == RequestOk)
+    req->execute(&req->work);
+}
+
+void asyncCallback(AsyncRequest *req);
+void completeRequest(AsyncRequest *req);
+
+void afterRequest(uv_work_t *work, int status) {
+  RequestWork *item = (RequestWork *) work->data;
+  AsyncRequest *req = item->req;
+  AddonData *addon = item->addon;
+  delete item;
+
+  // the request was cancelled while it was queued
+  if (req)
+    completeRequest(req);
+
+  addon->pending--;
+  releaseAddon(addon);
+}
+
+// calls back a request that has finished running, unless it was cancelled
+void completeRequest(AsyncRequest *req) {
+  // the request was cancelled while it was running, or its environment is shutting down
+  if (req->done || req->addon->closing)
+    return finishRequest(req);
+
+  if (req->error != RequestOk) {
+    Nan::HandleScope scope;
+    Nan::AsyncResource async("asyncCallback");
+    Local<Value> info[] = { requestError(req->error) };
+    req->done = true;
+    req->callback->Call(1, info, &async);
+    return finishRequest(req);
   }
+
+  asyncCallback(req);
 }
 
-void findFontsAsync(uv_work_t *work) {
-  AsyncRequest *req = (AsyncRequest *) work->data;
-  req->results = findFonts(req->desc);
+// queues a request to be performed on the threadpool
+void queueRequest(AsyncRequest *req, uv_work_cb execute) {
+  RequestWork *item = new RequestWork;
+  item->work.data = item;
+  item->addon = req->addon;
+  item->req = NULL;
+
+  req->execute = execute;
+  req->addon->queue.push(req, req->priority);
+  req->addon->pending++;
+  uv_queue_work(req->addon->loop, &item->work, runRequest, afterRequest);
 }
 
-template<bool async>
-NAN_METHOD(findFonts) {
-  if (info.Length() < 1 || !info[0]->IsObject() || info[0]->IsFunction())
-    return Nan::ThrowTypeError("Expected a font descriptor");
+// calls back the requests that were answered on the event loop thread since
+// the last flush, all in one go
+void flushRequests(uv_async_t *handle) {
+  AddonData *addon = (AddonData *) handle->data;
+  std::vector<AsyncRequest *> answered;
+  answered.swap(addon->answered);
+  uv_unref((uv_handle_t *) handle);
 
-  Local<Object> desc = info[0].As<Object>();
-  FontDescriptor *descriptor = new FontDescriptor(desc);
+  for (size_t i = 0; i < answered.size(); i++) {
+    completeRequest(answered[i]);
+  }
+}
 
-  if (async) {
-    if (info.Length() < 2 || !info[1]->IsFunction())
-      return Nan::ThrowTypeError("Expected a callback");
+// queues a request that was answered without the threadpool to be called
+// back on a later turn of the event loop, since callbacks must always be
+// asynchronous. the callbacks of all requests answered in the same turn are
+// made by a single flush.
+void deferRequest(AsyncRequest *req) {
+  AddonData *addon = req->addon;
+  if (!addon->flush) {
+    addon->flush = new uv_async_t;
+    uv_async_init(addon->loop, addon->flush, flushRequests);
+    addon->flush->data = addon;
+    uv_unref((uv_handle_t *) addon->flush);
+  }
 
-    AsyncRequest *req = new AsyncRequest(info[1]);
-    req->desc = descriptor;
-    uv_queue_work(uv_default_loop(), &req->work, findFontsAsync, (uv_after_work_cb) asyncCallback);
+  // keep the event loop alive until the flush
+  if (addon->answered.empty()) {
+    uv_ref((uv_handle_t *) addon->flush);
+    uv_async_send(addon->flush);
+  }
 
-    return;
-  } else {
-    Local<Object> res = collectResults(findFonts(descriptor));
-    delete descriptor;
-    info.GetReturnValue().Set(res);
+  addon->answered.push_back(req);
+}
+
+// answers a request on the event loop thread if answer can do it without
+// blocking, i.e. from the catalog or the result cache, or else queues it
+// to be performed on the threadpool
+void scheduleRequest(AsyncRequest *req, bool (*answer)(AsyncRequest *), uv_work_cb execute) {
+  // requests that were aborted before they were made don't run at all
+  if (req->error != RequestOk || answer(req))
+    return deferRequest(req);
+
+  queueRequest(req, execute);
+}
+
+// calls the JavaScript callback for a request
+void asyncCallback(AsyncRequest *req) {
+  Nan::HandleScope scope;
+  Nan::AsyncResource async("asyncCallback");
+  Local<Value> info[1];
+  StringCache *strings = &req->addon->strings;
+
+  switch (req->kind) {
+    case ResultFont:
+      info[0] = wrapResult(strings, req->result);
+      req->result = NULL;
+      break;
+    case ResultFonts:
+      info[0] = collectResults(strings, req->results);
+      req->results = NULL;
+      break;
+    case ResultFontStack:
+      info[0] = wrapResult(strings, req->stack);
+      req->stack = NULL;
+      break;
+    case ResultFallbackChain:
+      if (req->chain)
+        info[0] = req->chain->toJSArray(strings, req->limit);
+      else
+        info[0] = Nan::Null();
+      break;
+    case ResultCatalog:
+      info[0] = collectCatalog(strings, req->catalog.get(), req->catalogResult);
+      break;
+    case ResultCatalogFonts:
+      if (req->batch)
+        info[0] = collectCatalogFonts(strings, req->catalog.get(), req->indices);
+      else
+        info[0] = wrapCatalogFont(strings, req->catalog.get(), req->indices[0]);
+      break;
+    case ResultFamilyNames:
+      info[0] = collectFamilyNames(strings, req->catalog.get(), req->indices);
+      break;
+    case ResultIds:
+      info[0] = wrapIds(req->ids, req->batch);
+      break;
+    case ResultMetrics:
+      if (req->batch)
+        info[0] = collectMetrics(strings, req->metrics);
+      else
+        info[0] = wrapMetrics(strings, req->metrics[0].get());
+      break;
+    case ResultVariations:
+      info[0] = wrapVariations(strings, req->variations.get());
+      break;
+    case ResultMeasurements:
+      info[0] = wrapMeasurements(req->measurements, req->batch, req->advances);
+      break;
+    case ResultGeneration:
+      info[0] = Nan::New<Number>(req->generation);
+      break;
+    default:
+      info[0] = Nan::Null();
+      break;
   }
+
+  req->done = true;
+  req->callback->Call(1, info, &async);
+  finishRequest(req);
 }
 
-void findFontAsync(uv_work_t *work) {
+void getCatalogAsync(uv_work_t *work) {
   AsyncRequest *req = (AsyncRequest *) work->data;
-  req->result = findFont(req->desc);
+  req->catalog = getCatalog();
 }
 
-template<bool async>
-NAN_METHOD(findFont) {
-  if (info.Length() < 1 || !info[0]->IsObject() || info[0]->IsFunction())
-    return Nan::ThrowTypeError("Expected a font descriptor");
-
-  Local<Object> desc = info[0].As<Object>();
-  FontDescriptor *descriptor = new FontDescriptor(desc);
+bool answerCatalog(AsyncRequest *req) {
+  req->catalog = getReadyCatalog();
+  return req->catalog != NULL;
+}
 
+template<bool async, CatalogResult type>
+NAN_METHOD(readCatalog) {
   if (async) {
-    if (info.Length() < 2 || !info[1]->IsFunction())
-      return Nan::ThrowTypeError("Expected a callback");
+    AsyncRequest *req = createRequest(info, 0);
+    if (!req)
+      return;
 
-    AsyncRequest *req = new AsyncRequest(info[1]);
-    req->desc = descriptor;
-    uv_queue_work(uv_default_loop(), &req->work, findFontAsync, (uv_after_work_cb) asyncCallback);
+    req->kind = ResultCatalog;
+    req->catalogResult = type;
+    scheduleRequest(req, answerCatalog, getCatalogAsync);
 
     return;
   } else {
-    Local<Value> res = wrapResult(findFont(descriptor));
-    delete descriptor;
-    info.GetReturnValue().Set(res);
+    std::shared_ptr<FontCatalog> catalog = getCatalog();
+    info.GetReturnValue().Set(collectCatalog(&getAddonData(info)->strings, catalog.get(), type));
   }
 }
 
-void substituteFontAsync(uv_work_t *work) {
+// looks up each key in a catalog index
+void lookupCatalog(FontCatalog *catalog, CatalogIndex index, std::vector<std::string> &keys, std::vector<uint32_t> &indices) {
+  for (size_t i = 0; i < keys.size(); i++) {
+    indices.push_back(catalog->find(index, keys[i].c_str()));
+  }
+}
+
+template<CatalogIndex index>
+void lookupCatalogAsync(uv_work_t *work) {
   AsyncRequest *req = (AsyncRequest *) work->data;
-  req->result = substituteFont(req->postscriptName, req->substitutionString);
+  req->catalog = getCatalog();
+  lookupCatalog(req->catalog.get(), index, req->keys, req->indices);
 }
 
-template<bool async>
-NAN_METHOD(substituteFont) {
-  if (info.Length() < 1 || !info[0]->IsString())
-    return Nan::ThrowTypeError("Expected postscript name");
+template<CatalogIndex index>
+bool answerLookup(AsyncRequest *req) {
+  req->catalog = getReadyCatalog();
+  if (!req->catalog)
+    return false;
 
-  if (info.Length() < 2 || !info[1]->IsString())
-    return Nan::ThrowTypeError("Expected substitution string");
+  lookupCatalog(req->catalog.get(), index, req->keys, req->indices);
+  return true;
+}
 
-  Nan::Utf8String postscriptName(info[0]);
-  Nan::Utf8String substitutionString(info[1]);
+// looks up fonts by postscript name or path through the catalog indexes.
+// accepts a single key or an array of keys.
+template<bool async, CatalogIndex index>
+NAN_METHOD(lookupCatalog) {
+  const char *error = index == CatalogPathIndex ? "Expected a path" : "Expected postscript name";
+  if (info.Length() < 1 || !(info[0]->IsString() || info[0]->IsArray()))
+    return Nan::ThrowTypeError(error);
 
-  if (async) {
-    if (info.Length() < 3 || !info[2]->IsFunction())
-      return Nan::ThrowTypeError("Expected a callback");
+  bool batch = info[0]->IsArray();
+  std::vector<std::string> keys;
+  if (batch) {
+    Local<Array> list = info[0].As<Array>();
+    for (unsigned int i = 0; i < list->Length(); i++) {
+      Local<Value> key = Nan::Get(list, i).ToLocalChecked();
+      if (!key->IsString())
+        return Nan::ThrowTypeError(error);
 
-    // copy the strings since the JS garbage collector might run before the async request is finished
-    char *ps = new char[postscriptName.length() + 1];
-    strcpy(ps, *postscriptName);
+      keys.push_back(*Nan::Utf8String(key));
+    }
+  } else {
+    keys.push_back(*Nan::Utf8String(info[0]));
+  }
 
-    char *sub = new char[substitutionString.length() + 1];
-    strcpy(sub, *substitutionString);
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req)
+      return;
 
-    AsyncRequest *req = new AsyncRequest(info[2]);
-    req->postscriptName = ps;
-    req->substitutionString = sub;
-    uv_queue_work(uv_default_loop(), &req->work, substituteFontAsync, (uv_after_work_cb) asyncCallback);
+    req->kind = ResultCatalogFonts;
+    req->keys = keys;
+    req->batch = batch;
+    scheduleRequest(req, answerLookup<index>, lookupCatalogAsync<index>);
 
     return;
   } else {
-    info.GetReturnValue().Set(wrapResult(substituteFont(*postscriptName, *substitutionString)));
+    std::shared_ptr<FontCatalog> catalog = getCatalog();
+    std::vector<uint32_t> indices;
+    lookupCatalog(catalog.get(), index, keys, indices);
+
+    if (batch)
+      info.GetReturnValue().Set(collectCatalogFonts(&getAddonData(info)->strings, catalog.get(), indices));
+    else
+      info.GetReturnValue().Set(wrapCatalogFont(&getAddonData(info)->strings, catalog.get(), indices[0]));
   }
 }
 
+// whether a findFonts query is answered from the catalog's language index
+// and columns rather than by the platform, which can't match ranges, lists
+// of families or path prefixes
+bool queriesCatalog(FontDescriptor *desc) {
+  return desc->lang || desc->script || desc->hasPredicates();
+}
+
+// the number of families searchFamilies returns by default
+#define DEFAULT_SEARCH_LIMIT 20
+
+void searchFamiliesAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->catalog = getCatalog();
+  req->catalog->familySearch()->search(req->keys[0].c_str(), req->limit, req->indices);
+}
+
+// answers searches once the index was built by an earlier search
+bool answerSearch(AsyncRequest *req) {
+  req->catalog = getReadyCatalog();
+  const FamilySearch *search = req->catalog ? req->catalog->builtFamilySearch() : NULL;
+  if (!search)
+    return false;
+
+  search->search(req->keys[0].c_str(), req->limit, req->indices);
+  return true;
+}
+
+// finds the families whose names match a query typed so far, best first
+template<bool async>
+NAN_METHOD(searchFamilies) {
+  if (info.Length() < 1 || !info[0]->IsString())
+    return Nan::ThrowTypeError("Expected a query string");
+
+  // options are optional
+  unsigned int limit = DEFAULT_SEARCH_LIMIT;
+  if (info.Length() > 1 && info[1]->IsObject() && !info[1]->IsFunction()) {
+    Local<Object> options = info[1].As<Object>();
+    Local<Value> limitValue = Nan::Get(options, Nan::New<String>("limit").ToLocalChecked()).ToLocalChecked();
+
+    if (limitValue->IsNumber() && Nan::To<int32_t>(limitValue).FromJust() > 0)
+      limit = Nan::To<int32_t>(limitValue).FromJust();
+  }
+
+  Nan::Utf8String query(info[0]);
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req)
+      return;
+
+    req->keys.push_back(*query);
+    req->limit = limit;
+    req->kind = ResultFamilyNames;
+    scheduleRequest(req, answerSearch, searchFamiliesAsync);
+
+    return;
+  } else {
+    std::shared_ptr<FontCatalog> catalog = getCatalog();
+    std::vector<uint32_t> indices;
+    catalog->familySearch()->search(*query, limit, indices);
+    info.GetReturnValue().Set(collectFamilyNames(&getAddonData(info)->strings, catalog.get(), indices));
+  }
+}
+
+// copies cached results, since the results of a request are handed over to JavaScript
+ResultSet *copyResults(const ResultSet *results) {
+  ResultSet *res = new ResultSet;
+  for (ResultSet::const_iterator it = results->begin(); it != results->end(); it++) {
+    res->push_back(new FontDescriptor(*it));
+  }
+
+  return res;
+}
+
+// looks up the results of a findFont (single) or findFonts query in the
+// result cache, or asks the platform and caches them
+std::shared_ptr<const ResultSet> findCachedResults(FontDescriptor *desc, bool single) {
+  std::string key = getResultCacheKey(desc, single);
+  uint64_t generation = getCatalogGeneration();
+  std::shared_ptr<const ResultSet> res = getResultCache()->get(key, generation, true);
+  if (res)
+    return res;
+
+  if (single) {
+    ResultSet *results = new ResultSet;
+    FontDescriptor *result = findFont(desc);
+    if (result)
+      results->push_back(result);
+
+    res.reset(results);
+  } else {
+    res.reset(findFonts(desc));
+  }
+
+  getResultCache()->put(key, generation, getCatalogGeneration(), res);
+  return res;
+}
+
+// returns the cached results of a query in the generation of a catalog, or
+// NULL if they are not cached
+std::shared_ptr<const ResultSet> findReadyResults(FontCatalog *catalog, FontDescriptor *desc, bool single) {
+  return getResultCache()->get(getResultCacheKey(desc, single), catalog->cacheGeneration(), false);
+}
+
+ResultSet *findCachedFonts(FontDescriptor *desc) {
+  return copyResults(findCachedResults(desc, false).get());
+}
+
+// appends the catalog indices of the fonts found by the platform for a query
+// with one of the family names and the style of another query. returns
+// false if ready is set and the results are not cached.
+bool findNamedFonts(FontCatalog *catalog, FontDescriptor *desc, const char *family, bool ready, std::vector<uint32_t> &named) {
+  FontDescriptor query(NULL, desc->postscriptName, family, desc->style, FontWeightUndefined, FontWidthUndefined, desc->italic, desc->monospace);
+  std::shared_ptr<const ResultSet> results = ready ? findReadyResults(catalog, &query, false) : findCachedResults(&query, false);
+  if (!results)
+    return false;
+
+  for (ResultSet::const_iterator it = results->begin(); it != results->end(); it++) {
+    uint32_t index = catalog->findFont(*it);
+    if (index != CATALOG_NULL)
+      named.push_back(index);
+  }
+
+  return true;
+}
+
+// finds the fonts matching a query that the catalog answers. the catalog
+// keeps one family and style name per font, so queries with other names
+// (such as localized ones) ask the platform for the fonts with those names,
+// and the catalog checks the rest of the query. if ready is set, this
+// returns false rather than asking the platform when its results are not
+// cached.
+bool findCatalogFonts(FontCatalog *catalog, FontDescriptor *desc, bool ready, std::vector<uint32_t> &indices) {
+  if (catalog->hasNames(desc)) {
+    catalog->findFonts(desc, indices);
+    return true;
+  }
+
+  std::vector<uint32_t> named;
+  if (desc->families.empty()) {
+    if (!findNamedFonts(catalog, desc, desc->family, ready, named))
+      return false;
+  }
+
+  for (size_t i = 0; i < desc->families.size(); i++) {
+    if (!findNamedFonts(catalog, desc, desc->families[i].c_str(), ready, named))
+      return false;
+  }
+
+  catalog->findFonts(desc, indices, &named);
+  return true;
+}
+
+FontDescriptor *findCachedFont(FontDescriptor *desc) {
+  std::shared_ptr<const ResultSet> results = findCachedResults(desc, true);
+  return results->empty() ? NULL : new FontDescriptor(results->front());
+}
+
+void findFontsAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  if (queriesCatalog(req->desc)) {
+    req->catalog = getCatalog();
+    findCatalogFonts(req->catalog.get(), req->desc, false, req->indices);
+  } else {
+    req->results = findCachedFonts(req->desc);
+  }
+}
+
+bool answerFindFonts(AsyncRequest *req) {
+  std::shared_ptr<FontCatalog> catalog = getReadyCatalog();
+  if (!catalog)
+    return false;
+
+  if (queriesCatalog(req->desc)) {
+    if (!findCatalogFonts(catalog.get(), req->desc, true, req->indices))
+      return false;
+
+    req->catalog = catalog;
+    return true;
+  }
+
+  std::shared_ptr<const ResultSet> results = findReadyResults(catalog.get(), req->desc, false);
+  if (!results)
+    return false;
+
+  req->results = copyResults(results.get());
+  return true;
+}
+
+template<bool async>
+NAN_METHOD(findFonts) {
+  if (info.Length() < 1 || !info[0]->IsObject() || info[0]->IsFunction())
+    return Nan::ThrowTypeError("Expected a font descriptor");
+
+  Local<Object> desc = info[0].As<Object>();
+  FontDescriptor *descriptor = new FontDescriptor(desc);
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req) {
+      delete descriptor;
+      return;
+    }
+
+    req->desc = descriptor;
+    req->kind = queriesCatalog(descriptor) ? ResultCatalogFonts : ResultFonts;
+    req->batch = true;
+    scheduleRequest(req, answerFindFonts, findFontsAsync);
+
+    return;
+  } else if (queriesCatalog(descriptor)) {
+    std::shared_ptr<FontCatalog> catalog = getCatalog();
+    std::vector<uint32_t> indices;
+    findCatalogFonts(catalog.get(), descriptor, false, indices);
+    delete descriptor;
+    info.GetReturnValue().Set(collectCatalogFonts(&getAddonData(info)->strings, catalog.get(), indices));
+  } else {
+    Local<Object> res = collectResults(&getAddonData(info)->strings, findCachedFonts(descriptor));
+    delete descriptor;
+    info.GetReturnValue().Set(res);
+  }
+}
+
+void findFontAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->result = findCachedFont(req->desc);
+}
+
+bool answerFindFont(AsyncRequest *req) {
+  std::shared_ptr<FontCatalog> catalog = getReadyCatalog();
+  std::shared_ptr<const ResultSet> results;
+  if (catalog)
+    results = findReadyResults(catalog.get(), req->desc, true);
+
+  if (!results)
+    return false;
+
+  req->result = results->empty() ? NULL : new FontDescriptor(results->front());
+  return true;
+}
+
+template<bool async>
+NAN_METHOD(findFont) {
+  if (info.Length() < 1 || !info[0]->IsObject() || info[0]->IsFunction())
+    return Nan::ThrowTypeError("Expected a font descriptor");
+
+  Local<Object> desc = info[0].As<Object>();
+  FontDescriptor *descriptor = new FontDescriptor(desc);
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req) {
+      delete descriptor;
+      return;
+    }
+
+    req->desc = descriptor;
+    req->kind = ResultFont;
+    scheduleRequest(req, answerFindFont, findFontAsync);
+
+    return;
+  } else {
+    Local<Value> res = wrapResult(&getAddonData(info)->strings, findCachedFont(descriptor));
+    delete descriptor;
+    info.GetReturnValue().Set(res);
+  }
+}
+
+void substituteFontAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->result = substituteFont(req->postscriptName, req->substitutionString);
+}
+
+template<bool async>
+NAN_METHOD(substituteFont) {
+  if (info.Length() < 1 || !info[0]->IsString())
+    return Nan::ThrowTypeError("Expected postscript name");
+
+  if (info.Length() < 2 || !info[1]->IsString())
+    return Nan::ThrowTypeError("Expected substitution string");
+
+  Nan::Utf8String postscriptName(info[0]);
+  Nan::Utf8String substitutionString(info[1]);
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 2);
+    if (!req)
+      return;
+
+    // copy the strings since the JS garbage collector might run before the async request is finished
+    char *ps = new char[postscriptName.length() + 1];
+    strcpy(ps, *postscriptName);
+
+    char *sub = new char[substitutionString.length() + 1];
+    strcpy(sub, *substitutionString);
+
+    req->postscriptName = ps;
+    req->substitutionString = sub;
+    req->kind = ResultFont;
+    queueRequest(req, substituteFontAsync);
+
+    return;
+  } else {
+    info.GetReturnValue().Set(wrapResult(&getAddonData(info)->strings, substituteFont(*postscriptName, *substitutionString)));
+  }
+}
+
+// appends the IDs of fonts found by the platform. fonts that are not in
+// the catalog (added since it was built) are left out.
+void collectFontIds(FontCatalog *catalog, const ResultSet *results, std::vector<uint32_t> &ids) {
+  for (ResultSet::const_iterator it = results->begin(); it != results->end(); it++) {
+    uint32_t index = catalog->findFont(*it);
+    if (index != CATALOG_NULL)
+      ids.push_back(catalog->font(index).id);
+  }
+}
+
+// appends the IDs of the fonts at the given catalog indices
+void collectFontIds(FontCatalog *catalog, std::vector<uint32_t> &indices, std::vector<uint32_t> &ids) {
+  for (size_t i = 0; i < indices.size(); i++) {
+    ids.push_back(catalog->font(indices[i]).id);
+  }
+}
+
+// finds the IDs of the fonts matching a query
+void findFontIds(FontCatalog *catalog, FontDescriptor *desc, std::vector<uint32_t> &ids) {
+  if (queriesCatalog(desc)) {
+    std::vector<uint32_t> indices;
+    findCatalogFonts(catalog, desc, false, indices);
+    collectFontIds(catalog, indices, ids);
+  } else {
+    collectFontIds(catalog, findCachedResults(desc, false).get(), ids);
+  }
+}
+
+void findFontIdsAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->catalog = getCatalog();
+  findFontIds(req->catalog.get(), req->desc, req->ids);
+}
+
+bool answerFindFontIds(AsyncRequest *req) {
+  std::shared_ptr<FontCatalog> catalog = getReadyCatalog();
+  if (!catalog)
+    return false;
+
+  if (queriesCatalog(req->desc)) {
+    std::vector<uint32_t> indices;
+    if (!findCatalogFonts(catalog.get(), req->desc, true, indices))
+      return false;
+
+    collectFontIds(catalog.get(), indices, req->ids);
+    return true;
+  }
+
+  std::shared_ptr<const ResultSet> results = findReadyResults(catalog.get(), req->desc, false);
+  if (!results)
+    return false;
+
+  collectFontIds(catalog.get(), results.get(), req->ids);
+  return true;
+}
+
+// like findFonts, but returns the IDs of the fonts in a Uint32Array
+template<bool async>
+NAN_METHOD(findFontIds) {
+  if (info.Length() < 1 || !info[0]->IsObject() || info[0]->IsFunction())
+    return Nan::ThrowTypeError("Expected a font descriptor");
+
+  Local<Object> desc = info[0].As<Object>();
+  FontDescriptor *descriptor = new FontDescriptor(desc);
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req) {
+      delete descriptor;
+      return;
+    }
+
+    req->desc = descriptor;
+    req->kind = ResultIds;
+    req->batch = true;
+    scheduleRequest(req, answerFindFontIds, findFontIdsAsync);
+
+    return;
+  } else {
+    std::shared_ptr<FontCatalog> catalog = getCatalog();
+    std::vector<uint32_t> ids;
+    findFontIds(catalog.get(), descriptor, ids);
+    delete descriptor;
+    info.GetReturnValue().Set(createUint32Array(ids));
+  }
+}
+
+// returns the ID of the substitute font, or CATALOG_NULL
+uint32_t substituteFontId(FontCatalog *catalog, char *postscriptName, char *substitutionString) {
+  FontDescriptor *result = substituteFont(postscriptName, substitutionString);
+  if (!result)
+    return CATALOG_NULL;
+
+  uint32_t index = catalog->findFont(result);
+  delete result;
+  return index == CATALOG_NULL ? CATALOG_NULL : catalog->font(index).id;
+}
+
+void substituteFontIdAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->catalog = getCatalog();
+  req->ids.push_back(substituteFontId(req->catalog.get(), req->postscriptName, req->substitutionString));
+}
+
+// like substituteFont, but returns the ID of the font
+template<bool async>
+NAN_METHOD(substituteFontId) {
+  if (info.Length() < 1 || !info[0]->IsString())
+    return Nan::ThrowTypeError("Expected postscript name");
+
+  if (info.Length() < 2 || !info[1]->IsString())
+    return Nan::ThrowTypeError("Expected substitution string");
+
+  Nan::Utf8String postscriptName(info[0]);
+  Nan::Utf8String substitutionString(info[1]);
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 2);
+    if (!req)
+      return;
+
+    char *ps = new char[postscriptName.length() + 1];
+    strcpy(ps, *postscriptName);
+
+    char *sub = new char[substitutionString.length() + 1];
+    strcpy(sub, *substitutionString);
+
+    req->postscriptName = ps;
+    req->substitutionString = sub;
+    req->kind = ResultIds;
+    queueRequest(req, substituteFontIdAsync);
+
+    return;
+  } else {
+    std::shared_ptr<FontCatalog> catalog = getCatalog();
+    std::vector<uint32_t> ids(1, substituteFontId(catalog.get(), *postscriptName, *substitutionString));
+    info.GetReturnValue().Set(wrapIds(ids, false));
+  }
+}
+
+// reads a font ID, or an array or Uint32Array of them. returns false if
+// the value is neither.
+bool getIds(Local<Value> value, std::vector<uint32_t> &ids) {
+  if (value->IsNumber()) {
+    ids.push_back(Nan::To<uint32_t>(value).FromJust());
+    return true;
+  }
+
+  if (value->IsUint32Array()) {
+    Nan::TypedArrayContents<uint32_t> contents(value);
+    ids.assign(*contents, *contents + contents.length());
+    return true;
+  }
+
+  if (!value->IsArray())
+    return false;
+
+  Local<Array> list = value.As<Array>();
+  for (unsigned int i = 0; i < list->Length(); i++) {
+    Local<Value> id = Nan::Get(list, i).ToLocalChecked();
+    if (!id->IsNumber())
+      return false;
+
+    ids.push_back(Nan::To<uint32_t>(id).FromJust());
+  }
+
+  return true;
+}
+
+// finds the fonts in a catalog with the given IDs
+void lookupIds(FontCatalog *catalog, std::vector<uint32_t> &ids, std::vector<uint32_t> &indices) {
+  for (size_t i = 0; i < ids.size(); i++) {
+    indices.push_back(catalog->findById(ids[i]));
+  }
+}
+
+void getFontsByIdAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->catalog = getCatalog();
+  lookupIds(req->catalog.get(), req->ids, req->indices);
+}
+
+bool answerFontsById(AsyncRequest *req) {
+  req->catalog = getReadyCatalog();
+  if (!req->catalog)
+    return false;
+
+  lookupIds(req->catalog.get(), req->ids, req->indices);
+  return true;
+}
+
+// turns font IDs back into font descriptors. accepts a single ID, or an
+// array or Uint32Array of IDs.
+template<bool async>
+NAN_METHOD(getFontsById) {
+  std::vector<uint32_t> ids;
+  if (info.Length() < 1 || !getIds(info[0], ids))
+    return Nan::ThrowTypeError("Expected a font ID or an array of IDs");
+
+  bool batch = !info[0]->IsNumber();
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req)
+      return;
+
+    req->kind = ResultCatalogFonts;
+    req->ids = ids;
+    req->batch = batch;
+    scheduleRequest(req, answerFontsById, getFontsByIdAsync);
+
+    return;
+  } else {
+    std::shared_ptr<FontCatalog> catalog = getCatalog();
+    std::vector<uint32_t> indices;
+    lookupIds(catalog.get(), ids, indices);
+
+    if (batch)
+      info.GetReturnValue().Set(collectCatalogFonts(&getAddonData(info)->strings, catalog.get(), indices));
+    else
+      info.GetReturnValue().Set(wrapCatalogFont(&getAddonData(info)->strings, catalog.get(), indices[0]));
+  }
+}
+
+void resolveFontStackAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->stack = resolveFontStack(req->families, req->desc, req->substitutionString);
+}
+
+template<bool async>
+NAN_METHOD(resolveFontStack) {
+  if (info.Length() < 1 || !info[0]->IsArray())
+    return Nan::ThrowTypeError("Expected an array of font families");
+
+  if (info.Length() < 2 || !info[1]->IsObject() || info[1]->IsFunction())
+    return Nan::ThrowTypeError("Expected a font descriptor");
+
+  std::vector<std::string> families;
+  Local<Array> list = info[0].As<Array>();
+  for (unsigned int i = 0; i < list->Length(); i++) {
+    Local<Value> family = Nan::Get(list, i).ToLocalChecked();
+    if (!family->IsString())
+      return Nan::ThrowTypeError("Expected an array of font families");
+
+    families.push_back(*Nan::Utf8String(family));
+  }
+
+  // the text to find fallbacks for is optional
+  int callbackIndex = 2;
+  char *text = NULL;
+  if (info.Length() > 2 && info[2]->IsString()) {
+    Nan::Utf8String str(info[2]);
+    text = new char[str.length() + 1];
+    strcpy(text, *str);
+    callbackIndex++;
+  }
+
+  FontDescriptor *descriptor = new FontDescriptor(info[1].As<Object>());
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, callbackIndex);
+    if (!req) {
+      delete descriptor;
+      delete[] text;
+      return;
+    }
+
+    req->desc = descriptor;
+    req->substitutionString = text;
+    req->families = families;
+    req->kind = ResultFontStack;
+    queueRequest(req, resolveFontStackAsync);
+
+    return;
+  } else {
+    Local<Value> res = wrapResult(&getAddonData(info)->strings, resolveFontStack(families, descriptor, text));
+    delete descriptor;
+    delete[] text;
+    info.GetReturnValue().Set(res);
+  }
+}
+
+void getFallbackChainAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->chain = getCachedFallbackChain(req->postscriptName, req->lang);
+}
+
+template<bool async>
+NAN_METHOD(getFallbackChain) {
+  if (info.Length() < 1 || !info[0]->IsString())
+    return Nan::ThrowTypeError("Expected postscript name");
+
+  // options are optional
+  char *lang = NULL;
+  unsigned int limit = 0;
+  if (info.Length() > 1 && info[1]->IsObject() && !info[1]->IsFunction()) {
+    Local<Object> options = info[1].As<Object>();
+    Local<Value> langValue = Nan::Get(options, Nan::New<String>("lang").ToLocalChecked()).ToLocalChecked();
+    Local<Value> limitValue = Nan::Get(options, Nan::New<String>("limit").ToLocalChecked()).ToLocalChecked();
+
+    if (langValue->IsString()) {
+      Nan::Utf8String str(langValue);
+      lang = new char[str.length() + 1];
+      strcpy(lang, *str);
+    }
+
+    if (limitValue->IsNumber() && Nan::To<int32_t>(limitValue).FromJust() > 0)
+      limit = Nan::To<int32_t>(limitValue).FromJust();
+  }
+
+  Nan::Utf8String postscriptName(info[0]);
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req) {
+      delete[] lang;
+      return;
+    }
+
+    // copy the string since the JS garbage collector might run before the async request is finished
+    char *ps = new char[postscriptName.length() + 1];
+    strcpy(ps, *postscriptName);
+
+    req->postscriptName = ps;
+    req->lang = lang;
+    req->limit = limit;
+    req->kind = ResultFallbackChain;
+    queueRequest(req, getFallbackChainAsync);
+
+    return;
+  } else {
+    std::shared_ptr<FallbackChain> chain = getCachedFallbackChain(*postscriptName, lang);
+    delete[] lang;
+
+    if (chain)
+      info.GetReturnValue().Set(chain->toJSArray(&getAddonData(info)->strings, limit));
+    else
+      info.GetReturnValue().Set(Nan::Null());
+  }
+}
+
+// creates a getFontMetrics query from a postscript name or font descriptor,
+// or returns NULL if the value is neither
+FontDescriptor *createMetricsQuery(Local<Value> value) {
+  if (value->IsString())
+    return new FontDescriptor(NULL, *Nan::Utf8String(value), NULL, NULL, FontWeightUndefined, FontWidthUndefined, false, false);
+
+  if (!value->IsObject() || value->IsFunction() || value->IsArray())
+    return NULL;
+
+  // unlike queries, descriptors returned by other methods have a path
+  Local<Object> obj = value.As<Object>();
+  Local<Value> path = Nan::Get(obj, Nan::New<String>("path").ToLocalChecked()).ToLocalChecked();
+  FontDescriptor desc(obj);
+  if (!path->IsString())
+    return new FontDescriptor(&desc);
+
+  return new FontDescriptor(*Nan::Utf8String(path), desc.postscriptName, desc.family, desc.style, desc.weight, desc.width, desc.italic, desc.monospace);
+}
+
+// finds the file of the font a metrics query refers to. fonts are read from
+// their path if it is given, looked up by exact postscript name if that is
+// all there is, and matched with findFont otherwise. returns false if there
+// is no such font.
+bool findFontFile(FontDescriptor *query, std::string &path, std::string &postscriptName) {
+  if (query->path) {
+    path = query->path;
+    postscriptName = query->postscriptName ? query->postscriptName : "";
+    return true;
+  }
+
+  if (query->postscriptName && !query->family && !query->style && !query->weight && !query->width && !query->italic && !query->monospace) {
+    std::shared_ptr<FontCatalog> catalog = getCatalog();
+    uint32_t index = catalog->find(CatalogPostscriptNameIndex, query->postscriptName);
+    if (index == CATALOG_NULL)
+      return false;
+
+    if (!catalog->path(catalog->font(index).path, path))
+      return false;
+
+    postscriptName = query->postscriptName;
+    return true;
+  }
+
+  std::shared_ptr<const ResultSet> results = findCachedResults(query, true);
+  if (results->empty())
+    return false;
+
+  FontDescriptor *font = results->front();
+  path = font->path;
+  postscriptName = font->postscriptName ? font->postscriptName : "";
+  return true;
+}
+
+std::shared_ptr<const FontMetrics> findFontMetrics(FontDescriptor *query) {
+  std::string path, postscriptName;
+  if (!findFontFile(query, path, postscriptName))
+    return std::shared_ptr<const FontMetrics>();
+
+  return getFontMetrics(path.c_str(), postscriptName.empty() ? NULL : postscriptName.c_str());
+}
+
+void getFontMetricsAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  for (size_t i = 0; i < req->queries.size(); i++) {
+    req->metrics.push_back(findFontMetrics(req->queries[i]));
+  }
+}
+
+template<bool async>
+NAN_METHOD(getFontMetrics) {
+  const char *error = "Expected a font descriptor or postscript name";
+  if (info.Length() < 1)
+    return Nan::ThrowTypeError(error);
+
+  bool batch = info[0]->IsArray();
+  std::vector<FontDescriptor *> queries;
+  Local<Array> list = batch ? info[0].As<Array>() : Nan::New<Array>(1);
+  if (!batch)
+    Nan::Set(list, 0, info[0]);
+
+  for (unsigned int i = 0; i < list->Length(); i++) {
+    FontDescriptor *query = createMetricsQuery(Nan::Get(list, i).ToLocalChecked());
+    if (!query) {
+      for (size_t j = 0; j < queries.size(); j++) {
+        delete queries[j];
+      }
+
+      return Nan::ThrowTypeError(error);
+    }
+
+    queries.push_back(query);
+  }
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req) {
+      for (size_t i = 0; i < queries.size(); i++) {
+        delete queries[i];
+      }
+
+      return;
+    }
+
+    req->queries = queries;
+    req->batch = batch;
+    req->kind = ResultMetrics;
+    queueRequest(req, getFontMetricsAsync);
+
+    return;
+  } else {
+    MetricsList metrics;
+    for (size_t i = 0; i < queries.size(); i++) {
+      metrics.push_back(findFontMetrics(queries[i]));
+      delete queries[i];
+    }
+
+    if (batch)
+      info.GetReturnValue().Set(collectMetrics(&getAddonData(info)->strings, metrics));
+    else
+      info.GetReturnValue().Set(wrapMetrics(&getAddonData(info)->strings, metrics[0].get()));
+  }
+}
+
+std::shared_ptr<const FontVariations> findFontVariations(FontDescriptor *query) {
+  std::string path, postscriptName;
+  if (!findFontFile(query, path, postscriptName))
+    return std::shared_ptr<const FontVariations>();
+
+  return getFontVariations(path.c_str(), postscriptName.empty() ? NULL : postscriptName.c_str());
+}
+
+void getFontVariationsAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->variations = findFontVariations(req->queries[0]);
+}
+
+// returns the axes and named instances of a font, given as a postscript
+// name or font descriptor
+template<bool async>
+NAN_METHOD(getFontVariations) {
+  FontDescriptor *query = info.Length() > 0 ? createMetricsQuery(info[0]) : NULL;
+  if (!query)
+    return Nan::ThrowTypeError("Expected a font descriptor or postscript name");
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 1);
+    if (!req) {
+      delete query;
+      return;
+    }
+
+    req->queries.push_back(query);
+    req->kind = ResultVariations;
+    queueRequest(req, getFontVariationsAsync);
+
+    return;
+  } else {
+    std::shared_ptr<const FontVariations> variations = findFontVariations(query);
+    delete query;
+    info.GetReturnValue().Set(wrapVariations(&getAddonData(info)->strings, variations.get()));
+  }
+}
+
+// measures each text with the font a query refers to
+void measureText(FontDescriptor *query, std::vector<std::string> &texts, double size, bool kerning, bool advances, TextMeasurements &res) {
+  std::string path, postscriptName;
+  std::shared_ptr<const GlyphMetrics> glyphs;
+  if (findFontFile(query, path, postscriptName))
+    glyphs = getGlyphMetrics(path.c_str(), postscriptName.empty() ? NULL : postscriptName.c_str());
+
+  res.found = (bool) glyphs;
+  if (!glyphs)
+    return;
+
+  res.widths.resize(texts.size());
+  if (advances)
+    res.advances.resize(texts.size());
+
+  for (size_t i = 0; i < texts.size(); i++) {
+    res.widths[i] = glyphs->measure(texts[i].data(), texts[i].size(), size, kerning, advances ? &res.advances[i] : NULL);
+  }
+}
+
+void measureTextAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  measureText(req->queries[0], req->texts, req->size, req->kerning, req->advances, req->measurements);
+}
+
+// measures a string or an array of strings with a font, given as a postscript
+// name or font descriptor, at a font size
+template<bool async>
+NAN_METHOD(measureText) {
+  FontDescriptor *query = info.Length() > 0 ? createMetricsQuery(info[0]) : NULL;
+  if (!query)
+    return Nan::ThrowTypeError("Expected a font descriptor or postscript name");
+
+  bool batch = info.Length() > 1 && info[1]->IsArray();
+  std::vector<std::string> texts;
+  if (batch) {
+    Local<Array> list = info[1].As<Array>();
+    for (unsigned int i = 0; i < list->Length(); i++) {
+      Local<Value> text = Nan::Get(list, i).ToLocalChecked();
+      if (!text->IsString()) {
+        delete query;
+        return Nan::ThrowTypeError("Expected a string or an array of strings");
+      }
+
+      texts.push_back(*Nan::Utf8String(text));
+    }
+  } else if (info.Length() > 1 && info[1]->IsString()) {
+    texts.push_back(*Nan::Utf8String(info[1]));
+  } else {
+    delete query;
+    return Nan::ThrowTypeError("Expected a string or an array of strings");
+  }
+
+  if (info.Length() < 3 || !info[2]->IsNumber()) {
+    delete query;
+    return Nan::ThrowTypeError("Expected a font size");
+  }
+
+  double size = Nan::To<double>(info[2]).FromJust();
+
+  // options are optional
+  bool kerning = true;
+  bool advances = false;
+  if (info.Length() > 3 && info[3]->IsObject() && !info[3]->IsFunction()) {
+    Local<Object> options = info[3].As<Object>();
+    Local<Value> kerningValue = Nan::Get(options, Nan::New<String>("kerning").ToLocalChecked()).ToLocalChecked();
+    Local<Value> advancesValue = Nan::Get(options, Nan::New<String>("advances").ToLocalChecked()).ToLocalChecked();
+
+    if (!kerningValue->IsUndefined())
+      kerning = Nan::To<bool>(kerningValue).FromJust();
+
+    advances = Nan::To<bool>(advancesValue).FromJust();
+  }
+
+  if (async) {
+    AsyncRequest *req = createRequest(info, 3);
+    if (!req) {
+      delete query;
+      return;
+    }
+
+    req->queries.push_back(query);
+    req->texts.swap(texts);
+    req->size = size;
+    req->kerning = kerning;
+    req->advances = advances;
+    req->batch = batch;
+    req->kind = ResultMeasurements;
+    queueRequest(req, measureTextAsync);
+
+    return;
+  } else {
+    TextMeasurements measurements;
+    measureText(query, texts, size, kerning, advances, measurements);
+    delete query;
+    info.GetReturnValue().Set(wrapMeasurements(measurements, batch, advances));
+  }
+}
+
+// builds the backend state and the catalog on the threadpool. calls made in
+// the meantime (from any environment) wait for the refresh lock and the
+// backend's own one time initialization instead of building a second copy.
+void prewarmAsync(uv_work_t *work) {
+  getCatalog();
+}
+
+void afterPrewarm(uv_work_t *work, int status) {
+  AddonData *addon = (AddonData *) work->data;
+  delete work;
+  addon->prewarmState = PrewarmDone;
+
+  if (!addon->prewarmResolver.IsEmpty() && !addon->closing) {
+    Nan::HandleScope scope;
+    Local<Promise::Resolver> resolver = Nan::New(addon->prewarmResolver);
+    resolver->Resolve(Nan::GetCurrentContext(), Nan::Undefined()).FromJust();
+  }
+
+  addon->prewarmResolver.Reset();
+  addon->pending--;
+  releaseAddon(addon);
+}
+
+void startPrewarm(AddonData *addon) {
+  if (addon->prewarmState != PrewarmIdle)
+    return;
+
+  uv_work_t *work = new uv_work_t;
+  work->data = addon;
+  addon->prewarmState = PrewarmRunning;
+  addon->pending++;
+  uv_queue_work(addon->loop, work, prewarmAsync, afterPrewarm);
+}
+
+// starts building the catalog in the background, and returns a promise
+// that resolves once it is ready
+NAN_METHOD(prewarm) {
+  AddonData *addon = getAddonData(info);
+  startPrewarm(addon);
+
+  Local<Promise::Resolver> resolver;
+  if (addon->prewarmState == PrewarmRunning && !addon->prewarmResolver.IsEmpty()) {
+    resolver = Nan::New(addon->prewarmResolver);
+  } else {
+    resolver = Promise::Resolver::New(Nan::GetCurrentContext()).ToLocalChecked();
+    if (addon->prewarmState == PrewarmDone)
+      resolver->Resolve(Nan::GetCurrentContext(), Nan::Undefined()).FromJust();
+    else
+      addon->prewarmResolver.Reset(resolver);
+  }
+
+  info.GetReturnValue().Set(resolver->GetPromise());
+}
+
+void refreshCatalogAsync(uv_work_t *work) {
+  AsyncRequest *req = (AsyncRequest *) work->data;
+  req->generation = refreshCatalog();
+}
+
+// rebuilds the catalog now, and returns its new generation
+template<bool async>
+NAN_METHOD(refreshCatalog) {
+  if (async) {
+    AsyncRequest *req = createRequest(info, 0);
+    if (!req)
+      return;
+
+    req->kind = ResultGeneration;
+    queueRequest(req, refreshCatalogAsync);
+
+    return;
+  } else {
+    info.GetReturnValue().Set(Nan::New<Number>(refreshCatalog()));
+  }
+}
+
+// changes the limits of the findFont and findFonts result cache, and of
+// the calling thread's string cache
+NAN_METHOD(configureCache) {
+  if (info.Length() < 1 || !info[0]->IsObject())
+    return Nan::ThrowTypeError("Expected an options object");
+
+  ResultCacheStats current = getResultCache()->stats();
+  StringCache *strings = &getAddonData(info)->strings;
+  size_t limits[3] = { current.maxEntries, current.maxFonts, strings->stats().maxSize };
+  const char *names[3] = { "maxEntries", "maxFonts", "maxStringBytes" };
+
+  Local<Object> options = info[0].As<Object>();
+  for (int i = 0; i < 3; i++) {
+    Local<Value> value = Nan::Get(options, Nan::New<String>(names[i]).ToLocalChecked()).ToLocalChecked();
+    if (value->IsUndefined())
+      continue;
+
+    if (!value->IsNumber() || Nan::To<double>(value).FromJust() < 0)
+      return Nan::ThrowTypeError("Expected cache limits to be non-negative numbers");
+
+    limits[i] = (size_t) Nan::To<double>(value).FromJust();
+  }
+
+  getResultCache()->setLimits(limits[0], limits[1]);
+  strings->setMaxSize(limits[2]);
+}
+
+// returns the counters and size of the result cache, and of the calling
+// thread's string cache
+NAN_METHOD(getCacheStats) {
+  ResultCacheStats stats = getResultCache()->stats();
+  Local<Object> res = Nan::New<Object>();
+  Nan::Set(res, Nan::New<String>("hits").ToLocalChecked(), Nan::New<Number>(stats.hits));
+  Nan::Set(res, Nan::New<String>("misses").ToLocalChecked(), Nan::New<Number>(stats.misses));
+  Nan::Set(res, Nan::New<String>("evictions").ToLocalChecked(), Nan::New<Number>(stats.evictions));
+  Nan::Set(res, Nan::New<String>("invalidations").ToLocalChecked(), Nan::New<Number>(stats.invalidations));
+  Nan::Set(res, Nan::New<String>("entries").ToLocalChecked(), Nan::New<Number>(stats.entries));
+  Nan::Set(res, Nan::New<String>("fonts").ToLocalChecked(), Nan::New<Number>(stats.fonts));
+  Nan::Set(res, Nan::New<String>("maxEntries").ToLocalChecked(), Nan::New<Number>(stats.maxEntries));
+  Nan::Set(res, Nan::New<String>("maxFonts").ToLocalChecked(), Nan::New<Number>(stats.maxFonts));
+
+  StringCacheStats strings = getAddonData(info)->strings.stats();
+  Nan::Set(res, Nan::New<String>("strings").ToLocalChecked(), Nan::New<Number>(strings.entries));
+  Nan::Set(res, Nan::New<String>("stringBytes").ToLocalChecked(), Nan::New<Number>(strings.size));
+  Nan::Set(res, Nan::New<String>("stringEvictions").ToLocalChecked(), Nan::New<Number>((double) strings.evictions));
+  Nan::Set(res, Nan::New<String>("maxStringBytes").ToLocalChecked(), Nan::New<Number>(strings.maxSize));
+  info.GetReturnValue().Set(res);
+}
+
+// returns the size of the current catalog and its sections, in bytes, next
+// to the size its paths and names would take as separate strings
+NAN_METHOD(getCatalogStats) {
+  std::shared_ptr<FontCatalog> catalog = getCatalog();
+  const CatalogHeader *header = catalog->header;
+  Local<Object> res = Nan::New<Object>();
+  Nan::Set(res, Nan::New<String>("generation").ToLocalChecked(), Nan::New<Number>(catalog->generation));
+  Nan::Set(res, Nan::New<String>("fonts").ToLocalChecked(), Nan::New<Number>(header->fontCount));
+  Nan::Set(res, Nan::New<String>("families").ToLocalChecked(), Nan::New<Number>(header->familyCount));
+  Nan::Set(res, Nan::New<String>("paths").ToLocalChecked(), Nan::New<Number>(header->pathCount));
+  Nan::Set(res, Nan::New<String>("size").ToLocalChecked(), Nan::New<Number>(header->size));
+  Nan::Set(res, Nan::New<String>("pathsSize").ToLocalChecked(), Nan::New<Number>(header->pathsSize));
+  Nan::Set(res, Nan::New<String>("rawPathsSize").ToLocalChecked(), Nan::New<Number>(header->rawPathsSize));
+  Nan::Set(res, Nan::New<String>("namesSize").ToLocalChecked(), Nan::New<Number>(header->stringsSize));
+  Nan::Set(res, Nan::New<String>("rawNamesSize").ToLocalChecked(), Nan::New<Number>(header->rawStringsSize));
+  info.GetReturnValue().Set(res);
+}
+
+NAN_METHOD(publishCatalog) {
+  if (info.Length() < 1 || !info[0]->IsString())
+    return Nan::ThrowTypeError("Expected a name");
+
+  unsigned int generation = publishCatalog(*Nan::Utf8String(info[0]));
+  if (!generation)
+    return Nan::ThrowError("Could not publish the font catalog to shared memory");
+
+  info.GetReturnValue().Set(Nan::New<Number>(generation));
+}
+
+NAN_METHOD(attachCatalog) {
+  if (info.Length() < 1 || !info[0]->IsString())
+    return Nan::ThrowTypeError("Expected a name");
+
+  if (!attachCatalog(*Nan::Utf8String(info[0])))
+    return Nan::ThrowError("Could not attach to the shared font catalog");
+
+  info.GetReturnValue().Set(Nan::New<Number>(getCatalog()->generation));
+}
+
+NAN_METHOD(detachCatalog) {
+  detachCatalog();
+}
+
+// releases the state of an environment that is shutting down. callbacks are
+// no longer called, but requests that are still running on the threadpool
+// have to finish before the event loop can be closed.
+void closeFlush(uv_handle_t *handle) {
+  AddonData *addon = (AddonData *) handle->data;
+  delete (uv_async_t *) handle;
+  addon->pending--;
+  releaseAddon(addon);
+}
+
+// drops the requests that have not started, and closes the handles of an
+// environment that is shutting down
+void closeAddon(AddonData *addon) {
+  addon->closing = true;
+
+  // the work items of queued requests won't find anything to run
+  while (AsyncRequest *req = (AsyncRequest *) addon->queue.pop()) {
+    finishRequest(req);
+  }
+
+  for (size_t i = 0; i < addon->answered.size(); i++) {
+    finishRequest(addon->answered[i]);
+  }
+
+  addon->answered.clear();
+  if (addon->flush) {
+    addon->pending++;
+    uv_close((uv_handle_t *) addon->flush, closeFlush);
+  }
+}
+
+void destroyAddon(AddonData *addon) {
+  delete addon;
+}
+
+// called whenever work or a handle of an environment finishes. once the
+// async cleanup hook ran and nothing is pending anymore, the state is freed
+// and the environment is told it can finish shutting down.
+void releaseAddon(AddonData *addon) {
+  if (!addon->cleanupDone || addon->pending)
+    return;
+
+  void (*done)(void *) = addon->cleanupDone;
+  void *arg = addon->cleanupDoneArg;
+  destroyAddon(addon);
+  done(arg);
+}
+
+#ifdef ASYNC_CLEANUP_HOOKS
+// the environment keeps running its event loop until done is called, so
+// requests still running on the threadpool finish on their own
+void cleanupAddon(void *arg, void (*done)(void *), void *doneArg) {
+  AddonData *addon = (AddonData *) arg;
+  closeAddon(addon);
+
+  addon->cleanupDone = done;
+  addon->cleanupDoneArg = doneArg;
+  releaseAddon(addon);
+}
+#else
+// older versions of Node.js can't wait for the environment's work, so the
+// hook runs the event loop itself until the running requests are done
+void cleanupAddon(void *arg) {
+  AddonData *addon = (AddonData *) arg;
+  closeAddon(addon);
+
+  while (addon->pending) {
+    uv_run(addon->loop, UV_RUN_ONCE);
+  }
+
+  destroyAddon(addon);
+}
+#endif
+
+// exports a method that can find the state of its environment
+void exportMethod(Local<Object> target, Local<Value> data, const char *name, Nan::FunctionCallback method) {
+  Local<Function> fn = Nan::GetFunction(Nan::New<FunctionTemplate>(method, data)).ToLocalChecked();
+  Nan::Set(target, Nan::New<String>(name).ToLocalChecked(), fn);
+}
+
 NAN_MODULE_INIT(Init) {
-  Nan::Export(target, "getAvailableFonts", getAvailableFonts<true>);
-  Nan::Export(target, "getAvailableFontsSync", getAvailableFonts<false>);
-  Nan::Export(target, "findFonts", findFonts<true>);
-  Nan::Export(target, "findFontsSync", findFonts<false>);
-  Nan::Export(target, "findFont", findFont<true>);
-  Nan::Export(target, "findFontSync", findFont<false>);
-  Nan::Export(target, "substituteFont", substituteFont<true>);
-  Nan::Export(target, "substituteFontSync", substituteFont<false>);
+  Isolate *isolate = Isolate::GetCurrent();
+  AddonData *addon = new AddonData(isolate);
+#if defined(ASYNC_CLEANUP_HOOKS)
+  addon->cleanupHook = node::AddEnvironmentCleanupHook(isolate, cleanupAddon, addon);
+#elif NODE_MAJOR_VERSION > 10 || (NODE_MAJOR_VERSION == 10 && NODE_MINOR_VERSION >= 2)
+  node::AddEnvironmentCleanupHook(isolate, cleanupAddon, addon);
+#endif
+  Local<Value> data = Nan::New<External>(addon);
+
+  exportMethod(target, data, "getAvailableFonts", readCatalog<true, CatalogFonts>);
+  exportMethod(target, data, "getAvailableFontsSync", readCatalog<false, CatalogFonts>);
+  exportMethod(target, data, "findFonts", findFonts<true>);
+  exportMethod(target, data, "findFontsSync", findFonts<false>);
+  exportMethod(target, data, "findFont", findFont<true>);
+  exportMethod(target, data, "findFontSync", findFont<false>);
+  exportMethod(target, data, "substituteFont", substituteFont<true>);
+  exportMethod(target, data, "substituteFontSync", substituteFont<false>);
+  exportMethod(target, data, "findFontIds", findFontIds<true>);
+  exportMethod(target, data, "findFontIdsSync", findFontIds<false>);
+  exportMethod(target, data, "substituteFontId", substituteFontId<true>);
+  exportMethod(target, data, "substituteFontIdSync", substituteFontId<false>);
+  exportMethod(target, data, "getFontsById", getFontsById<true>);
+  exportMethod(target, data, "getFontsByIdSync", getFontsById<false>);
+  exportMethod(target, data, "getFontFamilies", readCatalog<true, CatalogFamilies>);
+  exportMethod(target, data, "getFontFamiliesSync", readCatalog<false, CatalogFamilies>);
+  exportMethod(target, data, "getFamilyNames", readCatalog<true, CatalogFamilyNames>);
+  exportMethod(target, data, "getFamilyNamesSync", readCatalog<false, CatalogFamilyNames>);
+  exportMethod(target, data, "searchFamilies", searchFamilies<true>);
+  exportMethod(target, data, "searchFamiliesSync", searchFamilies<false>);
+  exportMethod(target, data, "resolveFontStack", resolveFontStack<true>);
+  exportMethod(target, data, "resolveFontStackSync", resolveFontStack<false>);
+  exportMethod(target, data, "getFallbackChain", getFallbackChain<true>);
+  exportMethod(target, data, "getFallbackChainSync", getFallbackChain<false>);
+  exportMethod(target, data, "getFontByPostscriptName", lookupCatalog<true, CatalogPostscriptNameIndex>);
+  exportMethod(target, data, "getFontByPostscriptNameSync", lookupCatalog<false, CatalogPostscriptNameIndex>);
+  exportMethod(target, data, "getFontByPath", lookupCatalog<true, CatalogPathIndex>);
+  exportMethod(target, data, "getFontByPathSync", lookupCatalog<false, CatalogPathIndex>);
+  exportMethod(target, data, "getFontMetrics", getFontMetrics<true>);
+  exportMethod(target, data, "getFontMetricsSync", getFontMetrics<false>);
+  exportMethod(target, data, "getFontVariations", getFontVariations<true>);
+  exportMethod(target, data, "getFontVariationsSync", getFontVariations<false>);
+  exportMethod(target, data, "measureText", measureText<true>);
+  exportMethod(target, data, "measureTextSync", measureText<false>);
+  exportMethod(target, data, "prewarm", prewarm);
+  exportMethod(target, data, "refreshCatalog", refreshCatalog<true>);
+  exportMethod(target, data, "refreshCatalogSync", refreshCatalog<false>);
+  exportMethod(target, data, "configureCache", configureCache);
+  exportMethod(target, data, "getCacheStats", getCacheStats);
+  exportMethod(target, data, "getCatalogStats", getCatalogStats);
+  exportMethod(target, data, "publishCatalog", publishCatalog);
+  exportMethod(target, data, "attachCatalog", attachCatalog);
+  exportMethod(target, data, "detachCatalog", detachCatalog);
+
+  // let processes that can't call prewarm before their first query opt in
+  const char *prewarmEnv = getenv("FONT_MANAGER_PREWARM");
+  if (prewarmEnv && *prewarmEnv && strcmp(prewarmEnv, "0") != 0)
+    startPrewarm(addon);
 }
 
-NODE_MODULE(fontmanager, Init)
+NAN_MODULE_WORKER_ENABLED(fontmanager, Init)
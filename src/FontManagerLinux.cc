@@ -1,54 +1,21 @@
 #include <fontconfig/fontconfig.h>
+#include <math.h>
+#include <string>
+#include <uv.h>
 #include "FontDescriptor.h"
+#include "FontCatalog.h"
 
+// converts a standard weight (1 to 1000) to a fontconfig weight. weights
+// between the named ones map to the weights between them.
 int convertWeight(FontWeight weight) {
-  switch (weight) {
-    case FontWeightThin:
-      return FC_WEIGHT_THIN;
-    case FontWeightUltraLight:
-      return FC_WEIGHT_ULTRALIGHT;
-    case FontWeightLight:
-      return FC_WEIGHT_LIGHT;
-    case FontWeightNormal:
-      return FC_WEIGHT_REGULAR;
-    case FontWeightMedium:
-      return FC_WEIGHT_MEDIUM;
-    case FontWeightSemiBold:
-      return FC_WEIGHT_SEMIBOLD;
-    case FontWeightBold:
-      return FC_WEIGHT_BOLD;
-    case FontWeightUltraBold:
-      return FC_WEIGHT_EXTRABOLD;
-    case FontWeightHeavy:
-      return FC_WEIGHT_ULTRABLACK;
-    default:
-      return FC_WEIGHT_REGULAR;
-  }
-}
-
-FontWeight convertWeight(int weight) {
-  switch (weight) {
-    case FC_WEIGHT_THIN:
-      return FontWeightThin;
-    case FC_WEIGHT_ULTRALIGHT:
-      return FontWeightUltraLight;
-    case FC_WEIGHT_LIGHT:
-      return FontWeightLight;
-    case FC_WEIGHT_REGULAR:
-      return FontWeightNormal;
-    case FC_WEIGHT_MEDIUM:
-      return FontWeightMedium;
-    case FC_WEIGHT_SEMIBOLD:
-      return FontWeightSemiBold;
-    case FC_WEIGHT_BOLD:
-      return FontWeightBold;
-    case FC_WEIGHT_EXTRABOLD:
-      return FontWeightUltraBold;
-    case FC_WEIGHT_ULTRABLACK:
-      return FontWeightHeavy;
-    default:
-      return FontWeightNormal;
-  }
+  double res = FcWeightFromOpenTypeDouble(weight);
+  return res < 0 ? FC_WEIGHT_REGULAR : (int) (res + 0.5);
+}
+
+// converts a fontconfig weight to a standard weight (1 to 1000)
+FontWeight convertWeight(double weight) {
+  double res = FcWeightToOpenTypeDouble(weight);
+  return res < 0 ? FontWeightNormal : (FontWeight) (int) (res + 0.5);
 }
 
 int convertWidth(FontWidth width) {
@@ -76,46 +43,64 @@ int convertWidth(FontWidth width) {
   }
 }
 
-FontWidth convertWidth(int width) {
-  switch (width) {
-    case FC_WIDTH_ULTRACONDENSED:
-      return FontWidthUltraCondensed;
-    case FC_WIDTH_EXTRACONDENSED:
-      return FontWidthExtraCondensed;
-    case FC_WIDTH_CONDENSED:
-      return FontWidthCondensed;
-    case FC_WIDTH_SEMICONDENSED:
-      return FontWidthSemiCondensed;
-    case FC_WIDTH_NORMAL:
-      return FontWidthNormal;
-    case FC_WIDTH_SEMIEXPANDED:
-      return FontWidthSemiExpanded;
-    case FC_WIDTH_EXPANDED:
-      return FontWidthExpanded;
-    case FC_WIDTH_EXTRAEXPANDED:
-      return FontWidthExtraExpanded;
-    case FC_WIDTH_ULTRAEXPANDED:
-      return FontWidthUltraExpanded;
+// converts a fontconfig width (a percentage) to the closest standard width
+FontWidth convertWidth(double width) {
+  static const double widths[] = {
+    FC_WIDTH_ULTRACONDENSED, FC_WIDTH_EXTRACONDENSED, FC_WIDTH_CONDENSED,
+    FC_WIDTH_SEMICONDENSED, FC_WIDTH_NORMAL, FC_WIDTH_SEMIEXPANDED,
+    FC_WIDTH_EXPANDED, FC_WIDTH_EXTRAEXPANDED, FC_WIDTH_ULTRAEXPANDED
+  };
+
+  int res = 0;
+  for (int i = 1; i < 9; i++) {
+    if (fabs(widths[i] - width) < fabs(widths[res] - width))
+      res = i;
+  }
+
+  return (FontWidth) (res + 1);
+}
+
+// reads a number from a pattern. variable fonts have a range of values, of
+// which the one closest to the given default is used.
+double getNumber(FcPattern *pattern, const char *object, double defaultValue) {
+  FcValue value;
+  if (FcPatternGet(pattern, object, 0, &value) != FcResultMatch)
+    return defaultValue;
+
+  switch (value.type) {
+    case FcTypeInteger:
+      return value.u.i;
+    case FcTypeDouble:
+      return value.u.d;
+    case FcTypeRange: {
+      double begin, end;
+      if (!FcRangeGetDouble(value.u.r, &begin, &end))
+        return defaultValue;
+
+      return defaultValue < begin ? begin : defaultValue > end ? end : defaultValue;
+    }
     default:
-      return FontWidthNormal;
+      return defaultValue;
   }
 }
 
 FontDescriptor *createFontDescriptor(FcPattern *pattern) {
-  FcChar8 *path, *psName, *family, *style;
-  int weight, width, slant, spacing;
+  FcChar8 *path = NULL, *psName = NULL, *family = NULL, *style = NULL, *variations = NULL;
+  int slant = FC_SLANT_ROMAN, spacing = FC_PROPORTIONAL, index = -1;
 
   FcPatternGetString(pattern, FC_FILE, 0, &path);
   FcPatternGetString(pattern, FC_POSTSCRIPT_NAME, 0, &psName);
   FcPatternGetString(pattern, FC_FAMILY, 0, &family);
   FcPatternGetString(pattern, FC_STYLE, 0, &style);
+  FcPatternGetString(pattern, FC_FONT_VARIATIONS, 0, &variations);
 
-  FcPatternGetInteger(pattern, FC_WEIGHT, 0, &weight);
-  FcPatternGetInteger(pattern, FC_WIDTH, 0, &width);
+  double weight = getNumber(pattern, FC_WEIGHT, FC_WEIGHT_REGULAR);
+  double width = getNumber(pattern, FC_WIDTH, FC_WIDTH_NORMAL);
   FcPatternGetInteger(pattern, FC_SLANT, 0, &slant);
   FcPatternGetInteger(pattern, FC_SPACING, 0, &spacing);
+  FcPatternGetInteger(pattern, FC_INDEX, 0, &index);
 
-  return new FontDescriptor(
+  FontDescriptor *res = new FontDescriptor(
     (char *) path,
     (char *) psName,
     (char *) family,
@@ -125,38 +110,96 @@ FontDescriptor *createFontDescriptor(FcPattern *pattern) {
     slant == FC_SLANT_ITALIC,
     spacing == FC_MONO
   );
+
+  // named instances of variable fonts have the instance in the upper bits
+  res->faceIndex = index;
+
+  // matches in between the named instances of a variable font are set to
+  // a position on its axes
+  if (variations)
+    res->setVariations((char *) variations);
+
+  return res;
+}
+
+// copies the languages of a font, as "en|fr". matched fonts carry them too,
+// but only the catalog's index reads them, so only its fonts get them.
+void readLanguages(FcPattern *pattern, FontDescriptor *desc) {
+  FcLangSet *langs;
+  if (FcPatternGetLangSet(pattern, FC_LANG, 0, &langs) != FcResultMatch)
+    return;
+
+  FcStrSet *set = FcLangSetGetLangs(langs);
+  FcStrList *list = FcStrListCreate(set);
+  std::string languages;
+  FcChar8 *lang;
+  while ((lang = FcStrListNext(list))) {
+    if (!languages.empty())
+      languages.push_back('|');
+
+    languages.append((char *) lang);
+  }
+
+  FcStrListDone(list);
+  FcStrSetDestroy(set);
+  desc->setLanguages(languages.c_str());
 }
 
-ResultSet *getResultSet(FcFontSet *fs) {
+ResultSet *getResultSet(FcFontSet *fs, bool languages = false) {
   ResultSet *res = new ResultSet();
   if (!fs)
     return res;
 
   for (int i = 0; i < fs->nfont; i++) {
-    res->push_back(createFontDescriptor(fs->fonts[i]));
+    FontDescriptor *desc = createFontDescriptor(fs->fonts[i]);
+    if (languages)
+      readLanguages(fs->fonts[i], desc);
+
+    res->push_back(desc);
   }
 
   return res;
 }
 
-ResultSet *getAvailableFonts() {
+static uv_once_t configOnce = UV_ONCE_INIT;
+static uv_rwlock_t configLock;
+static FcConfig *config = NULL;
+
+static void initConfig() {
+  uv_rwlock_init(&configLock);
   FcInit();
+  config = FcConfigReference(FcConfigGetCurrent());
+}
 
+// Returns a reference to the configuration to run a query against, which
+// must be released with FcConfigDestroy. Queries run on several threads at
+// once, so rather than using the default configuration (which reloading
+// fonts destroys), each query holds on to the one it started with.
+FcConfig *acquireConfig() {
+  uv_once(&configOnce, initConfig);
+  uv_rwlock_rdlock(&configLock);
+  FcConfig *res = FcConfigReference(config);
+  uv_rwlock_rdunlock(&configLock);
+  return res;
+}
+
+ResultSet *getAvailableFonts() {
+  FcConfig *config = acquireConfig();
   FcPattern *pattern = FcPatternCreate();
-  FcObjectSet *os = FcObjectSetBuild(FC_FILE, FC_POSTSCRIPT_NAME, FC_FAMILY, FC_STYLE, FC_WEIGHT, FC_WIDTH, FC_SLANT, FC_SPACING, NULL);
-  FcFontSet *fs = FcFontList(NULL, pattern, os);
-  ResultSet *res = getResultSet(fs);
+  FcObjectSet *os = FcObjectSetBuild(FC_FILE, FC_INDEX, FC_POSTSCRIPT_NAME, FC_FAMILY, FC_STYLE, FC_WEIGHT, FC_WIDTH, FC_SLANT, FC_SPACING, FC_LANG, NULL);
+  FcFontSet *fs = FcFontList(config, pattern, os);
+  ResultSet *res = getResultSet(fs, true);
   
   FcPatternDestroy(pattern);
   FcObjectSetDestroy(os);
   FcFontSetDestroy(fs);
+  FcConfigDestroy(config);
 
   return res;
 }
 
 
 FcPattern *createPattern(FontDescriptor *desc) {
-  FcInit();
   FcPattern *pattern = FcPatternCreate();
 
   if (desc->postscriptName)
@@ -180,39 +223,50 @@ FcPattern *createPattern(FontDescriptor *desc) {
   if (desc->monospace)
     FcPatternAddInteger(pattern, FC_SPACING, FC_MONO);
 
+  const char *lang = desc->lang ? desc->lang : desc->script ? getScriptLanguage(desc->script) : NULL;
+  if (lang)
+    FcPatternAddString(pattern, FC_LANG, (FcChar8 *) lang);
+
   return pattern;
 }
 
 ResultSet *findFonts(FontDescriptor *desc) {
+  FcConfig *config = acquireConfig();
   FcPattern *pattern = createPattern(desc);
-  FcObjectSet *os = FcObjectSetBuild(FC_FILE, FC_POSTSCRIPT_NAME, FC_FAMILY, FC_STYLE, FC_WEIGHT, FC_WIDTH, FC_SLANT, FC_SPACING, NULL);
-  FcFontSet *fs = FcFontList(NULL, pattern, os);
+  FcObjectSet *os = FcObjectSetBuild(FC_FILE, FC_INDEX, FC_POSTSCRIPT_NAME, FC_FAMILY, FC_STYLE, FC_WEIGHT, FC_WIDTH, FC_SLANT, FC_SPACING, NULL);
+  FcFontSet *fs = FcFontList(config, pattern, os);
   ResultSet *res = getResultSet(fs);
 
   FcFontSetDestroy(fs);
   FcPatternDestroy(pattern);
   FcObjectSetDestroy(os);
+  FcConfigDestroy(config);
 
   return res;
 }
 
 FontDescriptor *findFont(FontDescriptor *desc) {
+  FcConfig *config = acquireConfig();
   FcPattern *pattern = createPattern(desc);
-  FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+
+  // let variable fonts match anywhere on their axes, unless a named instance matches exactly
+  FcPatternAddBool(pattern, FC_VARIABLE, FcDontCare);
+  FcConfigSubstitute(config, pattern, FcMatchPattern);
   FcDefaultSubstitute(pattern);
 
   FcResult result;
-  FcPattern *font = FcFontMatch(NULL, pattern, &result);
+  FcPattern *font = FcFontMatch(config, pattern, &result);
   FontDescriptor *res = createFontDescriptor(font);
 
   FcPatternDestroy(pattern);
   FcPatternDestroy(font);
+  FcConfigDestroy(config);
 
   return res;
 }
 
 FontDescriptor *substituteFont(char *postscriptName, char *string) {
-  FcInit();
+  FcConfig *config = acquireConfig();
 
   // create a pattern with the postscript name
   FcPattern* pattern = FcPatternCreate();
@@ -231,16 +285,282 @@ FontDescriptor *substituteFont(char *postscriptName, char *string) {
   FcPatternAddCharSet(pattern, FC_CHARSET, charset);
   FcCharSetDestroy(charset);
 
-  FcConfigSubstitute(0, pattern, FcMatchPattern);
+  FcConfigSubstitute(config, pattern, FcMatchPattern);
   FcDefaultSubstitute(pattern);
 
   // find the best match font
   FcResult result;
-  FcPattern *font = FcFontMatch(NULL, pattern, &result);
+  FcPattern *font = FcFontMatch(config, pattern, &result);
   FontDescriptor *res = createFontDescriptor(font);
 
   FcPatternDestroy(pattern);
   FcPatternDestroy(font);
+  FcConfigDestroy(config);
+
+  return res;
+}
+
+bool fontsChanged() {
+  FcConfig *current = acquireConfig();
+  bool upToDate = FcConfigUptoDate(current);
+  FcConfigDestroy(current);
+  if (upToDate)
+    return false;
+
+  // load a new configuration for later queries. FcInitBringUptoDate would
+  // destroy the current one while other threads may still be using it.
+  FcConfig *updated = FcInitLoadConfigAndFonts();
+  if (!updated)
+    return false;
+
+  uv_rwlock_wrlock(&configLock);
+  FcConfig *previous = config;
+  config = updated;
+  uv_rwlock_wrunlock(&configLock);
+
+  FcConfigDestroy(previous);
+  return true;
+}
+
+// maps CSS generic font families to the fontconfig aliases for them
+const char *genericFamily(const char *family) {
+  static const char *generics[][2] = {
+    { "serif", "serif" },
+    { "sans-serif", "sans-serif" },
+    { "monospace", "monospace" },
+    { "cursive", "cursive" },
+    { "fantasy", "fantasy" },
+    { "system-ui", "sans-serif" },
+    { "ui-serif", "serif" },
+    { "ui-sans-serif", "sans-serif" },
+    { "ui-monospace", "monospace" },
+    { "ui-rounded", "sans-serif" },
+    { "emoji", "emoji" },
+    { "math", "math" }
+  };
+
+  for (unsigned int i = 0; i < sizeof(generics) / sizeof(generics[0]); i++) {
+    if (FcStrCmpIgnoreCase((FcChar8 *) family, (FcChar8 *) generics[i][0]) == 0)
+      return generics[i][1];
+  }
+
+  return NULL;
+}
+
+// creates a pattern for the traits in desc with the given family
+FcPattern *createFamilyPattern(FcConfig *config, FontDescriptor *desc, const char *family) {
+  if (family && genericFamily(family))
+    family = genericFamily(family);
+
+  FontDescriptor query(NULL, NULL, family, desc->style, desc->weight, desc->width, desc->italic, desc->monospace);
+  FcPattern *pattern = createPattern(&query);
+  FcConfigSubstitute(config, pattern, FcMatchPattern);
+  FcDefaultSubstitute(pattern);
+  return pattern;
+}
+
+// returns the best match for a family in a font stack, or NULL if it does not exist.
+// generic families always resolve to whatever fontconfig aliases them to.
+FcPattern *matchFamily(FcConfig *config, FontDescriptor *desc, const char *family) {
+  FcPattern *pattern = createFamilyPattern(config, desc, family);
+
+  FcResult result;
+  FcPattern *font = FcFontMatch(config, pattern, &result);
+  FcPatternDestroy(pattern);
+
+  if (!font || genericFamily(family))
+    return font;
+
+  // fontconfig always returns something, so check that we got the family that was asked for
+  FcChar8 *name;
+  for (int i = 0; FcPatternGetString(font, FC_FAMILY, i, &name) == FcResultMatch; i++) {
+    if (FcStrCmpIgnoreCase(name, (FcChar8 *) family) == 0)
+      return font;
+  }
+
+  FcPatternDestroy(font);
+  return NULL;
+}
+
+bool hasChar(FcPattern *font, FcChar32 c) {
+  FcCharSet *charset;
+  if (FcPatternGetCharSet(font, FC_CHARSET, 0, &charset) != FcResultMatch)
+    return false;
+
+  return FcCharSetHasChar(charset, c);
+}
+
+FontStackResult *resolveFontStack(std::vector<std::string> &families, FontDescriptor *desc, char *text) {
+  FcConfig *config = acquireConfig();
+  FontStackResult *res = new FontStackResult();
 
+  // resolve the first family in the stack that exists
+  FcPattern *primary = NULL;
+  size_t next = 0;
+  while (!primary && next < families.size()) {
+    primary = matchFamily(config, desc, families[next].c_str());
+    if (primary) {
+      res->setFamily(families[next].c_str());
+    }
+
+    next++;
+  }
+
+  // if nothing in the stack exists, use the default font for the traits
+  if (!primary) {
+    FcPattern *pattern = createFamilyPattern(config, desc, NULL);
+    FcResult result;
+    primary = FcFontMatch(config, pattern, &result);
+    FcPatternDestroy(pattern);
+  }
+
+  if (!primary) {
+    FcConfigDestroy(config);
+    return res;
+  }
+
+  res->font = createFontDescriptor(primary);
+  if (!text) {
+    FcPatternDestroy(primary);
+    FcConfigDestroy(config);
+    return res;
+  }
+
+  // collect the code points in the text that the primary font does not support
+  res->hasText = true;
+  std::vector<FcChar32> missing;
+  FcCharSet *seen = FcCharSetCreate();
+  int len = strlen(text);
+
+  for (int i = 0; i < len;) {
+    FcChar32 c;
+    int n = FcUtf8ToUcs4((FcChar8 *) text + i, &c, len - i);
+    if (n <= 0)
+      break;
+
+    i += n;
+    if (!FcCharSetHasChar(seen, c) && !hasChar(primary, c))
+      missing.push_back(c);
+
+    FcCharSetAddChar(seen, c);
+  }
+
+  FcCharSetDestroy(seen);
+
+  // walk the rest of the stack, then the system fallback list, for each missing code point
+  std::vector<FontDescriptor *> fallbacks(missing.size(), (FontDescriptor *) NULL);
+  size_t remaining = missing.size();
+
+  for (; remaining > 0 && next < families.size(); next++) {
+    FcPattern *font = matchFamily(config, desc, families[next].c_str());
+    if (!font)
+      continue;
+
+    FontDescriptor *fallback = NULL;
+    for (size_t i = 0; i < missing.size(); i++) {
+      if (!fallbacks[i] && hasChar(font, missing[i])) {
+        if (!fallback)
+          fallback = res->addFallbackFont(createFontDescriptor(font));
+
+        fallbacks[i] = fallback;
+        remaining--;
+      }
+    }
+
+    FcPatternDestroy(font);
+  }
+
+  if (remaining > 0) {
+    FcPattern *pattern = createFamilyPattern(config, desc, res->family);
+    FcResult result;
+    FcFontSet *fs = FcFontSort(config, pattern, FcTrue, NULL, &result);
+
+    for (int j = 0; fs && remaining > 0 && j < fs->nfont; j++) {
+      FontDescriptor *fallback = NULL;
+      for (size_t i = 0; i < missing.size(); i++) {
+        if (!fallbacks[i] && hasChar(fs->fonts[j], missing[i])) {
+          if (!fallback)
+            fallback = res->addFallbackFont(createFontDescriptor(fs->fonts[j]));
+
+          fallbacks[i] = fallback;
+          remaining--;
+        }
+      }
+    }
+
+    if (fs)
+      FcFontSetDestroy(fs);
+
+    FcPatternDestroy(pattern);
+  }
+
+  for (size_t i = 0; i < missing.size(); i++) {
+    res->addFallback(missing[i], fallbacks[i]);
+  }
+
+  FcPatternDestroy(primary);
+  FcConfigDestroy(config);
+  return res;
+}
+
+FallbackChain *getFallbackChain(char *postscriptName, char *lang) {
+  FcConfig *config = acquireConfig();
+
+  // sorting never fails, so check that the font exists first
+  FcPattern *exact = FcPatternCreate();
+  FcPatternAddString(exact, FC_POSTSCRIPT_NAME, (FcChar8 *) postscriptName);
+  FcObjectSet *os = FcObjectSetBuild(FC_POSTSCRIPT_NAME, NULL);
+  FcFontSet *primary = FcFontList(config, exact, os);
+  bool found = primary && primary->nfont > 0;
+
+  if (primary)
+    FcFontSetDestroy(primary);
+
+  FcObjectSetDestroy(os);
+  FcPatternDestroy(exact);
+
+  if (!found) {
+    FcConfigDestroy(config);
+    return NULL;
+  }
+
+  FcPattern *pattern = FcPatternCreate();
+  FcPatternAddString(pattern, FC_POSTSCRIPT_NAME, (FcChar8 *) postscriptName);
+  if (lang)
+    FcPatternAddString(pattern, FC_LANG, (FcChar8 *) lang);
+
+  FcConfigSubstitute(config, pattern, FcMatchPattern);
+  FcDefaultSubstitute(pattern);
+
+  // sort all fonts by closeness to the pattern, trimming the ones that
+  // don't add any coverage to the fonts before them
+  FcResult result;
+  FcFontSet *fs = FcFontSort(config, pattern, FcTrue, NULL, &result);
+
+  FallbackChain *res = new FallbackChain();
+  FcCharSet *coverage = FcCharSetCreate();
+
+  for (int i = 0; fs && i < fs->nfont; i++) {
+    FcCharSet *charset;
+    if (FcPatternGetCharSet(fs->fonts[i], FC_CHARSET, 0, &charset) != FcResultMatch)
+      continue;
+
+    unsigned int added = FcCharSetSubtractCount(charset, coverage);
+    if (added == 0)
+      continue;
+
+    FcCharSet *merged = FcCharSetUnion(coverage, charset);
+    FcCharSetDestroy(coverage);
+    coverage = merged;
+
+    res->add(createFontDescriptor(fs->fonts[i]), added);
+  }
+
+  FcCharSetDestroy(coverage);
+  if (fs)
+    FcFontSetDestroy(fs);
+
+  FcPatternDestroy(pattern);
+  FcConfigDestroy(config);
   return res;
 }
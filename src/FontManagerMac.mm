@@ -1,6 +1,11 @@
 #include <Foundation/Foundation.h>
 #include <CoreText/CoreText.h>
+#include <atomic>
+#include <string>
+#include <unordered_set>
 #include "FontDescriptor.h"
+#include "FontCatalog.h"
+#include "Unicode.h"
 
 // converts a CoreText weight (-1 to +1) to a standard weight (100 to 900)
 static int convertWeight(float weight) {
@@ -68,24 +73,110 @@ FontDescriptor *createFontDescriptor(CTFontDescriptorRef descriptor) {
   return res;
 }
 
+// the font collection is cached for fast use in future calls, and created
+// again when the installed fonts change. these are only used while the
+// catalog's refresh lock is held.
+static CTFontCollectionRef collection = NULL;
+static NSUInteger checkedCount = 0;
+static uint64_t checkedHash = 0;
+
+// counts the notifications CoreText posts when fonts are registered or
+// unregistered, in this process or for the whole system
+static std::atomic<unsigned int> fontChanges(0);
+static unsigned int checkedChanges = 0;
+
+static void onFontsChanged(CFNotificationCenterRef center, void *observer, CFStringRef name, const void *object, CFDictionaryRef userInfo) {
+  fontChanges++;
+}
+
+// counts and hashes the sorted postscript names of the available fonts.
+// CoreText only delivers its notifications for system wide changes through
+// a run loop, which Node.js doesn't run, so the fonts are compared too. the
+// hash depends on the order of the names, so fonts that are swapped for
+// others change it, unlike a sum. each check enumerates and sorts every
+// name with the refresh lock held, so queries that need a refresh wait for
+// it, but it runs at most once per catalog check interval.
+static void getFontsFingerprint(NSUInteger *count, uint64_t *hash) {
+  NSArray *names = (NSArray *) CTFontManagerCopyAvailablePostScriptNames();
+  NSMutableArray *sorted = [names mutableCopy];
+  [names release];
+  [sorted sortUsingSelector:@selector(compare:)];
+
+  // FNV-1a over the names, each ending with a null byte
+  uint64_t res = 14695981039346656037ull;
+  for (NSString *name in sorted) {
+    for (const unsigned char *p = (const unsigned char *) [name UTF8String]; *p; p++) {
+      res ^= *p;
+      res *= 1099511628211ull;
+    }
+
+    res *= 1099511628211ull;
+  }
+
+  *count = [sorted count];
+  *hash = res;
+  [sorted release];
+}
+
 ResultSet *getAvailableFonts() {
-  // cache font collection for fast use in future calls
-  static CTFontCollectionRef collection = NULL;
-  if (collection == NULL)
+  if (!collection) {
+    CFNotificationCenterAddObserver(
+      CFNotificationCenterGetLocalCenter(),
+      NULL,
+      onFontsChanged,
+      kCTFontManagerRegisteredFontsChangedNotification,
+      NULL,
+      CFNotificationSuspensionBehaviorDeliverImmediately
+    );
+
     collection = CTFontCollectionCreateFromAvailableFonts(NULL);
+    checkedChanges = fontChanges;
+    getFontsFingerprint(&checkedCount, &checkedHash);
+  }
   
   NSArray *matches = (NSArray *) CTFontCollectionCreateMatchingFontDescriptors(collection);  
   ResultSet *results = new ResultSet();
   
   for (id m in matches) {
     CTFontDescriptorRef match = (CTFontDescriptorRef) m;
-    results->push_back(createFontDescriptor(match));
+    FontDescriptor *desc = createFontDescriptor(match);
+
+    // the languages of each font are only needed for the catalog's index
+    NSArray *languages = (NSArray *) CTFontDescriptorCopyAttribute(match, kCTFontLanguagesAttribute);
+    if (languages) {
+      NSString *joined = [languages componentsJoinedByString:@"|"];
+      desc->setLanguages([joined UTF8String]);
+      [languages release];
+    }
+
+    results->push_back(desc);
   }
   
   [matches release];
   return results;
 }
 
+bool fontsChanged() {
+  if (!collection)
+    return false;
+
+  unsigned int changes = fontChanges;
+  NSUInteger count;
+  uint64_t hash;
+  getFontsFingerprint(&count, &hash);
+  if (changes == checkedChanges && count == checkedCount && hash == checkedHash)
+    return false;
+
+  checkedChanges = changes;
+  checkedCount = count;
+  checkedHash = hash;
+
+  // the next catalog reads a new collection
+  CFRelease(collection);
+  collection = CTFontCollectionCreateFromAvailableFonts(NULL);
+  return true;
+}
+
 // helper to square a value
 static inline int sqr(int value) {
   return value * value;
@@ -111,6 +202,12 @@ CTFontDescriptorRef getFontDescriptor(FontDescriptor *desc) {
     attrs[(id)kCTFontStyleNameAttribute] = style;
   }
 
+  const char *lang = desc->lang ? desc->lang : desc->script ? getScriptLanguage(desc->script) : NULL;
+  if (lang) {
+    NSString *language = [NSString stringWithUTF8String:lang];
+    attrs[(id)kCTFontLanguagesAttribute] = @[language];
+  }
+
   // build symbolic traits
   if (desc->italic)
     symbolicTraits |= kCTFontItalicTrait;
@@ -251,3 +348,233 @@ FontDescriptor *substituteFont(char *postscriptName, char *string) {
   
   return res;
 }
+
+// maps CSS generic font families to the fonts macOS uses for them
+static const char *genericFamily(const char *family) {
+  static const char *generics[][2] = {
+    { "serif", "Times" },
+    { "sans-serif", "Helvetica" },
+    { "monospace", "Menlo" },
+    { "cursive", "Apple Chancery" },
+    { "fantasy", "Papyrus" },
+    { "system-ui", "Helvetica Neue" },
+    { "ui-serif", "Times" },
+    { "ui-sans-serif", "Helvetica Neue" },
+    { "ui-monospace", "Menlo" },
+    { "ui-rounded", "Helvetica Neue" },
+    { "emoji", "Apple Color Emoji" },
+    { "math", "STIXGeneral" }
+  };
+
+  for (unsigned int i = 0; i < sizeof(generics) / sizeof(generics[0]); i++) {
+    if (strcasecmp(family, generics[i][0]) == 0)
+      return generics[i][1];
+  }
+
+  return NULL;
+}
+
+static bool familyExists(const char *family) {
+  NSDictionary *attrs = @{(id)kCTFontFamilyNameAttribute: [NSString stringWithUTF8String:family]};
+  CTFontDescriptorRef descriptor = CTFontDescriptorCreateWithAttributes((CFDictionaryRef) attrs);
+  NSArray *matches = (NSArray *) CTFontDescriptorCreateMatchingFontDescriptors(descriptor, NULL);
+  bool exists = matches && [matches count] > 0;
+
+  [matches release];
+  CFRelease(descriptor);
+  return exists;
+}
+
+// returns the best match for a family in a font stack, or NULL if it does not exist
+static FontDescriptor *matchFamily(FontDescriptor *desc, const char *family) {
+  const char *generic = genericFamily(family);
+  if (generic)
+    family = generic;
+
+  if (!familyExists(family))
+    return NULL;
+
+  FontDescriptor *query = new FontDescriptor(NULL, NULL, family, desc->style, desc->weight, desc->width, desc->italic, desc->monospace);
+  FontDescriptor *res = findFont(query);
+  delete query;
+  return res;
+}
+
+// returns whether the font supports the given code point, and otherwise
+// stores the system substitute for it in fallback
+static bool hasChar(FontDescriptor *font, uint32_t c, FontDescriptor **fallback) {
+  char str[5];
+  encodeUtf8(c, str);
+
+  FontDescriptor *substitute = substituteFont((char *) font->postscriptName, str);
+  if (substitute && strcmp(substitute->postscriptName, font->postscriptName) == 0) {
+    delete substitute;
+    return true;
+  }
+
+  if (fallback)
+    *fallback = substitute;
+  else
+    delete substitute;
+
+  return false;
+}
+
+FontStackResult *resolveFontStack(std::vector<std::string> &families, FontDescriptor *desc, char *text) {
+  FontStackResult *res = new FontStackResult();
+
+  // resolve the first family in the stack that exists
+  size_t next = 0;
+  while (!res->font && next < families.size()) {
+    res->font = matchFamily(desc, families[next].c_str());
+    if (res->font) {
+      res->setFamily(families[next].c_str());
+    }
+
+    next++;
+  }
+
+  // if nothing in the stack exists, use the default font for the traits
+  if (!res->font) {
+    FontDescriptor *query = new FontDescriptor(NULL, NULL, NULL, desc->style, desc->weight, desc->width, desc->italic, desc->monospace);
+    res->font = findFont(query);
+    delete query;
+  }
+
+  if (!res->font || !text)
+    return res;
+
+  // collect the code points in the text that the font does not support,
+  // along with the system substitute for each of them
+  res->hasText = true;
+  std::vector<uint32_t> missing;
+  std::vector<FontDescriptor *> substitutes;
+  std::unordered_set<uint32_t> seen;
+  int len = strlen(text);
+
+  for (int i = 0; i < len;) {
+    uint32_t c;
+    i += decodeUtf8(text + i, len - i, &c);
+    if (!seen.insert(c).second)
+      continue;
+
+    FontDescriptor *substitute = NULL;
+    if (!hasChar(res->font, c, &substitute)) {
+      missing.push_back(c);
+      substitutes.push_back(substitute);
+    }
+  }
+
+  // prefer the rest of the stack over the system substitutes
+  std::vector<FontDescriptor *> fallbacks(missing.size(), (FontDescriptor *) NULL);
+  for (; next < families.size(); next++) {
+    FontDescriptor *font = matchFamily(desc, families[next].c_str());
+    if (!font)
+      continue;
+
+    bool used = false;
+    for (size_t i = 0; i < missing.size(); i++) {
+      if (!fallbacks[i] && hasChar(font, missing[i], NULL)) {
+        fallbacks[i] = font;
+        used = true;
+      }
+    }
+
+    if (used)
+      res->addFallbackFont(font);
+    else
+      delete font;
+  }
+
+  for (size_t i = 0; i < missing.size(); i++) {
+    if (!fallbacks[i] && substitutes[i]) {
+      res->addFallback(missing[i], res->addFallbackFont(substitutes[i]));
+    } else {
+      res->addFallback(missing[i], fallbacks[i]);
+      delete substitutes[i];
+    }
+  }
+
+  return res;
+}
+
+// adds the code points in a character set to a bitmap covering all 17
+// unicode planes, and returns how many of them were not already in it
+static unsigned int addCoverage(NSCharacterSet *set, std::vector<uint8_t> &covered) {
+  NSData *data = [set bitmapRepresentation];
+  const uint8_t *bytes = (const uint8_t *) [data bytes];
+  NSUInteger length = [data length];
+  unsigned int added = 0;
+
+  // the BMP comes first, followed by each other plane prefixed with its number
+  for (NSUInteger offset = 0; offset < length;) {
+    unsigned int plane = 0;
+    if (offset > 0)
+      plane = bytes[offset++];
+
+    if (plane > 16 || offset + 8192 > length)
+      break;
+
+    uint8_t *dst = &covered[plane * 8192];
+    for (unsigned int i = 0; i < 8192; i++) {
+      uint8_t bits = bytes[offset + i] & ~dst[i];
+      added += __builtin_popcount(bits);
+      dst[i] |= bits;
+    }
+
+    offset += 8192;
+  }
+
+  return added;
+}
+
+FallbackChain *getFallbackChain(char *postscriptName, char *lang) {
+  NSString *ps = [NSString stringWithUTF8String:postscriptName];
+  NSDictionary *attrs = @{(id)kCTFontNameAttribute: ps};
+  CTFontDescriptorRef descriptor = CTFontDescriptorCreateWithAttributes((CFDictionaryRef) attrs);
+  CTFontRef font = CTFontCreateWithFontDescriptor(descriptor, 12.0, NULL);
+
+  // CoreText substitutes a default font for unknown names
+  NSString *name = (NSString *) CTFontCopyPostScriptName(font);
+  bool found = [name isEqualToString:ps];
+  [name release];
+
+  if (!found) {
+    CFRelease(font);
+    CFRelease(descriptor);
+    return NULL;
+  }
+
+  FallbackChain *res = new FallbackChain();
+
+  // the font itself comes first, followed by the system cascade list for it
+  NSArray *languages = lang ? @[[NSString stringWithUTF8String:lang]] : nil;
+  NSArray *cascade = (NSArray *) CTFontCopyDefaultCascadeListForLanguages(font, (CFArrayRef) languages);
+  CTFontDescriptorRef primary = CTFontCopyFontDescriptor(font);
+  NSMutableArray *chain = [NSMutableArray arrayWithObject:(id) primary];
+  if (cascade)
+    [chain addObjectsFromArray:cascade];
+
+  std::vector<uint8_t> covered(17 * 8192, 0);
+  for (id d in chain) {
+    // cascade list entries may only have a name, so match them to get the full attributes
+    CTFontDescriptorRef match = CTFontDescriptorCreateMatchingFontDescriptor((CTFontDescriptorRef) d, NULL);
+    if (!match)
+      continue;
+
+    NSCharacterSet *set = (NSCharacterSet *) CTFontDescriptorCopyAttribute(match, kCTFontCharacterSetAttribute);
+    unsigned int added = set ? addCoverage(set, covered) : 0;
+    if (added > 0)
+      res->add(createFontDescriptor(match), added);
+
+    [set release];
+    CFRelease(match);
+  }
+
+  [cascade release];
+  CFRelease(primary);
+  CFRelease(font);
+  CFRelease(descriptor);
+
+  return res;
+}
@@ -1,8 +1,11 @@
 #define WINVER 0x0600
 #include "FontDescriptor.h"
+#include "FontCatalog.h"
 #include <dwrite.h>
 #include <dwrite_1.h>
+#include <string>
 #include <unordered_set>
+#include "Unicode.h"
 
 // throws a JS error when there is some exception in DirectWrite
 #define HR(hr) \
@@ -71,7 +74,7 @@ char *getString(IDWriteFont *font, DWRITE_INFORMATIONAL_STRING_ID string_id) {
 
     // convert to utf8
     res = utf16ToUtf8(str);
-    delete str;
+    delete[] str;
     
     strings->Release();
   }
@@ -142,11 +145,13 @@ FontDescriptor *resultFromFont(IDWriteFont *font) {
         monospace
       );
 
-      delete psName;
-      delete name;
-      delete postscriptName;
-      delete family;
-      delete style;
+      res->faceIndex = face->GetIndex();
+
+      delete[] psName;
+      delete[] name;
+      delete[] postscriptName;
+      delete[] family;
+      delete[] style;
       fileLoader->Release();
     }
 
@@ -159,6 +164,78 @@ FontDescriptor *resultFromFont(IDWriteFont *font) {
   return res;
 }
 
+// DirectWrite does not report the languages a font supports, so they are
+// taken from the code pages and Unicode ranges declared in the font's OS/2
+// table. a language is listed if the font supports its code page, or the
+// Unicode block of its script for the scripts no code page stands for.
+static const struct {
+  const char *lang;
+  int codePage;     // the bit of the code page in ulCodePageRange, or -1
+  int unicodeRange; // the bit of the script's block in ulUnicodeRange, or -1
+} languageRanges[] = {
+  { "am", -1, 75 }, { "ar", 6, 13 }, { "bg", 2, 9 }, { "bn", -1, 16 },
+  { "bo", -1, 70 }, { "cs", 1, -1 }, { "de", 0, -1 }, { "dv", -1, 72 },
+  { "el", 3, 7 }, { "en", 0, -1 }, { "es", 0, -1 }, { "fr", 0, -1 },
+  { "gu", -1, 18 }, { "he", 5, 11 }, { "hi", -1, 15 }, { "hu", 1, -1 },
+  { "hy", -1, 10 }, { "it", 0, -1 }, { "ja", 17, 49 }, { "ka", -1, 26 },
+  { "km", -1, 80 }, { "kn", -1, 22 }, { "ko", 19, 56 }, { "lo", -1, 25 },
+  { "lt", 7, -1 }, { "ml", -1, 23 }, { "mn", -1, 81 }, { "my", -1, 74 },
+  { "or", -1, 19 }, { "pa", -1, 17 }, { "pl", 1, -1 }, { "pt", 0, -1 },
+  { "ru", 2, 9 }, { "si", -1, 73 }, { "ta", -1, 20 }, { "te", -1, 21 },
+  { "th", 16, 24 }, { "tr", 4, -1 }, { "uk", 2, 9 }, { "vi", 8, -1 },
+  { "zh-cn", 18, -1 }, { "zh-tw", 20, -1 }
+};
+
+// the offsets of ulUnicodeRange1 and ulCodePageRange1 in the OS/2 table
+#define OS2_UNICODE_RANGE 42
+#define OS2_CODE_PAGE_RANGE 78
+
+// checks a bit of the ulUnicodeRange or ulCodePageRange fields of an OS/2
+// table, which are arrays of big endian 32 bit words. version 0 tables end
+// before the code pages.
+static bool hasRangeBit(const BYTE *table, UINT32 size, UINT32 offset, int bit) {
+  if (bit < 0)
+    return false;
+
+  UINT32 word = offset + (bit / 32) * 4;
+  if (word + 4 > size)
+    return false;
+
+  return (table[word + 3 - (bit % 32) / 8] >> (bit % 8)) & 1;
+}
+
+// returns the languages a font supports, as "en|ru"
+std::string getLanguages(IDWriteFont *font) {
+  std::string res;
+  IDWriteFontFace *face = NULL;
+  if (FAILED(font->CreateFontFace(&face)))
+    return res;
+
+  const void *data = NULL;
+  UINT32 size = 0;
+  void *context = NULL;
+  BOOL exists = FALSE;
+  HRESULT hr = face->TryGetFontTable(DWRITE_MAKE_OPENTYPE_TAG('O', 'S', '/', '2'), &data, &size, &context, &exists);
+  if (SUCCEEDED(hr) && exists) {
+    const BYTE *table = (const BYTE *) data;
+    for (size_t i = 0; i < sizeof(languageRanges) / sizeof(languageRanges[0]); i++) {
+      if (!hasRangeBit(table, size, OS2_CODE_PAGE_RANGE, languageRanges[i].codePage) &&
+          !hasRangeBit(table, size, OS2_UNICODE_RANGE, languageRanges[i].unicodeRange))
+        continue;
+
+      if (!res.empty())
+        res.push_back('|');
+
+      res.append(languageRanges[i].lang);
+    }
+
+    face->ReleaseFontTable(context);
+  }
+
+  face->Release();
+  return res;
+}
+
 ResultSet *getAvailableFonts() {
   ResultSet *res = new ResultSet();
   int count = 0;
@@ -194,8 +271,11 @@ ResultSet *getAvailableFonts() {
 
       FontDescriptor *result = resultFromFont(font);
       if (psNames.count(result->postscriptName) == 0) {
-        res->push_back(resultFromFont(font));
         psNames.insert(result->postscriptName);
+        result->setLanguages(getLanguages(font).c_str());
+        res->push_back(result);
+      } else {
+        delete result;
       }
     }
 
@@ -208,6 +288,50 @@ ResultSet *getAvailableFonts() {
   return res;
 }
 
+// the system font collection the last check saw. the shared factory keeps
+// returning the same collection until fonts are installed or removed. only
+// used while the catalog's refresh lock is held.
+static IDWriteFontCollection *checkedCollection = NULL;
+
+bool fontsChanged() {
+  IDWriteFactory *factory = NULL;
+  if (FAILED(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&factory))))
+    return false;
+
+  // asking the factory to check for updates replaces the collection it
+  // returns from then on if the fonts changed
+  IDWriteFontCollection *collection = NULL;
+  HRESULT hr = factory->GetSystemFontCollection(&collection, TRUE);
+  factory->Release();
+  if (FAILED(hr))
+    return false;
+
+  bool changed = checkedCollection && collection != checkedCollection;
+  if (checkedCollection)
+    checkedCollection->Release();
+
+  checkedCollection = collection;
+  return changed;
+}
+
+// checks whether a list of languages includes a language, or a more
+// specific form of it ("zh" includes "zh-cn")
+bool hasLanguage(const char *languages, const char *lang) {
+  size_t length = strlen(lang);
+  for (const char *p = languages; p && *p;) {
+    const char *end = strchr(p, '|');
+    if (!end)
+      end = p + strlen(p);
+
+    if ((size_t) (end - p) >= length && _strnicmp(p, lang, length) == 0 && (p + length == end || p[length] == '-'))
+      return true;
+
+    p = *end ? end + 1 : end;
+  }
+
+  return false;
+}
+
 bool resultMatches(FontDescriptor *result, FontDescriptor *desc) {
   if (desc->postscriptName && strcmp(desc->postscriptName, result->postscriptName) != 0)
     return false;
@@ -230,6 +354,15 @@ bool resultMatches(FontDescriptor *result, FontDescriptor *desc) {
   if (desc->monospace != result->monospace)
     return false;
 
+  if (desc->lang && !hasLanguage(result->languages, desc->lang))
+    return false;
+
+  if (desc->script) {
+    const char *lang = getScriptLanguage(desc->script);
+    if (!lang || !hasLanguage(result->languages, lang))
+      return false;
+  }
+
   return true;
 }
 
@@ -435,7 +568,7 @@ FontDescriptor *substituteFont(char *postscriptName, char *string) {
       &format
     ));
 
-    delete familyName;
+    delete[] familyName;
     delete font;
   } else {
     // this should never happen, but just in case, let the system
@@ -482,7 +615,328 @@ FontDescriptor *substituteFont(char *postscriptName, char *string) {
 
   desc->postscriptName = NULL;
   delete desc;
-  delete str;
+  delete[] str;
+  collection->Release();
+  factory->Release();
+
+  return res;
+}
+
+// maps CSS generic font families to the fonts Windows uses for them
+const char *genericFamily(const char *family) {
+  static const char *generics[][2] = {
+    { "serif", "Times New Roman" },
+    { "sans-serif", "Arial" },
+    { "monospace", "Consolas" },
+    { "cursive", "Comic Sans MS" },
+    { "fantasy", "Impact" },
+    { "system-ui", "Segoe UI" },
+    { "ui-serif", "Times New Roman" },
+    { "ui-sans-serif", "Segoe UI" },
+    { "ui-monospace", "Consolas" },
+    { "ui-rounded", "Segoe UI" },
+    { "emoji", "Segoe UI Emoji" },
+    { "math", "Cambria Math" }
+  };
+
+  for (unsigned int i = 0; i < sizeof(generics) / sizeof(generics[0]); i++) {
+    if (_stricmp(family, generics[i][0]) == 0)
+      return generics[i][1];
+  }
+
+  return NULL;
+}
+
+// returns the best match for a family in a font stack, or NULL if it does not exist
+FontDescriptor *matchFamily(FontDescriptor *desc, const char *family) {
+  FontDescriptor *res = NULL;
+  const char *generic = genericFamily(family);
+  if (generic)
+    family = generic;
+
+  IDWriteFactory *factory = NULL;
+  HR(DWriteCreateFactory(
+    DWRITE_FACTORY_TYPE_SHARED,
+    __uuidof(IDWriteFactory),
+    reinterpret_cast<IUnknown**>(&factory)
+  ));
+
+  IDWriteFontCollection *collection = NULL;
+  HR(factory->GetSystemFontCollection(&collection));
+
+  WCHAR *name = utf8ToUtf16(family);
+  unsigned int index = 0;
+  BOOL exists = false;
+  HR(collection->FindFamilyName(name, &index, &exists));
+
+  if (exists) {
+    IDWriteFontFamily *fontFamily = NULL;
+    IDWriteFont *font = NULL;
+    HR(collection->GetFontFamily(index, &fontFamily));
+    HR(fontFamily->GetFirstMatchingFont(
+      desc->weight ? (DWRITE_FONT_WEIGHT) desc->weight : DWRITE_FONT_WEIGHT_NORMAL,
+      desc->width ? (DWRITE_FONT_STRETCH) desc->width : DWRITE_FONT_STRETCH_NORMAL,
+      desc->italic ? DWRITE_FONT_STYLE_ITALIC : DWRITE_FONT_STYLE_NORMAL,
+      &font
+    ));
+
+    res = resultFromFont(font);
+    font->Release();
+    fontFamily->Release();
+  }
+
+  delete[] name;
+  collection->Release();
+  factory->Release();
+
+  return res;
+}
+
+// returns whether the font supports the given code point, and otherwise
+// stores the system substitute for it in fallback
+bool hasChar(FontDescriptor *font, uint32_t c, FontDescriptor **fallback) {
+  char str[5];
+  encodeUtf8(c, str);
+
+  FontDescriptor *substitute = substituteFont((char *) font->postscriptName, str);
+  if (substitute && strcmp(substitute->postscriptName, font->postscriptName) == 0) {
+    delete substitute;
+    return true;
+  }
+
+  if (fallback)
+    *fallback = substitute;
+  else
+    delete substitute;
+
+  return false;
+}
+
+FontStackResult *resolveFontStack(std::vector<std::string> &families, FontDescriptor *desc, char *text) {
+  FontStackResult *res = new FontStackResult();
+
+  // resolve the first family in the stack that exists
+  size_t next = 0;
+  while (!res->font && next < families.size()) {
+    res->font = matchFamily(desc, families[next].c_str());
+    if (res->font) {
+      res->setFamily(families[next].c_str());
+    }
+
+    next++;
+  }
+
+  // if nothing in the stack exists, use the default font for the traits
+  if (!res->font) {
+    FontDescriptor *query = new FontDescriptor(NULL, NULL, NULL, desc->style, desc->weight, desc->width, desc->italic, desc->monospace);
+    res->font = findFont(query);
+    delete query;
+  }
+
+  if (!res->font || !text)
+    return res;
+
+  // collect the code points in the text that the font does not support,
+  // along with the system substitute for each of them
+  res->hasText = true;
+  std::vector<uint32_t> missing;
+  std::vector<FontDescriptor *> substitutes;
+  std::unordered_set<uint32_t> seen;
+  int len = strlen(text);
+
+  for (int i = 0; i < len;) {
+    uint32_t c;
+    i += decodeUtf8(text + i, len - i, &c);
+    if (!seen.insert(c).second)
+      continue;
+
+    FontDescriptor *substitute = NULL;
+    if (!hasChar(res->font, c, &substitute)) {
+      missing.push_back(c);
+      substitutes.push_back(substitute);
+    }
+  }
+
+  // prefer the rest of the stack over the system substitutes
+  std::vector<FontDescriptor *> fallbacks(missing.size(), (FontDescriptor *) NULL);
+  for (; next < families.size(); next++) {
+    FontDescriptor *font = matchFamily(desc, families[next].c_str());
+    if (!font)
+      continue;
+
+    bool used = false;
+    for (size_t i = 0; i < missing.size(); i++) {
+      if (!fallbacks[i] && hasChar(font, missing[i], NULL)) {
+        fallbacks[i] = font;
+        used = true;
+      }
+    }
+
+    if (used)
+      res->addFallbackFont(font);
+    else
+      delete font;
+  }
+
+  for (size_t i = 0; i < missing.size(); i++) {
+    if (!fallbacks[i] && substitutes[i]) {
+      res->addFallback(missing[i], res->addFallbackFont(substitutes[i]));
+    } else {
+      res->addFallback(missing[i], fallbacks[i]);
+      delete substitutes[i];
+    }
+  }
+
+  return res;
+}
+
+// returns the DirectWrite font in the collection best matching a result
+IDWriteFont *getDWriteFont(IDWriteFontCollection *collection, FontDescriptor *desc) {
+  IDWriteFont *font = NULL;
+  WCHAR *name = utf8ToUtf16(desc->family);
+  unsigned int index = 0;
+  BOOL exists = false;
+  HR(collection->FindFamilyName(name, &index, &exists));
+
+  if (exists) {
+    IDWriteFontFamily *fontFamily = NULL;
+    HR(collection->GetFontFamily(index, &fontFamily));
+    HR(fontFamily->GetFirstMatchingFont(
+      (DWRITE_FONT_WEIGHT) desc->weight,
+      (DWRITE_FONT_STRETCH) desc->width,
+      desc->italic ? DWRITE_FONT_STYLE_ITALIC : DWRITE_FONT_STYLE_NORMAL,
+      &font
+    ));
+
+    fontFamily->Release();
+  }
+
+  delete[] name;
+  return font;
+}
+
+// adds the code points supported by a font to a bitmap of all code points,
+// and returns how many of them were not already in it
+unsigned int addCoverage(IDWriteFont *font, std::vector<uint8_t> &covered) {
+  unsigned int added = 0;
+  IDWriteFontFace *face = NULL;
+  IDWriteFontFace1 *face1 = NULL;
+  HR(font->CreateFontFace(&face));
+
+  // this method requires windows 7 with the platform update, so we need to cast to an IDWriteFontFace1
+  HRESULT hr = face->QueryInterface(__uuidof(IDWriteFontFace1), (void **)&face1);
+  if (SUCCEEDED(hr)) {
+    unsigned int count = 0;
+    face1->GetUnicodeRanges(0, NULL, &count);
+
+    DWRITE_UNICODE_RANGE *ranges = new DWRITE_UNICODE_RANGE[count];
+    HR(face1->GetUnicodeRanges(count, ranges, &count));
+
+    for (unsigned int i = 0; i < count; i++) {
+      for (unsigned int c = ranges[i].first; c <= ranges[i].last && c < 0x110000; c++) {
+        uint8_t bit = 1 << (c & 7);
+        if (!(covered[c >> 3] & bit)) {
+          covered[c >> 3] |= bit;
+          added++;
+        }
+      }
+    }
+
+    delete[] ranges;
+    face1->Release();
+  }
+
+  face->Release();
+  return added;
+}
+
+// returns the families linked to a family for fallback in the registry, in order
+std::vector<std::string> getLinkedFamilies(const char *family) {
+  std::vector<std::string> res;
+  WCHAR *name = utf8ToUtf16(family);
+  const WCHAR *key = L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion\\FontLink\\SystemLink";
+
+  DWORD size = 0;
+  if (RegGetValueW(HKEY_LOCAL_MACHINE, key, name, RRF_RT_REG_MULTI_SZ, NULL, NULL, &size) == ERROR_SUCCESS) {
+    WCHAR *value = new WCHAR[size / sizeof(WCHAR) + 1];
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, key, name, RRF_RT_REG_MULTI_SZ, NULL, value, &size) == ERROR_SUCCESS) {
+      // each entry looks like "FILE.TTC,Family Name[,scaling]"
+      for (WCHAR *entry = value; *entry; entry += wcslen(entry) + 1) {
+        WCHAR *start = wcschr(entry, L',');
+        if (!start)
+          continue;
+
+        std::wstring linked(start + 1);
+        size_t end = linked.find(L',');
+        if (end != std::wstring::npos)
+          linked.resize(end);
+
+        char *utf8 = utf16ToUtf8(linked.c_str());
+        res.push_back(utf8);
+        delete[] utf8;
+      }
+    }
+
+    delete[] value;
+  }
+
+  delete[] name;
+  return res;
+}
+
+FallbackChain *getFallbackChain(char *postscriptName, char *lang) {
+  // DirectWrite has no per-language fallback list before Windows 8.1,
+  // so the language is ignored and the registry font links are used.
+  // findFont would substitute a default font for an unknown name, so
+  // look for an exact match instead.
+  FontDescriptor *desc = new FontDescriptor();
+  desc->postscriptName = postscriptName;
+  ResultSet *fonts = findFonts(desc);
+  desc->postscriptName = NULL;
+  delete desc;
+
+  FontDescriptor *font = fonts->size() > 0 ? new FontDescriptor(fonts->front()) : NULL;
+  delete fonts;
+
+  if (!font)
+    return NULL;
+
+  FallbackChain *res = new FallbackChain();
+
+  IDWriteFactory *factory = NULL;
+  HR(DWriteCreateFactory(
+    DWRITE_FACTORY_TYPE_SHARED,
+    __uuidof(IDWriteFactory),
+    reinterpret_cast<IUnknown**>(&factory)
+  ));
+
+  IDWriteFontCollection *collection = NULL;
+  HR(factory->GetSystemFontCollection(&collection));
+
+  // the font itself comes first, followed by the fonts linked to it
+  std::vector<FontDescriptor *> chain;
+  chain.push_back(font);
+
+  std::vector<std::string> linked = getLinkedFamilies(font->family);
+  for (std::vector<std::string>::iterator it = linked.begin(); it != linked.end(); it++) {
+    FontDescriptor *match = matchFamily(font, it->c_str());
+    if (match)
+      chain.push_back(match);
+  }
+
+  std::vector<uint8_t> covered(0x110000 / 8, 0);
+  for (std::vector<FontDescriptor *>::iterator it = chain.begin(); it != chain.end(); it++) {
+    IDWriteFont *dwFont = getDWriteFont(collection, *it);
+    unsigned int added = dwFont ? addCoverage(dwFont, covered) : 0;
+    if (dwFont)
+      dwFont->Release();
+
+    if (added > 0)
+      res->add(*it, added);
+    else
+      delete *it;
+  }
+
   collection->Release();
   factory->Release();
 
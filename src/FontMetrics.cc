@@ -0,0 +1,1047 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <uv.h>
+#include "FontMetrics.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// the maximum number of cached metrics
+#define MAX_CACHED_METRICS 4096
+
+// glyph metrics are larger, so fewer of them are cached
+#define MAX_CACHED_GLYPH_METRICS 256
+
+#define MAX_CODEPOINT 0x10ffff
+
+#define TAG(a, b, c, d) ((uint32_t) (a) << 24 | (uint32_t) (b) << 16 | (uint32_t) (c) << 8 | (uint32_t) (d))
+
+// OS/2 fsSelection flag telling us to use the typographic metrics
+#define USE_TYPO_METRICS (1 << 7)
+
+static inline uint16_t readUInt16(const uint8_t *p) {
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline int16_t readInt16(const uint8_t *p) {
+  return (int16_t) readUInt16(p);
+}
+
+static inline uint32_t readUInt32(const uint8_t *p) {
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+// reads the parts of a font file we need with plain stdio
+class FontFile {
+public:
+  FontFile(const char *path) {
+#ifdef _WIN32
+    // paths are UTF-8, which the narrow windows APIs don't understand
+    int len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+    std::vector<wchar_t> wpath(len);
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, &wpath[0], len);
+    file = _wfopen(&wpath[0], L"rb");
+#else
+    file = fopen(path, "rb");
+#endif
+
+    // tables can claim any length, so reads are checked against the file
+    size = 0;
+    if (file && fseek(file, 0, SEEK_END) == 0) {
+      long end = ftell(file);
+      size = end > 0 ? (uint64_t) end : 0;
+    }
+  }
+
+  ~FontFile() {
+    if (file)
+      fclose(file);
+  }
+
+  bool isOpen() {
+    return file != NULL;
+  }
+
+  // reads length bytes at offset, failing without allocating anything if
+  // they are not all in the file
+  bool read(uint64_t offset, uint64_t length, std::vector<uint8_t> &buffer) {
+    if (offset + length > size)
+      return false;
+
+    buffer.resize((size_t) length);
+    return length == 0 || (fseek(file, (long) offset, SEEK_SET) == 0 && fread(&buffer[0], 1, (size_t) length, file) == length);
+  }
+
+private:
+  FILE *file;
+  uint64_t size;
+};
+
+// the location of a table in a font file
+struct TableRecord {
+  uint32_t offset;
+  uint32_t length;
+};
+
+typedef std::unordered_map<uint32_t, TableRecord> TableDirectory;
+
+// reads the table directory of the face starting at the given offset
+static bool readTableDirectory(FontFile &file, uint32_t offset, TableDirectory &tables) {
+  std::vector<uint8_t> header;
+  if (!file.read(offset, 12, header))
+    return false;
+
+  uint32_t version = readUInt32(&header[0]);
+  if (version != 0x00010000 && version != TAG('O', 'T', 'T', 'O') && version != TAG('t', 'r', 'u', 'e'))
+    return false;
+
+  uint16_t numTables = readUInt16(&header[4]);
+  std::vector<uint8_t> records;
+  if (!file.read((uint64_t) offset + 12, numTables * 16, records))
+    return false;
+
+  for (uint16_t i = 0; i < numTables; i++) {
+    const uint8_t *record = &records[i * 16];
+    TableRecord table;
+    table.offset = readUInt32(record + 8);
+    table.length = readUInt32(record + 12);
+    tables[readUInt32(record)] = table;
+  }
+
+  return true;
+}
+
+// reads a whole table, if it exists, is at least minLength bytes long, and
+// fits in the file
+static bool readTable(FontFile &file, TableDirectory &tables, uint32_t tag, uint32_t minLength, std::vector<uint8_t> &buffer) {
+  TableDirectory::iterator it = tables.find(tag);
+  return it != tables.end() && it->second.length >= minLength && file.read(it->second.offset, it->second.length, buffer);
+}
+
+// checks whether the postscript name (name ID 6) of a face matches
+static bool hasPostscriptName(FontFile &file, TableDirectory &tables, const char *postscriptName) {
+  std::vector<uint8_t> name;
+  if (!readTable(file, tables, TAG('n', 'a', 'm', 'e'), 6, name))
+    return false;
+
+  uint16_t count = readUInt16(&name[2]);
+  uint16_t stringOffset = readUInt16(&name[4]);
+  size_t expected = strlen(postscriptName);
+
+  for (uint16_t i = 0; i < count && 6 + (size_t) (i + 1) * 12 <= name.size(); i++) {
+    const uint8_t *record = &name[6 + i * 12];
+    uint16_t platformID = readUInt16(record);
+    uint16_t nameID = readUInt16(record + 6);
+    uint16_t length = readUInt16(record + 8);
+    uint32_t offset = stringOffset + readUInt16(record + 10);
+    if (nameID != 6 || offset + length > name.size())
+      continue;
+
+    // postscript names are ASCII, stored as single bytes (mac) or UTF-16BE (windows)
+    const uint8_t *str = &name[offset];
+    bool wide = platformID == 0 || platformID == 3;
+    if (length != (wide ? expected * 2 : expected))
+      continue;
+
+    bool match = true;
+    for (size_t j = 0; j < expected && match; j++) {
+      match = wide ? (str[j * 2] == 0 && str[j * 2 + 1] == (uint8_t) postscriptName[j]) : str[j] == (uint8_t) postscriptName[j];
+    }
+
+    if (match)
+      return true;
+  }
+
+  return false;
+}
+
+// appends a code point to a UTF-8 string
+static void appendUtf8(std::string &str, uint32_t c) {
+  if (c < 0x80) {
+    str.push_back((char) c);
+  } else if (c < 0x800) {
+    str.push_back((char) (0xc0 | c >> 6));
+    str.push_back((char) (0x80 | (c & 0x3f)));
+  } else if (c < 0x10000) {
+    str.push_back((char) (0xe0 | c >> 12));
+    str.push_back((char) (0x80 | (c >> 6 & 0x3f)));
+    str.push_back((char) (0x80 | (c & 0x3f)));
+  } else {
+    str.push_back((char) (0xf0 | c >> 18));
+    str.push_back((char) (0x80 | (c >> 12 & 0x3f)));
+    str.push_back((char) (0x80 | (c >> 6 & 0x3f)));
+    str.push_back((char) (0x80 | (c & 0x3f)));
+  }
+}
+
+// reads a string from the name table as UTF-8, preferring US English names
+// from the windows platform. returns an empty string if there is none.
+static std::string readName(const std::vector<uint8_t> &name, uint16_t nameID) {
+  if (name.size() < 6)
+    return std::string();
+
+  uint16_t count = readUInt16(&name[2]);
+  uint16_t stringOffset = readUInt16(&name[4]);
+  int bestScore = 0;
+  const uint8_t *best = NULL;
+  uint16_t bestLength = 0;
+  bool bestWide = false;
+
+  for (uint16_t i = 0; i < count && 6 + (size_t) (i + 1) * 12 <= name.size(); i++) {
+    const uint8_t *record = &name[6 + i * 12];
+    uint16_t platformID = readUInt16(record);
+    uint16_t encodingID = readUInt16(record + 2);
+    uint16_t languageID = readUInt16(record + 4);
+    uint16_t length = readUInt16(record + 8);
+    uint32_t offset = stringOffset + readUInt16(record + 10);
+    if (readUInt16(record + 6) != nameID || offset + length > name.size())
+      continue;
+
+    int score = 0;
+    if (platformID == 3 && (encodingID == 1 || encodingID == 10))
+      score = languageID == 0x409 ? 4 : 3;
+    else if (platformID == 0)
+      score = 2;
+    else if (platformID == 1 && encodingID == 0)
+      score = languageID == 0 ? 1 : 0;
+
+    if (score > bestScore) {
+      bestScore = score;
+      best = &name[offset];
+      bestLength = length;
+      bestWide = platformID != 1;
+    }
+  }
+
+  std::string res;
+  if (!best)
+    return res;
+
+  if (!bestWide) {
+    // only the ASCII part of mac roman is the same in UTF-8
+    for (uint16_t i = 0; i < bestLength; i++) {
+      res.push_back(best[i] < 0x80 ? (char) best[i] : '?');
+    }
+
+    return res;
+  }
+
+  for (uint16_t i = 0; i + 1 < bestLength; i += 2) {
+    uint32_t c = readUInt16(best + i);
+    if (c >= 0xd800 && c < 0xdc00 && i + 3 < bestLength) {
+      uint32_t low = readUInt16(best + i + 2);
+      if (low >= 0xdc00 && low < 0xe000) {
+        c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+        i += 2;
+      }
+    }
+
+    appendUtf8(res, c);
+  }
+
+  return res;
+}
+
+// reads the table directory of a font file. for collections, this is the face
+// with the given postscript name, or the first face if there is no such face.
+static bool readFace(FontFile &file, const char *postscriptName, TableDirectory &tables) {
+  std::vector<uint8_t> header;
+  if (!file.isOpen() || !file.read(0, 12, header))
+    return false;
+
+  // collections have a header listing the offsets of their faces
+  if (readUInt32(&header[0]) != TAG('t', 't', 'c', 'f'))
+    return readTableDirectory(file, 0, tables);
+
+  uint32_t numFonts = readUInt32(&header[8]);
+  std::vector<uint8_t> offsets;
+  if (numFonts == 0 || numFonts > 0xffff || !file.read(12, numFonts * 4, offsets))
+    return false;
+
+  for (uint32_t i = 0; postscriptName && i < numFonts; i++) {
+    tables.clear();
+    if (readTableDirectory(file, readUInt32(&offsets[i * 4]), tables) && hasPostscriptName(file, tables, postscriptName))
+      return true;
+  }
+
+  tables.clear();
+  return readTableDirectory(file, readUInt32(&offsets[0]), tables);
+}
+
+// parses the metrics of a font file
+static FontMetrics *readFontMetrics(const char *path, const char *postscriptName) {
+  FontFile file(path);
+  TableDirectory tables;
+  if (!readFace(file, postscriptName, tables))
+    return NULL;
+
+  std::vector<uint8_t> head, hhea, os2, post;
+  if (!readTable(file, tables, TAG('h', 'e', 'a', 'd'), 54, head) || !readTable(file, tables, TAG('h', 'h', 'e', 'a'), 36, hhea))
+    return NULL;
+
+  FontMetrics *res = new FontMetrics();
+  res->unitsPerEm = readUInt16(&head[18]);
+  res->ascent = readInt16(&hhea[4]);
+  res->descent = readInt16(&hhea[6]);
+  res->lineGap = readInt16(&hhea[8]);
+  res->capHeight = 0;
+  res->xHeight = 0;
+  res->italicAngle = 0;
+
+  if (readTable(file, tables, TAG('O', 'S', '/', '2'), 78, os2)) {
+    // prefer the typographic metrics if the font asks for it, or if hhea has none
+    if ((readUInt16(&os2[62]) & USE_TYPO_METRICS) || (res->ascent == 0 && res->descent == 0)) {
+      res->ascent = readInt16(&os2[68]);
+      res->descent = readInt16(&os2[70]);
+      res->lineGap = readInt16(&os2[72]);
+    }
+
+    // cap height and x-height were added in version 2
+    if (readUInt16(&os2[0]) >= 2 && os2.size() >= 90) {
+      res->xHeight = readInt16(&os2[86]);
+      res->capHeight = readInt16(&os2[88]);
+    }
+  }
+
+  if (readTable(file, tables, TAG('p', 'o', 's', 't'), 8, post))
+    res->italicAngle = (int32_t) readUInt32(&post[4]) / 65536.0;
+
+  return res;
+}
+
+// parses the fvar table of a font file
+static FontVariations *readFontVariations(const char *path, const char *postscriptName) {
+  FontFile file(path);
+  TableDirectory tables;
+  if (!readFace(file, postscriptName, tables))
+    return NULL;
+
+  FontVariations *res = new FontVariations();
+  std::vector<uint8_t> fvar, name;
+  if (!readTable(file, tables, TAG('f', 'v', 'a', 'r'), 16, fvar))
+    return res;
+
+  readTable(file, tables, TAG('n', 'a', 'm', 'e'), 6, name);
+
+  uint16_t axesOffset = readUInt16(&fvar[4]);
+  uint16_t axisCount = readUInt16(&fvar[8]);
+  uint16_t axisSize = readUInt16(&fvar[10]);
+  uint16_t instanceCount = readUInt16(&fvar[12]);
+  uint16_t instanceSize = readUInt16(&fvar[14]);
+  if (axisSize < 20 || instanceSize < 4 + axisCount * 4 || axesOffset + (size_t) axisCount * axisSize > fvar.size())
+    return res;
+
+  for (uint16_t i = 0; i < axisCount; i++) {
+    const uint8_t *record = &fvar[axesOffset + i * axisSize];
+    FontAxis axis;
+    for (int j = 0; j < 4; j++) {
+      axis.tag[j] = (char) record[j];
+    }
+
+    axis.tag[4] = '\0';
+    axis.min = (int32_t) readUInt32(record + 4) / 65536.0;
+    axis.defaultValue = (int32_t) readUInt32(record + 8) / 65536.0;
+    axis.max = (int32_t) readUInt32(record + 12) / 65536.0;
+    axis.hidden = (readUInt16(record + 16) & 0x0001) != 0;
+    axis.name = readName(name, readUInt16(record + 18));
+    res->axes.push_back(axis);
+  }
+
+  // instances follow the axes, and may end with the name ID of a postscript name
+  size_t instancesOffset = axesOffset + (size_t) axisCount * axisSize;
+  bool hasPostscriptNames = instanceSize >= 6 + axisCount * 4;
+  for (uint16_t i = 0; i < instanceCount && instancesOffset + (size_t) (i + 1) * instanceSize <= fvar.size(); i++) {
+    const uint8_t *record = &fvar[instancesOffset + i * instanceSize];
+    FontInstance instance;
+    instance.name = readName(name, readUInt16(record));
+    for (uint16_t j = 0; j < axisCount; j++) {
+      instance.coordinates.push_back((int32_t) readUInt32(record + 4 + j * 4) / 65536.0);
+    }
+
+    if (hasPostscriptNames) {
+      uint16_t nameID = readUInt16(record + 4 + axisCount * 4);
+      if (nameID != 0xffff)
+        instance.postscriptName = readName(name, nameID);
+    }
+
+    res->instances.push_back(instance);
+  }
+
+  return res;
+}
+
+// reads the character map subtable at the given offset into the glyph metrics.
+// returns false if the format is not supported.
+static bool readCharacterMap(const std::vector<uint8_t> &cmap, uint32_t offset, GlyphMetrics *res) {
+  size_t size = cmap.size();
+  if ((uint64_t) offset + 4 > size)
+    return false;
+
+  const uint8_t *table = &cmap[offset];
+  switch (readUInt16(table)) {
+    case 0: {
+      if ((uint64_t) offset + 262 > size)
+        return false;
+
+      for (uint32_t c = 0; c < 256; c++) {
+        res->setGlyph(c, table[6 + c]);
+      }
+
+      return true;
+    }
+
+    case 4: {
+      if ((uint64_t) offset + 14 > size)
+        return false;
+
+      uint32_t segCount = readUInt16(table + 6) / 2;
+      if ((uint64_t) offset + 16 + segCount * 8 > size)
+        return false;
+
+      const uint8_t *endCodes = table + 14;
+      const uint8_t *startCodes = endCodes + segCount * 2 + 2;
+      const uint8_t *idDeltas = startCodes + segCount * 2;
+      const uint8_t *idRangeOffsets = idDeltas + segCount * 2;
+
+      for (uint32_t i = 0; i < segCount; i++) {
+        uint32_t start = readUInt16(startCodes + i * 2);
+        uint32_t end = readUInt16(endCodes + i * 2);
+        uint16_t delta = readUInt16(idDeltas + i * 2);
+        uint16_t rangeOffset = readUInt16(idRangeOffsets + i * 2);
+
+        for (uint32_t c = start; c <= end && c != 0xffff; c++) {
+          uint16_t glyph = 0;
+          if (rangeOffset == 0) {
+            glyph = (uint16_t) (c + delta);
+          } else {
+            // the offset is relative to the idRangeOffset entry itself
+            size_t glyphOffset = (idRangeOffsets + i * 2 - &cmap[0]) + rangeOffset + (c - start) * 2;
+            if (glyphOffset + 2 > size)
+              break;
+
+            glyph = readUInt16(&cmap[glyphOffset]);
+            if (glyph != 0)
+              glyph = (uint16_t) (glyph + delta);
+          }
+
+          res->setGlyph(c, glyph);
+        }
+      }
+
+      return true;
+    }
+
+    case 6: {
+      if ((uint64_t) offset + 10 > size)
+        return false;
+
+      uint32_t first = readUInt16(table + 6);
+      uint32_t count = readUInt16(table + 8);
+      for (uint32_t i = 0; i < count && (uint64_t) offset + 12 + i * 2 <= size; i++) {
+        res->setGlyph(first + i, readUInt16(table + 10 + i * 2));
+      }
+
+      return true;
+    }
+
+    case 12: {
+      if ((uint64_t) offset + 16 > size)
+        return false;
+
+      uint32_t numGroups = readUInt32(table + 12);
+      for (uint32_t i = 0; i < numGroups && (uint64_t) offset + 16 + (uint64_t) (i + 1) * 12 <= size; i++) {
+        const uint8_t *group = table + 16 + i * 12;
+        uint32_t start = readUInt32(group);
+        uint32_t end = std::min(readUInt32(group + 4), (uint32_t) MAX_CODEPOINT);
+        uint32_t glyph = readUInt32(group + 8);
+        for (uint32_t c = start; c <= end && glyph + (c - start) <= 0xffff; c++) {
+          res->setGlyph(c, (uint16_t) (glyph + (c - start)));
+        }
+      }
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// picks the best unicode subtable from the cmap table and reads it
+static bool readCharacterMap(const std::vector<uint8_t> &cmap, GlyphMetrics *res) {
+  if (cmap.size() < 4)
+    return false;
+
+  // prefer full unicode tables, then BMP tables, then symbol and mac roman ones
+  int bestScore = 0;
+  uint32_t bestOffset = 0;
+  uint16_t numTables = readUInt16(&cmap[2]);
+  for (uint16_t i = 0; i < numTables && 4 + (size_t) (i + 1) * 8 <= cmap.size(); i++) {
+    const uint8_t *record = &cmap[4 + i * 8];
+    uint16_t platformID = readUInt16(record);
+    uint16_t encodingID = readUInt16(record + 2);
+    uint32_t offset = readUInt32(record + 4);
+    if ((uint64_t) offset + 2 > cmap.size())
+      continue;
+
+    uint16_t format = readUInt16(&cmap[offset]);
+    int score = 0;
+    if ((platformID == 3 && encodingID == 10) || (platformID == 0 && format == 12))
+      score = 5;
+    else if ((platformID == 3 && encodingID == 1) || platformID == 0)
+      score = 4;
+    else if (platformID == 3 && encodingID == 0)
+      score = 3;
+    else if (platformID == 1 && encodingID == 0)
+      score = 2;
+
+    if (score > bestScore) {
+      bestScore = score;
+      bestOffset = offset;
+    }
+  }
+
+  if (!bestScore || !readCharacterMap(cmap, bestOffset, res))
+    return false;
+
+  // symbol fonts map their characters into the private use area at U+F000
+  if (bestScore == 3) {
+    for (uint32_t c = 0; c < 256; c++) {
+      if (!res->glyph(c))
+        res->setGlyph(c, res->glyph(0xf000 + c));
+    }
+  }
+
+  return true;
+}
+
+// the size of a GPOS value record with the given format
+static uint32_t valueRecordSize(uint16_t format) {
+  uint32_t size = 0;
+  for (; format; format >>= 1) {
+    size += (format & 1) * 2;
+  }
+
+  return size;
+}
+
+// reads the x advance from a GPOS value record, if it has one
+static int16_t readXAdvance(const uint8_t *record, uint16_t format) {
+  if (!(format & 0x0004))
+    return 0;
+
+  return readInt16(record + valueRecordSize(format & 0x0003));
+}
+
+// reads the glyphs in a coverage table, in coverage index order
+static bool readCoverage(const std::vector<uint8_t> &table, uint32_t offset, std::vector<uint16_t> &glyphs) {
+  size_t size = table.size();
+  if ((uint64_t) offset + 4 > size)
+    return false;
+
+  uint16_t format = readUInt16(&table[offset]);
+  uint16_t count = readUInt16(&table[offset + 2]);
+  if (format == 1) {
+    for (uint16_t i = 0; i < count && (uint64_t) offset + 4 + (i + 1) * 2 <= size; i++) {
+      glyphs.push_back(readUInt16(&table[offset + 4 + i * 2]));
+    }
+
+    return true;
+  }
+
+  if (format == 2) {
+    for (uint16_t i = 0; i < count && (uint64_t) offset + 4 + (i + 1) * 6 <= size; i++) {
+      const uint8_t *range = &table[offset + 4 + i * 6];
+      for (uint32_t glyph = readUInt16(range); glyph <= readUInt16(range + 2); glyph++) {
+        glyphs.push_back((uint16_t) glyph);
+      }
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+// reads a class definition table into a class for each glyph
+static void readClassDef(const std::vector<uint8_t> &table, uint32_t offset, std::vector<uint16_t> &classes) {
+  size_t size = table.size();
+  if ((uint64_t) offset + 6 > size)
+    return;
+
+  uint16_t format = readUInt16(&table[offset]);
+  if (format == 1) {
+    uint32_t start = readUInt16(&table[offset + 2]);
+    uint16_t count = readUInt16(&table[offset + 4]);
+    for (uint16_t i = 0; i < count && start + i < classes.size() && (uint64_t) offset + 6 + (i + 1) * 2 <= size; i++) {
+      classes[start + i] = readUInt16(&table[offset + 6 + i * 2]);
+    }
+  } else if (format == 2) {
+    uint16_t count = readUInt16(&table[offset + 2]);
+    for (uint16_t i = 0; i < count && (uint64_t) offset + 4 + (i + 1) * 6 <= size; i++) {
+      const uint8_t *range = &table[offset + 4 + i * 6];
+      uint16_t value = readUInt16(range + 4);
+      for (uint32_t glyph = readUInt16(range); glyph <= readUInt16(range + 2) && glyph < classes.size(); glyph++) {
+        classes[glyph] = value;
+      }
+    }
+  }
+}
+
+// reads a GPOS pair adjustment subtable at the given offset
+static void readPairAdjustment(const std::vector<uint8_t> &gpos, uint32_t offset, GlyphMetrics *res) {
+  size_t size = gpos.size();
+  if ((uint64_t) offset + 10 > size)
+    return;
+
+  const uint8_t *table = &gpos[offset];
+  uint16_t format = readUInt16(table);
+  uint16_t valueFormat1 = readUInt16(table + 4);
+  uint16_t valueFormat2 = readUInt16(table + 6);
+  uint32_t size1 = valueRecordSize(valueFormat1);
+  uint32_t size2 = valueRecordSize(valueFormat2);
+
+  // pairs that only position the second glyph don't change the advance
+  if (!(valueFormat1 & 0x0004))
+    return;
+
+  std::vector<uint16_t> coverage;
+  if (!readCoverage(gpos, offset + readUInt16(table + 2), coverage))
+    return;
+
+  KerningSubtable subtable;
+  subtable.classCount = 0;
+
+  if (format == 1) {
+    uint16_t pairSetCount = readUInt16(table + 8);
+    for (uint16_t i = 0; i < pairSetCount && i < coverage.size() && (uint64_t) offset + 10 + (i + 1) * 2 <= size; i++) {
+      uint64_t pairSet = (uint64_t) offset + readUInt16(table + 10 + i * 2);
+      if (pairSet + 2 > size)
+        continue;
+
+      uint16_t count = readUInt16(&gpos[pairSet]);
+      uint32_t recordSize = 2 + size1 + size2;
+      for (uint16_t j = 0; j < count && pairSet + 2 + (uint64_t) (j + 1) * recordSize <= size; j++) {
+        const uint8_t *record = &gpos[pairSet + 2 + j * recordSize];
+        subtable.pairs.insert(std::make_pair((uint32_t) coverage[i] << 16 | readUInt16(record), readXAdvance(record + 2, valueFormat1)));
+      }
+    }
+  } else if (format == 2) {
+    if ((uint64_t) offset + 16 > size)
+      return;
+
+    uint16_t class1Count = readUInt16(table + 12);
+    uint16_t class2Count = readUInt16(table + 14);
+    uint32_t recordSize = size1 + size2;
+    if ((uint64_t) offset + 16 + (uint64_t) class1Count * class2Count * recordSize > size)
+      return;
+
+    subtable.classCount = class2Count;
+    subtable.classes1.resize(res->numGlyphs(), 0);
+    subtable.classes2.resize(res->numGlyphs(), 0);
+    readClassDef(gpos, offset + readUInt16(table + 8), subtable.classes1);
+    readClassDef(gpos, offset + readUInt16(table + 10), subtable.classes2);
+
+    subtable.values.resize(class1Count * class2Count);
+    for (uint32_t i = 0; i < subtable.values.size(); i++) {
+      subtable.values[i] = readXAdvance(table + 16 + i * recordSize, valueFormat1);
+    }
+
+    // clamp classes so lookups never read outside the matrix
+    for (size_t i = 0; i < subtable.classes1.size(); i++) {
+      if (subtable.classes1[i] >= class1Count)
+        subtable.classes1[i] = 0;
+
+      if (subtable.classes2[i] >= class2Count)
+        subtable.classes2[i] = 0;
+    }
+  } else {
+    return;
+  }
+
+  subtable.coverage.resize(res->numGlyphs(), false);
+  for (size_t i = 0; i < coverage.size(); i++) {
+    if (coverage[i] < subtable.coverage.size())
+      subtable.coverage[coverage[i]] = true;
+  }
+
+  res->addKerning(subtable);
+}
+
+// reads the pair adjustments of the kern feature from a GPOS table.
+// returns false if the table has no kern feature.
+static bool readGlyphPositioning(const std::vector<uint8_t> &gpos, GlyphMetrics *res) {
+  size_t size = gpos.size();
+  if (size < 10)
+    return false;
+
+  uint32_t scriptList = readUInt16(&gpos[4]);
+  uint32_t featureList = readUInt16(&gpos[6]);
+  uint32_t lookupList = readUInt16(&gpos[8]);
+  if (scriptList + 2 > size || featureList + 2 > size || lookupList + 2 > size)
+    return false;
+
+  // use the default language of the default script, or latin, or whatever comes first
+  uint32_t langSys = 0;
+  uint16_t scriptCount = readUInt16(&gpos[scriptList]);
+  for (uint16_t i = 0; i < scriptCount && scriptList + 2 + (size_t) (i + 1) * 6 <= size; i++) {
+    const uint8_t *record = &gpos[scriptList + 2 + i * 6];
+    uint32_t tag = readUInt32(record);
+    uint32_t script = scriptList + readUInt16(record + 4);
+    if (script + 2 > size || !readUInt16(&gpos[script]))
+      continue;
+
+    if (!langSys || tag == TAG('D', 'F', 'L', 'T') || tag == TAG('l', 'a', 't', 'n'))
+      langSys = script + readUInt16(&gpos[script]);
+
+    if (tag == TAG('D', 'F', 'L', 'T'))
+      break;
+  }
+
+  if (!langSys || langSys + 6 > size)
+    return false;
+
+  std::vector<uint16_t> lookups;
+  uint16_t featureCount = readUInt16(&gpos[featureList]);
+  uint16_t featureIndexCount = readUInt16(&gpos[langSys + 4]);
+  for (uint16_t i = 0; i < featureIndexCount && langSys + 6 + (size_t) (i + 1) * 2 <= size; i++) {
+    uint16_t feature = readUInt16(&gpos[langSys + 6 + i * 2]);
+    if (feature >= featureCount || featureList + 2 + (size_t) (feature + 1) * 6 > size)
+      continue;
+
+    const uint8_t *record = &gpos[featureList + 2 + feature * 6];
+    uint32_t table = featureList + readUInt16(record + 4);
+    if (readUInt32(record) != TAG('k', 'e', 'r', 'n') || table + 4 > size)
+      continue;
+
+    uint16_t lookupCount = readUInt16(&gpos[table + 2]);
+    for (uint16_t j = 0; j < lookupCount && table + 4 + (size_t) (j + 1) * 2 <= size; j++) {
+      lookups.push_back(readUInt16(&gpos[table + 4 + j * 2]));
+    }
+  }
+
+  if (lookups.empty())
+    return false;
+
+  std::sort(lookups.begin(), lookups.end());
+  lookups.erase(std::unique(lookups.begin(), lookups.end()), lookups.end());
+
+  uint16_t lookupCount = readUInt16(&gpos[lookupList]);
+  for (size_t i = 0; i < lookups.size(); i++) {
+    if (lookups[i] >= lookupCount || lookupList + 2 + (size_t) (lookups[i] + 1) * 2 > size)
+      continue;
+
+    uint32_t lookup = lookupList + readUInt16(&gpos[lookupList + 2 + lookups[i] * 2]);
+    if (lookup + 6 > size)
+      continue;
+
+    uint16_t type = readUInt16(&gpos[lookup]);
+    uint16_t subtableCount = readUInt16(&gpos[lookup + 4]);
+    for (uint16_t j = 0; j < subtableCount && lookup + 6 + (size_t) (j + 1) * 2 <= size; j++) {
+      uint32_t subtable = lookup + readUInt16(&gpos[lookup + 6 + j * 2]);
+
+      // extension subtables point to the real subtable with a 32 bit offset,
+      // which must not wrap around
+      if (type == 9 && (uint64_t) subtable + 8 <= size && readUInt16(&gpos[subtable + 2]) == 2) {
+        uint64_t extension = (uint64_t) subtable + readUInt32(&gpos[subtable + 4]);
+        if (extension < size)
+          readPairAdjustment(gpos, (uint32_t) extension, res);
+      } else if (type == 2) {
+        readPairAdjustment(gpos, subtable, res);
+      }
+    }
+  }
+
+  return true;
+}
+
+// reads the horizontal pairs from a version 0 kern table
+static void readKerning(const std::vector<uint8_t> &kern, GlyphMetrics *res) {
+  size_t size = kern.size();
+  if (size < 4 || readUInt16(&kern[0]) != 0)
+    return;
+
+  KerningSubtable subtable;
+  subtable.classCount = 0;
+  subtable.coverage.resize(res->numGlyphs(), false);
+
+  uint16_t numTables = readUInt16(&kern[2]);
+  uint32_t offset = 4;
+  for (uint16_t i = 0; i < numTables && (uint64_t) offset + 14 <= size; i++) {
+    uint16_t length = readUInt16(&kern[offset + 2]);
+    uint16_t coverage = readUInt16(&kern[offset + 4]);
+
+    // only format 0 subtables with horizontal kerning values
+    if ((coverage & 0xff07) == 0x0001) {
+      uint16_t nPairs = readUInt16(&kern[offset + 6]);
+      for (uint16_t j = 0; j < nPairs && offset + 14 + (size_t) (j + 1) * 6 <= size; j++) {
+        const uint8_t *pair = &kern[offset + 14 + j * 6];
+        uint16_t left = readUInt16(pair);
+        subtable.pairs.insert(std::make_pair((uint32_t) left << 16 | readUInt16(pair + 2), readInt16(pair + 4)));
+        if (left < subtable.coverage.size())
+          subtable.coverage[left] = true;
+      }
+    }
+
+    if (length < 14)
+      break;
+
+    offset += length;
+  }
+
+  if (!subtable.pairs.empty())
+    res->addKerning(subtable);
+}
+
+// parses the glyph metrics of a font file
+static GlyphMetrics *readGlyphMetrics(const char *path, const char *postscriptName) {
+  FontFile file(path);
+  TableDirectory tables;
+  if (!readFace(file, postscriptName, tables))
+    return NULL;
+
+  std::vector<uint8_t> head, hhea, maxp, hmtx, cmap, table;
+  if (!readTable(file, tables, TAG('h', 'e', 'a', 'd'), 54, head) ||
+      !readTable(file, tables, TAG('h', 'h', 'e', 'a'), 36, hhea) ||
+      !readTable(file, tables, TAG('m', 'a', 'x', 'p'), 6, maxp) ||
+      !readTable(file, tables, TAG('h', 'm', 't', 'x'), 4, hmtx) ||
+      !readTable(file, tables, TAG('c', 'm', 'a', 'p'), 4, cmap))
+    return NULL;
+
+  uint16_t numGlyphs = readUInt16(&maxp[4]);
+  uint16_t numberOfHMetrics = readUInt16(&hhea[34]);
+  if (numGlyphs == 0 || numberOfHMetrics == 0 || hmtx.size() < numberOfHMetrics * 4u)
+    return NULL;
+
+  // glyphs after the last long metric all have its advance
+  std::vector<uint16_t> advances(numGlyphs);
+  for (uint32_t i = 0; i < numGlyphs; i++) {
+    advances[i] = readUInt16(&hmtx[std::min(i, (uint32_t) numberOfHMetrics - 1) * 4]);
+  }
+
+  GlyphMetrics *res = new GlyphMetrics(readUInt16(&head[18]), advances);
+  if (!readCharacterMap(cmap, res)) {
+    delete res;
+    return NULL;
+  }
+
+  if (!readTable(file, tables, TAG('G', 'P', 'O', 'S'), 10, table) || !readGlyphPositioning(table, res)) {
+    if (readTable(file, tables, TAG('k', 'e', 'r', 'n'), 4, table))
+      readKerning(table, res);
+  }
+
+  return res;
+}
+
+GlyphMetrics::GlyphMetrics(uint16_t unitsPerEm, std::vector<uint16_t> &advances) {
+  this->unitsPerEm = unitsPerEm;
+  this->advances.swap(advances);
+  pages.resize((MAX_CODEPOINT >> 8) + 1, 0);
+
+  // page 0 is shared by all pages without any glyphs
+  glyphs.resize(256, 0);
+}
+
+void GlyphMetrics::setGlyph(uint32_t codepoint, uint16_t glyph) {
+  if (codepoint > MAX_CODEPOINT || glyph == 0 || glyph >= advances.size())
+    return;
+
+  uint32_t &page = pages[codepoint >> 8];
+  if (page == 0) {
+    page = glyphs.size() >> 8;
+    glyphs.resize(glyphs.size() + 256, 0);
+  }
+
+  glyphs[page << 8 | (codepoint & 0xff)] = glyph;
+}
+
+void GlyphMetrics::addKerning(KerningSubtable &subtable) {
+  if (kerned.empty())
+    kerned.resize(advances.size(), false);
+
+  for (size_t i = 0; i < subtable.coverage.size(); i++) {
+    if (subtable.coverage[i])
+      kerned[i] = true;
+  }
+
+  kerning.push_back(std::move(subtable));
+}
+
+int32_t GlyphMetrics::kern(uint16_t left, uint16_t right) const {
+  if (left >= kerned.size() || !kerned[left])
+    return 0;
+
+  // like a GPOS lookup, the first subtable that has the pair applies
+  for (size_t i = 0; i < kerning.size(); i++) {
+    const KerningSubtable &subtable = kerning[i];
+    if (!subtable.coverage[left])
+      continue;
+
+    if (subtable.classCount)
+      return subtable.values[subtable.classes1[left] * subtable.classCount + subtable.classes2[right]];
+
+    std::unordered_map<uint32_t, int16_t>::const_iterator it = subtable.pairs.find((uint32_t) left << 16 | right);
+    if (it != subtable.pairs.end())
+      return it->second;
+  }
+
+  return 0;
+}
+
+// decodes the next codepoint of a UTF-8 string, returning U+FFFD for invalid sequences
+static inline uint32_t nextCodepoint(const uint8_t *&p, const uint8_t *end) {
+  uint32_t c = *p++;
+  if (c < 0x80)
+    return c;
+
+  int length = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+  if (length == 0 || end - p < length)
+    return 0xfffd;
+
+  c &= 0x3f >> length;
+  for (int i = 0; i < length; i++) {
+    c = c << 6 | (*p++ & 0x3f);
+  }
+
+  return c;
+}
+
+double GlyphMetrics::measure(const char *text, size_t length, double size, bool kerning, std::vector<float> *output) const {
+  const uint8_t *p = (const uint8_t *) text;
+  const uint8_t *end = p + length;
+  double scale = unitsPerEm ? size / unitsPerEm : 0;
+  int64_t width = 0;
+  int32_t previousAdvance = 0;
+  uint16_t previous = 0;
+  bool first = true;
+
+  while (p < end) {
+    uint16_t glyph = this->glyph(nextCodepoint(p, end));
+    int32_t advance = advances[glyph];
+
+    // kerning adjusts the advance of the first glyph of each pair
+    if (kerning && !first) {
+      int32_t adjustment = kern(previous, glyph);
+      width += adjustment;
+      if (output)
+        output->back() = (float) ((previousAdvance + adjustment) * scale);
+    }
+
+    width += advance;
+    if (output)
+      output->push_back((float) (advance * scale));
+
+    previous = glyph;
+    previousAdvance = advance;
+    first = false;
+  }
+
+  return width * scale;
+}
+
+// a value cached for a font file, along with the version of the file it was read from
+template<typename T>
+struct CachedFileEntry {
+  int64_t mtime;
+  int64_t size;
+  std::shared_ptr<const T> value;
+};
+
+// gets the modification time and size of a file, to tell whether it changed
+static bool getFileVersion(const char *path, int64_t *mtime, int64_t *size) {
+#ifdef _WIN32
+  int len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+  std::vector<wchar_t> wpath(len);
+  MultiByteToWideChar(CP_UTF8, 0, path, -1, &wpath[0], len);
+  struct _stat64 st;
+  if (_wstat64(&wpath[0], &st) != 0)
+    return false;
+#else
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return false;
+#endif
+
+  *mtime = st.st_mtime;
+  *size = st.st_size;
+  return true;
+}
+
+// caches values read from font files by path and postscript name until the
+// file is modified. lookups share the lock, which is not held while reading files.
+template<typename T, size_t limit>
+class FileCache {
+public:
+  FileCache() {
+    uv_rwlock_init(&lock);
+  }
+
+  std::shared_ptr<const T> get(const char *path, const char *postscriptName, T *(*read)(const char *, const char *)) {
+    int64_t mtime, size;
+    if (!path || !getFileVersion(path, &mtime, &size))
+      return std::shared_ptr<const T>();
+
+    std::string key(path);
+    key.push_back('\0');
+    if (postscriptName)
+      key.append(postscriptName);
+
+    uv_rwlock_rdlock(&lock);
+    typename std::unordered_map<std::string, CachedFileEntry<T> >::iterator it = entries.find(key);
+    if (it != entries.end() && it->second.mtime == mtime && it->second.size == size) {
+      std::shared_ptr<const T> res = it->second.value;
+      uv_rwlock_rdunlock(&lock);
+      return res;
+    }
+
+    uv_rwlock_rdunlock(&lock);
+
+    std::shared_ptr<const T> res(read(path, postscriptName));
+
+    uv_rwlock_wrlock(&lock);
+    if (entries.size() >= limit && entries.find(key) == entries.end())
+      entries.erase(entries.begin());
+
+    CachedFileEntry<T> &entry = entries[key];
+    entry.mtime = mtime;
+    entry.size = size;
+    entry.value = res;
+    uv_rwlock_wrunlock(&lock);
+    return res;
+  }
+
+private:
+  uv_rwlock_t lock;
+  std::unordered_map<std::string, CachedFileEntry<T> > entries;
+};
+
+static uv_once_t cacheOnce = UV_ONCE_INIT;
+static FileCache<FontMetrics, MAX_CACHED_METRICS> *metricsCache;
+static FileCache<GlyphMetrics, MAX_CACHED_GLYPH_METRICS> *glyphMetricsCache;
+static FileCache<FontVariations, MAX_CACHED_METRICS> *variationsCache;
+
+static void initCaches() {
+  metricsCache = new FileCache<FontMetrics, MAX_CACHED_METRICS>();
+  glyphMetricsCache = new FileCache<GlyphMetrics, MAX_CACHED_GLYPH_METRICS>();
+  variationsCache = new FileCache<FontVariations, MAX_CACHED_METRICS>();
+}
+
+std::shared_ptr<const FontMetrics> getFontMetrics(const char *path, const char *postscriptName) {
+  uv_once(&cacheOnce, initCaches);
+  return metricsCache->get(path, postscriptName, readFontMetrics);
+}
+
+std::shared_ptr<const GlyphMetrics> getGlyphMetrics(const char *path, const char *postscriptName) {
+  uv_once(&cacheOnce, initCaches);
+  return glyphMetricsCache->get(path, postscriptName, readGlyphMetrics);
+}
+
+std::shared_ptr<const FontVariations> getFontVariations(const char *path, const char *postscriptName) {
+  uv_once(&cacheOnce, initCaches);
+  return variationsCache->get(path, postscriptName, readFontVariations);
+}
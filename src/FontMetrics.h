@@ -0,0 +1,108 @@
+#ifndef FONT_METRICS_H
+#define FONT_METRICS_H
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// vertical metrics of a font, in font units
+struct FontMetrics {
+  uint16_t unitsPerEm;
+  int16_t ascent;
+  int16_t descent;
+  int16_t lineGap;
+  int16_t capHeight;
+  int16_t xHeight;
+  double italicAngle;
+};
+
+// Reads the metrics of a font from the head, hhea, OS/2 and post tables of
+// its file, without loading the rest of it. For font collections, the face
+// with the given postscript name (which may be NULL) is used, or the first
+// one if there is no such face. Results are cached by path until the file
+// is modified. Returns NULL if the file can't be read or is not a TrueType
+// or OpenType font.
+std::shared_ptr<const FontMetrics> getFontMetrics(const char *path, const char *postscriptName);
+
+// an axis of a variable font
+struct FontAxis {
+  char tag[5];
+  std::string name;
+  double min;
+  double defaultValue;
+  double max;
+  bool hidden;  // whether the axis is meant to be hidden from users
+};
+
+// a named instance of a variable font
+struct FontInstance {
+  std::string name;
+  std::string postscriptName;       // empty if the font does not name its instances
+  std::vector<double> coordinates;  // the position on each axis
+};
+
+// the axes and named instances of a variable font, from its fvar table
+struct FontVariations {
+  std::vector<FontAxis> axes;
+  std::vector<FontInstance> instances;
+};
+
+// Reads the axes and named instances of a font, for the face with the given
+// postscript name like getFontMetrics. Static fonts have no axes. Results
+// are cached by path until the file is modified. Returns NULL if the file
+// can't be read or is not a TrueType or OpenType font.
+std::shared_ptr<const FontVariations> getFontVariations(const char *path, const char *postscriptName);
+
+// the pair adjustments from one kern table or GPOS subtable
+struct KerningSubtable {
+  std::vector<bool> coverage;         // the first glyphs of the pairs in the subtable
+  std::unordered_map<uint32_t, int16_t> pairs; // adjustments by (first glyph << 16 | second glyph)
+  std::vector<uint16_t> classes1;     // class of each glyph for class based adjustments
+  std::vector<uint16_t> classes2;     // ditto for the second glyph
+  std::vector<int16_t> values;        // adjustments by class1 * classCount + class2
+  uint16_t classCount;                // the number of second glyph classes, or 0 for pairs
+};
+
+// the horizontal glyph metrics of a font, from its cmap, hmtx and GPOS or kern tables
+class GlyphMetrics {
+public:
+  GlyphMetrics(uint16_t unitsPerEm, std::vector<uint16_t> &advances);
+
+  // returns the glyph for a codepoint, or 0 (.notdef) if the font does not have one
+  uint16_t glyph(uint32_t codepoint) const {
+    return codepoint <= 0x10ffff ? glyphs[pages[codepoint >> 8] << 8 | (codepoint & 0xff)] : 0;
+  }
+
+  // returns the kerning adjustment between two glyphs, in font units
+  int32_t kern(uint16_t left, uint16_t right) const;
+
+  // measures the width of UTF-8 text at the given font size. the advance of
+  // each codepoint (including the kerning with the next one) is appended to
+  // output, if given.
+  double measure(const char *text, size_t length, double size, bool kerning, std::vector<float> *output) const;
+
+  uint16_t numGlyphs() const {
+    return advances.size();
+  }
+
+  void setGlyph(uint32_t codepoint, uint16_t glyph);
+  void addKerning(KerningSubtable &subtable);
+
+  uint16_t unitsPerEm;
+
+private:
+  std::vector<uint16_t> advances;     // advance of each glyph
+  std::vector<uint32_t> pages;        // index into glyphs for each block of 256 codepoints
+  std::vector<uint16_t> glyphs;       // glyph of each codepoint, 256 at a time
+  std::vector<bool> kerned;           // whether a glyph is the first glyph of any pair
+  std::vector<KerningSubtable> kerning;
+};
+
+// Reads the glyph metrics of a font, for the face with the given postscript
+// name like getFontMetrics. Results are cached by path until the file is
+// modified. Returns NULL if the file can't be read or has no unicode cmap.
+std::shared_ptr<const GlyphMetrics> getGlyphMetrics(const char *path, const char *postscriptName);
+
+#endif
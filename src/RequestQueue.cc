@@ -0,0 +1,46 @@
+#include "RequestQueue.h"
+
+RequestQueue::RequestQueue() {
+  sequence = 0;
+  uv_mutex_init(&mutex);
+}
+
+RequestQueue::~RequestQueue() {
+  uv_mutex_destroy(&mutex);
+}
+
+void RequestQueue::push(void *request, int priority) {
+  uv_mutex_lock(&mutex);
+  Entry entry;
+  entry.priority = priority;
+  entry.sequence = sequence++;
+  entry.request = request;
+  positions[request] = entries.insert(entry).first;
+  uv_mutex_unlock(&mutex);
+}
+
+void *RequestQueue::pop() {
+  uv_mutex_lock(&mutex);
+  void *res = NULL;
+  if (!entries.empty()) {
+    res = entries.begin()->request;
+    entries.erase(entries.begin());
+    positions.erase(res);
+  }
+
+  uv_mutex_unlock(&mutex);
+  return res;
+}
+
+bool RequestQueue::remove(void *request) {
+  uv_mutex_lock(&mutex);
+  std::unordered_map<void *, EntrySet::iterator>::iterator it = positions.find(request);
+  bool found = it != positions.end();
+  if (found) {
+    entries.erase(it->second);
+    positions.erase(it);
+  }
+
+  uv_mutex_unlock(&mutex);
+  return found;
+}
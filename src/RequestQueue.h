@@ -0,0 +1,48 @@
+#ifndef REQUEST_QUEUE_H
+#define REQUEST_QUEUE_H
+#include <stdint.h>
+#include <set>
+#include <unordered_map>
+#include <uv.h>
+
+// A thread safe queue of requests waiting to run on the threadpool,
+// ordered by priority (highest first) and then by the order they were
+// added in. Requests can be removed before they run, e.g. when they are
+// cancelled while still waiting.
+class RequestQueue {
+public:
+  RequestQueue();
+  ~RequestQueue();
+
+  void push(void *request, int priority);
+
+  // removes and returns the request to run next, or NULL if there is none
+  void *pop();
+
+  // removes a request that has not run yet. returns false if it was not
+  // in the queue (it already started running).
+  bool remove(void *request);
+
+private:
+  struct Entry {
+    int priority;
+    uint64_t sequence;
+    void *request;
+
+    bool operator<(const Entry &other) const {
+      if (priority != other.priority)
+        return priority > other.priority;
+
+      return sequence < other.sequence;
+    }
+  };
+
+  typedef std::set<Entry> EntrySet;
+
+  EntrySet entries;
+  std::unordered_map<void *, EntrySet::iterator> positions;
+  uint64_t sequence;
+  uv_mutex_t mutex;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include "ResultCache.h"
+
+ResultCache::ResultCache(size_t maxEntries, size_t maxFonts) {
+  this->maxEntries = maxEntries;
+  this->maxFonts = maxFonts;
+  generation = 0;
+  fonts = 0;
+  hits = 0;
+  misses = 0;
+  evictions = 0;
+  invalidations = 0;
+  uv_mutex_init(&mutex);
+}
+
+ResultCache::~ResultCache() {
+  uv_mutex_destroy(&mutex);
+}
+
+// drops every entry when moving to a new generation. the mutex must be held.
+void ResultCache::invalidate(uint64_t generation) {
+  if (!entries.empty())
+    invalidations++;
+
+  entries.clear();
+  order.clear();
+  fonts = 0;
+  this->generation = generation;
+}
+
+// evicts the least recently used entries until the cache is within its
+// limits. the mutex must be held.
+void ResultCache::evict() {
+  while (!order.empty() && (entries.size() > maxEntries || fonts > maxFonts)) {
+    std::unordered_map<std::string, Entry>::iterator it = entries.find(order.back());
+    fonts -= it->second.results->size();
+    entries.erase(it);
+    order.pop_back();
+    evictions++;
+  }
+}
+
+std::shared_ptr<const ResultSet> ResultCache::get(const std::string &key, uint64_t generation, bool countMisses) {
+  uv_mutex_lock(&mutex);
+
+  // lookups from another generation miss without touching the cache. while
+  // the catalog is replaced, requests holding the previous version must not
+  // drop the entries of the new one.
+  std::shared_ptr<const ResultSet> res;
+  std::unordered_map<std::string, Entry>::iterator it = generation == this->generation ? entries.find(key) : entries.end();
+  if (it != entries.end()) {
+    order.splice(order.begin(), order, it->second.position);
+    res = it->second.results;
+    hits++;
+  } else if (countMisses) {
+    misses++;
+  }
+
+  uv_mutex_unlock(&mutex);
+  return res;
+}
+
+void ResultCache::put(const std::string &key, uint64_t generation, uint64_t current, const std::shared_ptr<const ResultSet> &results) {
+  uv_mutex_lock(&mutex);
+
+  // generations are only compared for equality, so results found in an
+  // earlier generation are not stored, and only results of the current one
+  // move the cache over to it
+  if (generation != current) {
+    uv_mutex_unlock(&mutex);
+    return;
+  }
+
+  if (generation != this->generation)
+    invalidate(generation);
+
+  if (maxEntries > 0 && results->size() <= maxFonts &&
+      entries.find(key) == entries.end()) {
+    order.push_front(key);
+    Entry &entry = entries[key];
+    entry.results = results;
+    entry.position = order.begin();
+    fonts += results->size();
+    evict();
+  }
+
+  uv_mutex_unlock(&mutex);
+}
+
+void ResultCache::setLimits(size_t maxEntries, size_t maxFonts) {
+  uv_mutex_lock(&mutex);
+  this->maxEntries = maxEntries;
+  this->maxFonts = maxFonts;
+  evict();
+  uv_mutex_unlock(&mutex);
+}
+
+ResultCacheStats ResultCache::stats() {
+  uv_mutex_lock(&mutex);
+  ResultCacheStats res;
+  res.hits = hits;
+  res.misses = misses;
+  res.evictions = evictions;
+  res.invalidations = invalidations;
+  res.entries = entries.size();
+  res.fonts = fonts;
+  res.maxEntries = maxEntries;
+  res.maxFonts = maxFonts;
+  uv_mutex_unlock(&mutex);
+  return res;
+}
+
+// appends a string field of a query to a key. missing fields are told
+// apart from empty ones, and fields are separated by a null character.
+static void appendField(std::string &key, const char *value) {
+  if (value) {
+    key.push_back('s');
+    key.append(value);
+  }
+
+  key.push_back('\0');
+}
+
+std::string getResultCacheKey(FontDescriptor *query, bool single) {
+  std::string key;
+  key.push_back(single ? '1' : '*');
+  appendField(key, query->postscriptName);
+  appendField(key, query->family);
+  appendField(key, query->style);
+  appendField(key, query->lang);
+  appendField(key, query->script);
+
+  char numbers[32];
+  snprintf(numbers, sizeof(numbers), "%d,%d,%d,%d", (int) query->weight, (int) query->width, query->italic, query->monospace);
+  key.append(numbers);
+  return key;
+}
+
+static uv_once_t cacheOnce = UV_ONCE_INIT;
+static ResultCache *cache;
+
+static void initCache() {
+  cache = new ResultCache(DEFAULT_CACHED_RESULTS, DEFAULT_CACHED_RESULT_FONTS);
+}
+
+ResultCache *getResultCache() {
+  uv_once(&cacheOnce, initCache);
+  return cache;
+}
@@ -0,0 +1,82 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <uv.h>
+#include "FontDescriptor.h"
+
+// the default limits of the result cache
+#define DEFAULT_CACHED_RESULTS 1024
+#define DEFAULT_CACHED_RESULT_FONTS 65536
+
+// what the result cache holds, and how often it was useful
+struct ResultCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;       // entries dropped to stay within the limits
+  uint64_t invalidations;   // times the whole cache was dropped because the fonts changed
+  size_t entries;
+  size_t fonts;             // the number of fonts in all entries
+  size_t maxEntries;
+  size_t maxFonts;
+};
+
+// A thread safe cache of the results of findFont and findFonts, keyed by
+// the fields of the query. Results belong to the catalog generation they
+// were found in. Lookups in any other generation miss, and the whole cache
+// is dropped when results of a new current generation are added. The least
+// recently used entries are evicted once there are more than maxEntries of
+// them, or they hold more than maxFonts fonts in total.
+class ResultCache {
+public:
+  ResultCache(size_t maxEntries, size_t maxFonts);
+  ~ResultCache();
+
+  // returns the cached results of a query in the given generation, or
+  // NULL. countMisses is false for lookups that are retried if they miss.
+  std::shared_ptr<const ResultSet> get(const std::string &key, uint64_t generation, bool countMisses);
+
+  // adds the results of a query that was made in the given generation, if
+  // it is still the current one. the cache moves over to it if needed.
+  void put(const std::string &key, uint64_t generation, uint64_t current, const std::shared_ptr<const ResultSet> &results);
+
+  // changes the limits, evicting entries if needed. a limit of 0 disables the cache.
+  void setLimits(size_t maxEntries, size_t maxFonts);
+
+  ResultCacheStats stats();
+
+private:
+  typedef std::list<std::string> KeyList;
+
+  struct Entry {
+    std::shared_ptr<const ResultSet> results;
+    KeyList::iterator position;   // in order
+  };
+
+  void invalidate(uint64_t generation);
+  void evict();
+
+  std::unordered_map<std::string, Entry> entries;
+  KeyList order;          // keys from the most to the least recently used
+  uint64_t generation;
+  size_t fonts;
+  size_t maxEntries;
+  size_t maxFonts;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t invalidations;
+  uv_mutex_t mutex;
+};
+
+// returns the key of a query in the result cache. single is true for
+// findFont, whose result is a single font rather than all the matches.
+std::string getResultCacheKey(FontDescriptor *query, bool single);
+
+// returns the result cache shared by the whole process
+ResultCache *getResultCache();
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include "SharedCatalog.h"
+#include "FontCatalog.h"
+
+#define SHARED_CATALOG_MAGIC 0x53434d46 // 'FMCS'
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SharedCatalog::SharedCatalog(const char *name, bool publish) {
+  // shared memory object names must start with a slash
+  this->name = name[0] == '/' ? name : std::string("/") + name;
+  publisher = publish;
+  control = NULL;
+}
+
+SharedCatalog::~SharedCatalog() {
+  if (control)
+    munmap(control, sizeof(SharedCatalogControl));
+}
+
+SharedCatalog *SharedCatalog::open(const char *name, bool publish) {
+  SharedCatalog *res = new SharedCatalog(name, publish);
+  int fd = shm_open(res->name.c_str(), publish ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+  if (fd < 0) {
+    delete res;
+    return NULL;
+  }
+
+  // some platforms only allow sizing a segment once, so only do it when it is new
+  struct stat st;
+  bool sized = fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(SharedCatalogControl);
+  if (!sized && (!publish || ftruncate(fd, sizeof(SharedCatalogControl)) != 0)) {
+    close(fd);
+    delete res;
+    return NULL;
+  }
+
+  void *addr = mmap(NULL, sizeof(SharedCatalogControl), publish ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (addr == MAP_FAILED) {
+    delete res;
+    return NULL;
+  }
+
+  res->control = (SharedCatalogControl *) addr;
+  if (publish && __atomic_load_n(&res->control->magic, __ATOMIC_ACQUIRE) != SHARED_CATALOG_MAGIC) {
+    res->control->generation = 0;
+    res->control->size = 0;
+    __atomic_store_n(&res->control->magic, SHARED_CATALOG_MAGIC, __ATOMIC_RELEASE);
+  }
+
+  if (__atomic_load_n(&res->control->magic, __ATOMIC_ACQUIRE) != SHARED_CATALOG_MAGIC) {
+    delete res;
+    return NULL;
+  }
+
+  return res;
+}
+
+std::string SharedCatalog::segmentName(unsigned int generation) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%u", generation);
+  return name + suffix;
+}
+
+unsigned int SharedCatalog::generation() {
+  return __atomic_load_n(&control->generation, __ATOMIC_ACQUIRE);
+}
+
+unsigned int SharedCatalog::publish(const char *data, size_t size) {
+  unsigned int previous = generation();
+  unsigned int next = previous + 1;
+  std::string segment = segmentName(next);
+
+  // remove anything left over from an earlier publisher that crashed
+  shm_unlink(segment.c_str());
+
+  int fd = shm_open(segment.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return 0;
+
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    shm_unlink(segment.c_str());
+    return 0;
+  }
+
+  void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (addr == MAP_FAILED) {
+    shm_unlink(segment.c_str());
+    return 0;
+  }
+
+  memcpy(addr, data, size);
+  ((CatalogHeader *) addr)->generation = next;
+  munmap(addr, size);
+
+  // readers only look at the new segment once the generation is bumped
+  control->size = size;
+  __atomic_store_n(&control->generation, next, __ATOMIC_RELEASE);
+
+  // readers that already mapped the old image keep it until they unmap it
+  if (previous)
+    shm_unlink(segmentName(previous).c_str());
+
+  return next;
+}
+
+const char *SharedCatalog::map() {
+  // the image may be replaced between reading the generation and opening
+  // it, in which case we simply try again with the newer generation
+  for (int attempt = 0; attempt < 3; attempt++) {
+    unsigned int current = generation();
+    if (current == 0)
+      return NULL;
+
+    int fd = shm_open(segmentName(current).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      continue;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return NULL;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED)
+      return NULL;
+
+    if (!FontCatalog::validate((const char *) addr, st.st_size)) {
+      munmap(addr, st.st_size);
+      return NULL;
+    }
+
+    return (const char *) addr;
+  }
+
+  return NULL;
+}
+
+void SharedCatalog::unmap(const char *data, size_t size) {
+  munmap((void *) data, size);
+}
+
+void SharedCatalog::unlink() {
+  unsigned int current = generation();
+  if (current)
+    shm_unlink(segmentName(current).c_str());
+
+  shm_unlink(name.c_str());
+}
+
+bool SharedCatalog::hasName(const char *name) {
+  return this->name == (name[0] == '/' ? name : std::string("/") + name);
+}
+
+#else
+
+// shared catalogs rely on POSIX shared memory, which windows does not have
+
+SharedCatalog::SharedCatalog(const char *name, bool publish) {
+  this->name = name;
+  publisher = publish;
+  control = NULL;
+}
+
+SharedCatalog::~SharedCatalog() {}
+
+SharedCatalog *SharedCatalog::open(const char *name, bool publish) {
+  return NULL;
+}
+
+std::string SharedCatalog::segmentName(unsigned int generation) {
+  return name;
+}
+
+unsigned int SharedCatalog::generation() {
+  return 0;
+}
+
+unsigned int SharedCatalog::publish(const char *data, size_t size) {
+  return 0;
+}
+
+const char *SharedCatalog::map() {
+  return NULL;
+}
+
+void SharedCatalog::unmap(const char *data, size_t size) {}
+
+void SharedCatalog::unlink() {}
+
+bool SharedCatalog::hasName(const char *name) {
+  return this->name == name;
+}
+
+#endif
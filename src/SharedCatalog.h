@@ -0,0 +1,56 @@
+#ifndef SHARED_CATALOG_H
+#define SHARED_CATALOG_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// the small segment readers poll to find the latest catalog image
+struct SharedCatalogControl {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t size;
+};
+
+// A catalog image published in POSIX shared memory. The name refers to a
+// control segment holding the current generation, and each generation of
+// the image lives in its own segment (name.generation) that is written
+// completely before the generation is bumped. Readers map an image once
+// and keep using it until they notice the generation changed, so a
+// publisher never modifies memory that readers may be looking at.
+class SharedCatalog {
+public:
+  // opens the control segment for a name, creating it if publishing.
+  // returns NULL if it does not exist or shared memory is unavailable.
+  static SharedCatalog *open(const char *name, bool publish);
+  ~SharedCatalog();
+
+  // returns the latest published generation
+  unsigned int generation();
+
+  // copies a catalog image into a new segment and makes it the latest
+  // generation. returns the new generation, or 0 on failure.
+  unsigned int publish(const char *data, size_t size);
+
+  // maps the latest image read only, or returns NULL on failure
+  const char *map();
+
+  // unmaps an image returned by map
+  static void unmap(const char *data, size_t size);
+
+  // removes the segments for this name
+  void unlink();
+
+  // returns whether this catalog is published under the given name
+  bool hasName(const char *name);
+
+  bool publisher;
+
+private:
+  SharedCatalog(const char *name, bool publish);
+  std::string segmentName(unsigned int generation);
+
+  std::string name;
+  SharedCatalogControl *control;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "StringCache.h"
+
+// maximum number of bytes (native and V8 heap) a cache may hold
+#define STRING_CACHE_MAX_SIZE (8 * 1024 * 1024)
+
+// approximate per-entry overhead of a V8 string and hash map node
+#define STRING_CACHE_ENTRY_OVERHEAD (sizeof(StringCache::Entry) + 64)
+
+StringCache::StringCache() {
+  head = NULL;
+  tail = NULL;
+  size = 0;
+  evictions = 0;
+  maxSize = STRING_CACHE_MAX_SIZE;
+}
+
+StringCache::~StringCache() {
+  while (tail)
+    evict();
+}
+
+Local<String> StringCache::get(const char *str) {
+  EntryMap::iterator it = entries.find(str);
+  if (it != entries.end()) {
+    Entry *entry = it->second;
+    moveToFront(entry);
+    return Nan::New(entry->value);
+  }
+
+  Local<String> value = String::NewFromUtf8(Isolate::GetCurrent(), str, NewStringType::kInternalized).ToLocalChecked();
+
+  size_t len = strlen(str);
+  Entry *entry = new Entry();
+  entry->key = new char[len + 1];
+  memcpy(entry->key, str, len + 1);
+  entry->value.Reset(value);
+  entry->size = 2 * len + STRING_CACHE_ENTRY_OVERHEAD;
+  entry->prev = NULL;
+  entry->next = NULL;
+
+  entries[entry->key] = entry;
+  moveToFront(entry);
+  size += entry->size;
+  Nan::AdjustExternalMemory((int) entry->size);
+
+  while (size > maxSize && tail != entry) {
+    evict();
+    evictions++;
+  }
+
+  return value;
+}
+
+void StringCache::setMaxSize(size_t maxSize) {
+  this->maxSize = maxSize;
+  while (size > maxSize && tail) {
+    evict();
+    evictions++;
+  }
+}
+
+StringCacheStats StringCache::stats() const {
+  StringCacheStats res;
+  res.entries = entries.size();
+  res.size = size;
+  res.maxSize = maxSize;
+  res.evictions = evictions;
+  return res;
+}
+
+void StringCache::moveToFront(Entry *entry) {
+  if (entry == head)
+    return;
+
+  unlink(entry);
+  entry->next = head;
+  if (head)
+    head->prev = entry;
+
+  head = entry;
+  if (!tail)
+    tail = entry;
+}
+
+void StringCache::unlink(Entry *entry) {
+  if (entry->prev)
+    entry->prev->next = entry->next;
+
+  if (entry->next)
+    entry->next->prev = entry->prev;
+
+  if (head == entry)
+    head = entry->next;
+
+  if (tail == entry)
+    tail = entry->prev;
+
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+// removes the least recently used entry
+void StringCache::evict() {
+  Entry *entry = tail;
+  unlink(entry);
+  entries.erase(entry->key);
+
+  size -= entry->size;
+  Nan::AdjustExternalMemory(-(int) entry->size);
+
+  entry->value.Reset();
+  delete[] entry->key;
+  delete entry;
+}
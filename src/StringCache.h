@@ -0,0 +1,85 @@
+#ifndef STRING_CACHE_H
+#define STRING_CACHE_H
+#include <node.h>
+#include <v8.h>
+#include <nan.h>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+
+using namespace v8;
+
+// how much a string cache holds, and how often it dropped strings
+struct StringCacheStats {
+  size_t entries;
+  size_t size;      // approximate bytes held, native and V8 heap
+  size_t maxSize;
+  uint64_t evictions;
+};
+
+// hashes and compares C strings by value so they can be used as map keys
+struct CStringHash {
+  size_t operator()(const char *str) const {
+    // FNV-1a
+    size_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) str; *p; p++) {
+      hash = (hash ^ *p) * 16777619u;
+    }
+
+    return hash;
+  }
+};
+
+struct CStringEqual {
+  bool operator()(const char *a, const char *b) const {
+    return strcmp(a, b) == 0;
+  }
+};
+
+// A bounded cache of V8 strings, one per Node.js environment. Font results
+// repeat the same family names, styles and paths over and over, so rather
+// than allocating a fresh V8 string for every field of every result, we hand
+// out persistent handles for values we have already seen. Each environment
+// owns its cache and passes it to the functions that build results, so it is
+// only ever used on that environment's thread. Least recently used strings
+// are evicted once the cache grows beyond its byte budget, and the memory it
+// holds is reported to V8 as external memory. The strings are internalized,
+// so property lookups and comparisons on them are pointer comparisons.
+class StringCache {
+public:
+  StringCache();
+
+  // returns a (possibly shared) V8 string for a UTF-8 C string
+  Local<String> get(const char *str);
+
+  // changes the byte budget, evicting strings until the cache fits
+  void setMaxSize(size_t maxSize);
+
+  StringCacheStats stats() const;
+
+  ~StringCache();
+
+private:
+  struct Entry {
+    char *key;
+    Nan::Persistent<String> value;
+    size_t size;
+    Entry *prev;
+    Entry *next;
+  };
+
+  typedef std::unordered_map<const char *, Entry *, CStringHash, CStringEqual> EntryMap;
+
+  void moveToFront(Entry *entry);
+  void unlink(Entry *entry);
+  void evict();
+
+  EntryMap entries;
+  Entry *head;  // most recently used
+  Entry *tail;  // least recently used
+  size_t size;
+  size_t maxSize;
+  uint64_t evictions;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef UNICODE_H
+#define UNICODE_H
+#include <stdint.h>
+
+// decodes the UTF-8 sequence at the start of str (at most len bytes long)
+// into a code point. returns the number of bytes consumed, which is always
+// at least 1 so that callers make progress on malformed input.
+static inline int decodeUtf8(const char *str, int len, uint32_t *codepoint) {
+  const unsigned char *s = (const unsigned char *) str;
+  int n = s[0] < 0x80 ? 1 : s[0] < 0xe0 ? 2 : s[0] < 0xf0 ? 3 : 4;
+
+  if (s[0] >= 0x80 && s[0] < 0xc0) {
+    *codepoint = 0xfffd;
+    return 1;
+  }
+
+  if (n > len) {
+    *codepoint = 0xfffd;
+    return len;
+  }
+
+  uint32_t c = n == 1 ? s[0] : s[0] & (0xff >> (n + 1));
+  for (int i = 1; i < n; i++) {
+    if ((s[i] & 0xc0) != 0x80) {
+      *codepoint = 0xfffd;
+      return i;
+    }
+
+    c = (c << 6) | (s[i] & 0x3f);
+  }
+
+  *codepoint = c;
+  return n;
+}
+
+// encodes a code point as a null terminated UTF-8 string. out must have
+// room for at least 5 bytes. returns the number of bytes written.
+static inline int encodeUtf8(uint32_t codepoint, char *out) {
+  int n = 0;
+  if (codepoint < 0x80) {
+    out[n++] = (char) codepoint;
+  } else if (codepoint < 0x800) {
+    out[n++] = (char) (0xc0 | (codepoint >> 6));
+    out[n++] = (char) (0x80 | (codepoint & 0x3f));
+  } else if (codepoint < 0x10000) {
+    out[n++] = (char) (0xe0 | (codepoint >> 12));
+    out[n++] = (char) (0x80 | ((codepoint >> 6) & 0x3f));
+    out[n++] = (char) (0x80 | (codepoint & 0x3f));
+  } else {
+    out[n++] = (char) (0xf0 | (codepoint >> 18));
+    out[n++] = (char) (0x80 | ((codepoint >> 12) & 0x3f));
+    out[n++] = (char) (0x80 | ((codepoint >> 6) & 0x3f));
+    out[n++] = (char) (0x80 | (codepoint & 0x3f));
+  }
+
+  out[n] = '\0';
+  return n;
+}
+
+#endif
@@ -1,5 +1,6 @@
 var fontManager = require('../');
 var assert = require('assert');
+var path = require('path');
 
 // some standard fonts that are likely to be installed on the platform the tests are running on
 var standardFont = process.platform === 'linux' ? 'Liberation Sans' : 'Arial';
@@ -15,6 +16,41 @@ describe('font-manager', function() {
     assert.equal(typeof fontManager.findFontSync, 'function');
     assert.equal(typeof fontManager.substituteFont, 'function');
     assert.equal(typeof fontManager.substituteFontSync, 'function');
+    assert.equal(typeof fontManager.getFontFamilies, 'function');
+    assert.equal(typeof fontManager.getFontFamiliesSync, 'function');
+    assert.equal(typeof fontManager.getFamilyNames, 'function');
+    assert.equal(typeof fontManager.getFamilyNamesSync, 'function');
+    assert.equal(typeof fontManager.searchFamilies, 'function');
+    assert.equal(typeof fontManager.searchFamiliesSync, 'function');
+    assert.equal(typeof fontManager.resolveFontStack, 'function');
+    assert.equal(typeof fontManager.resolveFontStackSync, 'function');
+    assert.equal(typeof fontManager.getFallbackChain, 'function');
+    assert.equal(typeof fontManager.getFallbackChainSync, 'function');
+    assert.equal(typeof fontManager.getFontByPostscriptName, 'function');
+    assert.equal(typeof fontManager.getFontByPostscriptNameSync, 'function');
+    assert.equal(typeof fontManager.getFontByPath, 'function');
+    assert.equal(typeof fontManager.getFontByPathSync, 'function');
+    assert.equal(typeof fontManager.findFontIds, 'function');
+    assert.equal(typeof fontManager.findFontIdsSync, 'function');
+    assert.equal(typeof fontManager.substituteFontId, 'function');
+    assert.equal(typeof fontManager.substituteFontIdSync, 'function');
+    assert.equal(typeof fontManager.getFontsById, 'function');
+    assert.equal(typeof fontManager.getFontsByIdSync, 'function');
+    assert.equal(typeof fontManager.getFontMetrics, 'function');
+    assert.equal(typeof fontManager.getFontMetricsSync, 'function');
+    assert.equal(typeof fontManager.getFontVariations, 'function');
+    assert.equal(typeof fontManager.getFontVariationsSync, 'function');
+    assert.equal(typeof fontManager.measureText, 'function');
+    assert.equal(typeof fontManager.measureTextSync, 'function');
+    assert.equal(typeof fontManager.prewarm, 'function');
+    assert.equal(typeof fontManager.refreshCatalog, 'function');
+    assert.equal(typeof fontManager.refreshCatalogSync, 'function');
+    assert.equal(typeof fontManager.configureCache, 'function');
+    assert.equal(typeof fontManager.getCacheStats, 'function');
+    assert.equal(typeof fontManager.getCatalogStats, 'function');
+    assert.equal(typeof fontManager.publishCatalog, 'function');
+    assert.equal(typeof fontManager.attachCatalog, 'function');
+    assert.equal(typeof fontManager.detachCatalog, 'function');
   });
   
   function assertFontDescriptor(font) {
@@ -64,8 +100,36 @@ describe('font-manager', function() {
       assert(fonts.length > 0);
       fonts.forEach(assertFontDescriptor);
     });
+
+    it('should return the same results when called repeatedly', function() {
+      var fonts = fontManager.getAvailableFontsSync();
+      for (var i = 0; i < 3; i++) {
+        assert.deepEqual(fontManager.getAvailableFontsSync(), fonts);
+      }
+    });
+
+    it('should keep the string cache within its budget', function() {
+      var fonts = fontManager.getAvailableFontsSync();
+      var limit = fontManager.getCacheStats().maxStringBytes;
+      try {
+        fontManager.configureCache({ maxStringBytes: 4096 });
+        var stats = fontManager.getCacheStats();
+        assert(stats.stringBytes <= 4096);
+
+        // more distinct strings than fit have to evict some of them
+        assert.deepEqual(fontManager.getAvailableFontsSync(), fonts);
+        var current = fontManager.getCacheStats();
+        assert(current.stringEvictions > stats.stringEvictions);
+        assert(current.stringBytes <= 4096 + 1024);
+        assert.deepEqual(fontManager.getAvailableFontsSync(), fonts);
+      } finally {
+        fontManager.configureCache({ maxStringBytes: limit });
+      }
+
+      assert.equal(fontManager.getCacheStats().maxStringBytes, limit);
+    });
   });
-  
+
   describe('findFonts', function() {
     it('should throw if no font descriptor is provided', function() {
       assert.throws(function() {
@@ -105,6 +169,17 @@ describe('font-manager', function() {
       async = true;
     });
     
+    it('should find fonts by language asynchronously', function(done) {
+      fontManager.findFonts({ lang: 'en', monospace: true }, function(fonts) {
+        assert(Array.isArray(fonts));
+        fonts.forEach(function(font) {
+          assertFontDescriptor(font);
+          assert.equal(font.monospace, true);
+        });
+        done();
+      });
+    });
+    
     it('should find fonts by postscriptName', function(done) {
       fontManager.findFonts({ postscriptName: postscriptName }, function(fonts) {
         assert(Array.isArray(fonts));
@@ -238,6 +313,74 @@ describe('font-manager', function() {
       assert.equal(fonts[0].weight, 700);
     });
     
+    it('should find fonts by language', function() {
+      var fonts = fontManager.findFontsSync({ family: standardFont, lang: 'en' });
+      assert(Array.isArray(fonts));
+      assert(fonts.length > 0);
+      fonts.forEach(assertFontDescriptor);
+      assert.equal(fonts[0].family, standardFont);
+    });
+    
+    it('should find fonts by script', function() {
+      var fonts = fontManager.findFontsSync({ family: standardFont, script: 'Latn' });
+      assert(fonts.length > 0);
+      assert.deepEqual(fontManager.findFontsSync({ script: 'Zzzz' }), []);
+    });
+
+    it('should ask the platform about family names the catalog does not have', function() {
+      function postscriptName(font) {
+        return font.postscriptName;
+      }
+
+      var fonts = fontManager.findFontsSync({ family: standardFont, lang: 'en' });
+      var named = fontManager.findFontsSync({ family: ['NonExistentFont', standardFont], lang: 'en' });
+      assert.deepEqual(named.map(postscriptName).sort(), fonts.map(postscriptName).sort());
+      assert.deepEqual(fontManager.findFontsSync({ family: 'NonExistentFont', lang: 'en' }), []);
+    });
+
+    it('should find fonts by weight and width ranges', function() {
+      var all = fontManager.getAvailableFontsSync();
+      var fonts = fontManager.findFontsSync({ weight: { min: 300, max: 600 }, width: { max: 5 } });
+      assert.equal(fonts.length, all.filter(function(font) {
+        return font.weight >= 300 && font.weight <= 600 && font.width <= 5;
+      }).length);
+
+      fonts.forEach(function(font) {
+        assertFontDescriptor(font);
+        assert(font.weight >= 300 && font.weight <= 600);
+        assert(font.width <= 5);
+      });
+
+      assert.deepEqual(fontManager.findFontsSync({ weight: { min: 600, max: 300 } }), []);
+    });
+
+    it('should find fonts in any of a list of families', function() {
+      var fonts = fontManager.findFontsSync({ family: [standardFont, 'Does Not Exist'], weight: { min: 700 } });
+      assert(fonts.length > 0);
+      fonts.forEach(function(font) {
+        assert.equal(font.family, standardFont);
+        assert(font.weight >= 700);
+      });
+
+      assert.equal(fontManager.findFontsSync({ family: [] }).length, fontManager.findFontsSync({}).length);
+    });
+
+    it('should find fonts by path prefix', function() {
+      var font = fontManager.findFontSync({ postscriptName: postscriptName });
+      var dir = path.dirname(font.path) + path.sep;
+      var fonts = fontManager.findFontsSync({ pathPrefix: dir });
+      assert(fonts.some(function(found) {
+        return found.path === font.path;
+      }));
+
+      fonts.forEach(function(found) {
+        assert.equal(found.path.slice(0, dir.length), dir);
+      });
+
+      assert.deepEqual(fontManager.findFontsSync({ pathPrefix: '/does/not/exist/' }), []);
+      assert.equal(fontManager.findFontIdsSync({ pathPrefix: dir }).length, fonts.length);
+    });
+
     it('should find italic fonts', function() {
       var fonts = fontManager.findFontsSync({ family: standardFont, italic: true });
       assert(Array.isArray(fonts));
@@ -408,6 +551,12 @@ describe('font-manager', function() {
       assert(!Array.isArray(font));
       assertFontDescriptor(font);
     });
+
+    it('should find fonts for weights in between the standard ones', function() {
+      var font = fontManager.findFontSync({ family: standardFont, weight: 450 });
+      assertFontDescriptor(font);
+      assert.equal(font.family, standardFont);
+    });
     
     it('should find font by postscriptName', function() {
       var font = fontManager.findFontSync({ postscriptName: postscriptName });
@@ -577,4 +726,1256 @@ describe('font-manager', function() {
       assertFontDescriptor(font);
     });
   });
+
+  function assertFamilies(families) {
+    assert(Array.isArray(families));
+    assert(families.length > 0);
+    families.forEach(function(family) {
+      assert.equal(typeof family.family, 'string');
+      assert(Array.isArray(family.faces));
+      assert(family.faces.length > 0);
+      family.faces.forEach(function(font, i) {
+        assertFontDescriptor(font);
+        assert.equal(font.family, family.family);
+
+        var prev = family.faces[i - 1];
+        if (prev) {
+          assert(prev.weight < font.weight || (prev.weight === font.weight &&
+            (prev.width < font.width || (prev.width === font.width && prev.italic <= font.italic))));
+        }
+      });
+    });
+  }
+
+  describe('getFontFamilies', function() {
+    it('should throw if no callback is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontFamilies();
+      }, /Expected a callback/);
+    });
+
+    it('should getFontFamilies asynchronously', function(done) {
+      var async = false;
+
+      fontManager.getFontFamilies(function(families) {
+        assert(async);
+        assertFamilies(families);
+        done();
+      });
+
+      async = true;
+    });
+  });
+
+  describe('getFontFamiliesSync', function() {
+    it('should getFontFamilies synchronously', function() {
+      assertFamilies(fontManager.getFontFamiliesSync());
+    });
+
+    it('should group the standard font family', function() {
+      var family = fontManager.getFontFamiliesSync().filter(function(family) {
+        return family.family === standardFont;
+      })[0];
+
+      assert(family);
+      assert(family.faces.some(function(font) { return font.weight === 700; }));
+      assert(family.faces.some(function(font) { return font.italic; }));
+    });
+
+    it('should include every available font with a family', function() {
+      var count = 0;
+      fontManager.getFontFamiliesSync().forEach(function(family) {
+        count += family.faces.length;
+      });
+
+      assert.equal(count, fontManager.getAvailableFontsSync().length);
+    });
+  });
+
+  describe('getFamilyNames', function() {
+    it('should throw if no callback is provided', function() {
+      assert.throws(function() {
+        fontManager.getFamilyNames();
+      }, /Expected a callback/);
+    });
+
+    it('should getFamilyNames asynchronously', function(done) {
+      var async = false;
+
+      fontManager.getFamilyNames(function(names) {
+        assert(async);
+        assert(Array.isArray(names));
+        assert(names.indexOf(standardFont) !== -1);
+        done();
+      });
+
+      async = true;
+    });
+  });
+
+  describe('getFamilyNamesSync', function() {
+    it('should match the names of getFontFamilies', function() {
+      var names = fontManager.getFamilyNamesSync();
+      assert.deepEqual(names, fontManager.getFontFamiliesSync().map(function(family) {
+        return family.family;
+      }));
+    });
+  });
+
+  describe('searchFamilies', function() {
+    it('should throw if no query is provided', function() {
+      assert.throws(function() {
+        fontManager.searchFamilies();
+      }, /Expected a query string/);
+    });
+
+    it('should searchFamilies asynchronously', function(done) {
+      fontManager.searchFamilies(standardFont.slice(0, 4), function(names) {
+        assert(Array.isArray(names));
+        assert(names.indexOf(standardFont) !== -1);
+        done();
+      });
+    });
+  });
+
+  describe('searchFamiliesSync', function() {
+    it('should rank the exact name first', function() {
+      assert.equal(fontManager.searchFamiliesSync(standardFont)[0], standardFont);
+    });
+
+    it('should ignore case and punctuation', function() {
+      var names = fontManager.searchFamiliesSync(standardFont.toUpperCase().replace(/ /g, '-'));
+      assert.equal(names[0], standardFont);
+    });
+
+    it('should find names with typos', function() {
+      var typo = standardFont.slice(0, -1) + 'z';
+      assert(fontManager.searchFamiliesSync(typo).indexOf(standardFont) !== -1);
+    });
+
+    it('should limit the number of results', function() {
+      assert(fontManager.searchFamiliesSync('', { limit: 2 }).length <= 2);
+      assert.deepEqual(fontManager.searchFamiliesSync('', { limit: 2 }), fontManager.getFamilyNamesSync().slice(0, 2));
+    });
+  });
+
+  describe('resolveFontStack', function() {
+    it('should throw if no families are provided', function() {
+      assert.throws(function() {
+        fontManager.resolveFontStack({}, function(result) {});
+      }, /Expected an array of font families/);
+    });
+
+    it('should throw if a family is not a string', function() {
+      assert.throws(function() {
+        fontManager.resolveFontStack([standardFont, 2], {}, function(result) {});
+      }, /Expected an array of font families/);
+    });
+
+    it('should throw if no font descriptor is provided', function() {
+      assert.throws(function() {
+        fontManager.resolveFontStack([standardFont], function(result) {});
+      }, /Expected a font descriptor/);
+    });
+
+    it('should throw if no callback is provided', function() {
+      assert.throws(function() {
+        fontManager.resolveFontStack([standardFont], {}, 'hi');
+      }, /Expected a callback/);
+    });
+
+    it('should resolveFontStack asynchronously', function(done) {
+      var async = false;
+
+      fontManager.resolveFontStack(['' + Date.now(), standardFont, 'sans-serif'], { weight: 700 }, function(result) {
+        assert(async);
+        assert.equal(result.family, standardFont);
+        assertFontDescriptor(result.font);
+        assert.equal(result.font.family, standardFont);
+        assert.equal(result.font.weight, 700);
+        assert.equal(result.fallbacks, undefined);
+        done();
+      });
+
+      async = true;
+    });
+
+    it('should find fallbacks for text asynchronously', function(done) {
+      fontManager.resolveFontStack([standardFont], {}, 'hi汉字', function(result) {
+        assert.equal(result.family, standardFont);
+        assert(Array.isArray(result.fallbacks));
+        assert.deepEqual(result.fallbacks.map(function(f) { return f.codepoint; }), [0x6c49, 0x5b57]);
+        done();
+      });
+    });
+  });
+
+  describe('resolveFontStackSync', function() {
+    it('should resolve the first family that exists', function() {
+      var result = fontManager.resolveFontStackSync(['' + Date.now(), standardFont], { italic: true });
+      assert.equal(result.family, standardFont);
+      assertFontDescriptor(result.font);
+      assert.equal(result.font.family, standardFont);
+      assert.equal(result.font.italic, true);
+    });
+
+    it('should resolve generic families', function() {
+      var result = fontManager.resolveFontStackSync(['' + Date.now(), 'sans-serif'], {});
+      assert.equal(result.family, 'sans-serif');
+      assertFontDescriptor(result.font);
+    });
+
+    it('should return a default font if no family exists', function() {
+      var result = fontManager.resolveFontStackSync(['' + Date.now()], {});
+      assert.equal(result.family, null);
+      assertFontDescriptor(result.font);
+    });
+
+    it('should not return fallbacks for supported characters', function() {
+      var result = fontManager.resolveFontStackSync([standardFont], {}, 'hello');
+      assert.deepEqual(result.fallbacks, []);
+    });
+
+    it('should return fallbacks for unsupported characters', function() {
+      var result = fontManager.resolveFontStackSync([standardFont], {}, '汉字汉');
+      assert.equal(result.fallbacks.length, 2);
+      result.fallbacks.forEach(function(fallback) {
+        assertFontDescriptor(fallback.font);
+        assert.notEqual(fallback.font.postscriptName, result.font.postscriptName);
+      });
+    });
+  });
+
+  function assertFallbackChain(chain) {
+    assert(Array.isArray(chain));
+    assert(chain.length > 0);
+    assert.equal(chain[0].font.postscriptName, postscriptName);
+
+    var total = 0;
+    chain.forEach(function(entry) {
+      assertFontDescriptor(entry.font);
+      assert(entry.coverage > 0);
+      total += entry.coverage;
+      assert.equal(entry.totalCoverage, total);
+    });
+  }
+
+  describe('getFallbackChain', function() {
+    it('should throw if no postscript name is provided', function() {
+      assert.throws(function() {
+        fontManager.getFallbackChain(function(chain) {});
+      }, /Expected postscript name/);
+    });
+
+    it('should throw if no callback is provided', function() {
+      assert.throws(function() {
+        fontManager.getFallbackChain(postscriptName, { limit: 2 });
+      }, /Expected a callback/);
+    });
+
+    it('should getFallbackChain asynchronously', function(done) {
+      var async = false;
+
+      fontManager.getFallbackChain(postscriptName, function(chain) {
+        assert(async);
+        assertFallbackChain(chain);
+        done();
+      });
+
+      async = true;
+    });
+
+    it('should accept options', function(done) {
+      fontManager.getFallbackChain(postscriptName, { lang: 'ja', limit: 1 }, function(chain) {
+        assertFallbackChain(chain);
+        assert.equal(chain.length, 1);
+        done();
+      });
+    });
+
+    it('should return null for an unknown postscript name', function(done) {
+      fontManager.getFallbackChain('NonExistentFont-Regular', function(chain) {
+        assert.strictEqual(chain, null);
+        done();
+      });
+    });
+  });
+
+  describe('getFallbackChainSync', function() {
+    it('should getFallbackChain synchronously', function() {
+      assertFallbackChain(fontManager.getFallbackChainSync(postscriptName));
+    });
+
+    it('should return the same chain when called repeatedly', function() {
+      var chain = fontManager.getFallbackChainSync(postscriptName, { lang: 'en' });
+      assert.deepEqual(fontManager.getFallbackChainSync(postscriptName, { lang: 'en' }), chain);
+    });
+
+    it('should return null for an unknown postscript name', function() {
+      assert.strictEqual(fontManager.getFallbackChainSync('NonExistentFont-Regular'), null);
+      assert.strictEqual(fontManager.getFallbackChainSync('NonExistentFont-Regular', { lang: 'ja' }), null);
+    });
+
+    it('should limit the number of fonts', function() {
+      var chain = fontManager.getFallbackChainSync(postscriptName);
+      var limited = fontManager.getFallbackChainSync(postscriptName, { limit: 1 });
+      assert.deepEqual(limited, chain.slice(0, 1));
+    });
+  });
+
+  describe('getFontByPostscriptName', function() {
+    it('should throw if no postscript name is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontByPostscriptName();
+      }, /Expected postscript name/);
+    });
+
+    it('should throw if no callback is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontByPostscriptName(postscriptName);
+      }, /Expected a callback/);
+    });
+
+    it('should getFontByPostscriptName asynchronously', function(done) {
+      fontManager.getFontByPostscriptName(postscriptName, function(font) {
+        assertFontDescriptor(font);
+        assert.equal(font.postscriptName, postscriptName);
+        done();
+      });
+    });
+
+    it('should look up several fonts asynchronously', function(done) {
+      fontManager.getFontByPostscriptName([postscriptName, 'NonExistentFont'], function(fonts) {
+        assert(Array.isArray(fonts));
+        assert.equal(fonts.length, 2);
+        assert.equal(fonts[0].postscriptName, postscriptName);
+        assert.equal(fonts[1], null);
+        done();
+      });
+    });
+  });
+
+  describe('getFontByPostscriptNameSync', function() {
+    it('should throw if a postscript name is not a string', function() {
+      assert.throws(function() {
+        fontManager.getFontByPostscriptNameSync([postscriptName, 2]);
+      }, /Expected postscript name/);
+    });
+
+    it('should getFontByPostscriptName synchronously', function() {
+      var font = fontManager.getFontByPostscriptNameSync(postscriptName);
+      assertFontDescriptor(font);
+      assert.equal(font.postscriptName, postscriptName);
+      assert.equal(font.family, standardFont);
+    });
+
+    it('should return null if no font has the postscript name', function() {
+      assert.equal(fontManager.getFontByPostscriptNameSync('NonExistentFont'), null);
+    });
+
+    it('should find every available font', function() {
+      var fonts = fontManager.getAvailableFontsSync().filter(function(font) {
+        return font.postscriptName;
+      });
+
+      var found = fontManager.getFontByPostscriptNameSync(fonts.map(function(font) {
+        return font.postscriptName;
+      }));
+
+      found.forEach(function(font, i) {
+        assertFontDescriptor(font);
+        assert.equal(font.postscriptName, fonts[i].postscriptName);
+      });
+    });
+  });
+
+  describe('getFontByPath', function() {
+    it('should throw if no path is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontByPath();
+      }, /Expected a path/);
+    });
+
+    it('should throw if no callback is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontByPath('/font.ttf');
+      }, /Expected a callback/);
+    });
+
+    it('should getFontByPath asynchronously', function(done) {
+      var path = fontManager.findFontSync({ postscriptName: postscriptName }).path;
+      fontManager.getFontByPath(path, function(font) {
+        assertFontDescriptor(font);
+        assert.equal(font.path, path);
+        done();
+      });
+    });
+  });
+
+  describe('getFontByPathSync', function() {
+    it('should getFontByPath synchronously', function() {
+      var path = fontManager.findFontSync({ postscriptName: postscriptName }).path;
+      var font = fontManager.getFontByPathSync(path);
+      assertFontDescriptor(font);
+      assert.equal(font.path, path);
+    });
+
+    it('should return null if no font has the path', function() {
+      assert.equal(fontManager.getFontByPathSync('/does/not/exist.ttf'), null);
+      assert.deepEqual(fontManager.getFontByPathSync(['/does/not/exist.ttf']), [null]);
+    });
+
+    it('should find the font of every path', function() {
+      fontManager.getAvailableFontsSync().forEach(function(font) {
+        var found = fontManager.getFontByPathSync(font.path);
+        assert.equal(found.path, font.path);
+        assert.equal(fontManager.getFontByPathSync(font.path + '.missing'), null);
+      });
+    });
+  });
+
+  describe('findFontIds', function() {
+    it('should throw if no font descriptor is provided', function() {
+      assert.throws(function() {
+        fontManager.findFontIds(function(ids) {});
+      }, /Expected a font descriptor/);
+    });
+
+    it('should findFontIds asynchronously', function(done) {
+      fontManager.findFontIds({ family: standardFont }, function(ids) {
+        assert(ids instanceof Uint32Array);
+        assert(ids.length > 0);
+        done();
+      });
+    });
+  });
+
+  describe('findFontIdsSync', function() {
+    it('should find the same fonts as findFontsSync', function() {
+      var ids = fontManager.findFontIdsSync({ family: standardFont });
+      var fonts = fontManager.findFontsSync({ family: standardFont });
+      assert(ids instanceof Uint32Array);
+      assert.deepEqual(fontManager.getFontsByIdSync(ids).map(function(font) {
+        return font.postscriptName;
+      }).sort(), fonts.map(function(font) {
+        return font.postscriptName;
+      }).sort());
+    });
+
+    it('should return the same IDs every time', function() {
+      var ids = fontManager.findFontIdsSync({ family: standardFont });
+      assert.deepEqual(fontManager.findFontIdsSync({ family: standardFont }), ids);
+    });
+  });
+
+  describe('substituteFontId', function() {
+    it('should throw if no postscript name is provided', function() {
+      assert.throws(function() {
+        fontManager.substituteFontId(function(id) {});
+      }, /Expected postscript name/);
+    });
+
+    it('should substituteFontId asynchronously', function(done) {
+      fontManager.substituteFontId(postscriptName, '汉字', function(id) {
+        var font = fontManager.substituteFontSync(postscriptName, '汉字');
+        assert.equal(fontManager.getFontsByIdSync(id).postscriptName, font.postscriptName);
+        done();
+      });
+    });
+  });
+
+  describe('substituteFontIdSync', function() {
+    it('should return the ID of the original font if it has the characters', function() {
+      var id = fontManager.substituteFontIdSync(postscriptName, 'abc');
+      assert.equal(fontManager.getFontsByIdSync(id).postscriptName, postscriptName);
+    });
+  });
+
+  describe('getFontsById', function() {
+    it('should throw if no ID is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontsById('ArialMT', function(font) {});
+      }, /Expected a font ID or an array of IDs/);
+    });
+
+    it('should getFontsById asynchronously', function(done) {
+      var id = fontManager.substituteFontIdSync(postscriptName, 'abc');
+      fontManager.getFontsById(id, function(font) {
+        assertFontDescriptor(font);
+        assert.equal(font.postscriptName, postscriptName);
+        done();
+      });
+    });
+  });
+
+  describe('getFontsByIdSync', function() {
+    it('should accept an array of IDs', function() {
+      var ids = Array.prototype.slice.call(fontManager.findFontIdsSync({ family: standardFont }));
+      var fonts = fontManager.getFontsByIdSync(ids);
+      assert.equal(fonts.length, ids.length);
+      fonts.forEach(assertFontDescriptor);
+    });
+
+    it('should return null for unknown IDs', function() {
+      var ids = fontManager.findFontIdsSync({});
+      var id = 1;
+      while (Array.prototype.indexOf.call(ids, id) !== -1)
+        id++;
+
+      assert.equal(fontManager.getFontsByIdSync(id), null);
+      assert.deepEqual(fontManager.getFontsByIdSync([id]), [null]);
+    });
+  });
+
+  function assertFontMetrics(metrics) {
+    assert.equal(typeof metrics, 'object');
+    assert(metrics.unitsPerEm > 0);
+    assert(metrics.ascent > 0);
+    assert(metrics.descent <= 0);
+    assert.equal(typeof metrics.lineGap, 'number');
+    assert.equal(typeof metrics.capHeight, 'number');
+    assert.equal(typeof metrics.xHeight, 'number');
+    assert.equal(typeof metrics.italicAngle, 'number');
+  }
+
+  describe('getFontMetrics', function() {
+    it('should throw if no font is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontMetrics();
+      }, /Expected a font descriptor or postscript name/);
+    });
+
+    it('should throw if no callback is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontMetrics(postscriptName);
+      }, /Expected a callback/);
+    });
+
+    it('should getFontMetrics asynchronously', function(done) {
+      fontManager.getFontMetrics(postscriptName, function(metrics) {
+        assertFontMetrics(metrics);
+        done();
+      });
+    });
+
+    it('should get the metrics of several fonts asynchronously', function(done) {
+      fontManager.getFontMetrics([postscriptName, 'NonExistentFont'], function(metrics) {
+        assert.equal(metrics.length, 2);
+        assertFontMetrics(metrics[0]);
+        assert.equal(metrics[1], null);
+        done();
+      });
+    });
+  });
+
+  describe('getFontMetricsSync', function() {
+    it('should throw if a font is not a string or object', function() {
+      assert.throws(function() {
+        fontManager.getFontMetricsSync([postscriptName, 2]);
+      }, /Expected a font descriptor or postscript name/);
+    });
+
+    it('should getFontMetrics synchronously', function() {
+      assertFontMetrics(fontManager.getFontMetricsSync(postscriptName));
+    });
+
+    it('should return null if no font has the postscript name', function() {
+      assert.equal(fontManager.getFontMetricsSync('NonExistentFont'), null);
+    });
+
+    it('should accept font descriptors', function() {
+      var font = fontManager.findFontSync({ family: standardFont });
+      var metrics = fontManager.getFontMetricsSync(font);
+      assertFontMetrics(metrics);
+      assert.deepEqual(fontManager.getFontMetricsSync({ family: standardFont }), metrics);
+      assert.deepEqual(fontManager.getFontMetricsSync(font.postscriptName), metrics);
+    });
+
+    it('should return the same metrics when called repeatedly', function() {
+      assert.deepEqual(fontManager.getFontMetricsSync(postscriptName), fontManager.getFontMetricsSync(postscriptName));
+    });
+  });
+
+  function assertFontVariations(variations) {
+    assert.equal(typeof variations, 'object');
+    assert(Array.isArray(variations.axes));
+    assert(Array.isArray(variations.instances));
+    variations.axes.forEach(function(axis) {
+      assert.equal(typeof axis.tag, 'string');
+      assert.equal(axis.tag.length, 4);
+      assert(axis.min <= axis.default && axis.default <= axis.max);
+    });
+  }
+
+  describe('getFontVariations', function() {
+    it('should throw if no font is provided', function() {
+      assert.throws(function() {
+        fontManager.getFontVariations();
+      }, /Expected a font descriptor or postscript name/);
+    });
+
+    it('should getFontVariations asynchronously', function(done) {
+      fontManager.getFontVariations(postscriptName, function(variations) {
+        assertFontVariations(variations);
+        done();
+      });
+    });
+  });
+
+  describe('getFontVariationsSync', function() {
+    it('should getFontVariations synchronously', function() {
+      assertFontVariations(fontManager.getFontVariationsSync(postscriptName));
+    });
+
+    it('should return null if no font has the postscript name', function() {
+      assert.equal(fontManager.getFontVariationsSync('NonExistentFont'), null);
+    });
+  });
+
+  describe('measureText', function() {
+    it('should throw if no font is provided', function() {
+      assert.throws(function() {
+        fontManager.measureText();
+      }, /Expected a font descriptor or postscript name/);
+    });
+
+    it('should throw if no text is provided', function() {
+      assert.throws(function() {
+        fontManager.measureText(postscriptName);
+      }, /Expected a string or an array of strings/);
+    });
+
+    it('should throw if no size is provided', function() {
+      assert.throws(function() {
+        fontManager.measureText(postscriptName, 'Hello');
+      }, /Expected a font size/);
+    });
+
+    it('should throw if no callback is provided', function() {
+      assert.throws(function() {
+        fontManager.measureText(postscriptName, 'Hello', 16);
+      }, /Expected a callback/);
+    });
+
+    it('should measureText asynchronously', function(done) {
+      fontManager.measureText(postscriptName, 'Hello', 16, function(width) {
+        assert.equal(width, fontManager.measureTextSync(postscriptName, 'Hello', 16));
+        done();
+      });
+    });
+
+    it('should measure several strings asynchronously', function(done) {
+      fontManager.measureText(postscriptName, ['Hello', 'world'], 16, { priority: 1 }, function(widths) {
+        assert(widths instanceof Float32Array);
+        assert.equal(widths.length, 2);
+        done();
+      });
+    });
+  });
+
+  describe('measureTextSync', function() {
+    it('should throw if a text is not a string', function() {
+      assert.throws(function() {
+        fontManager.measureTextSync(postscriptName, ['Hello', 2], 16);
+      }, /Expected a string or an array of strings/);
+    });
+
+    it('should measureText synchronously', function() {
+      var width = fontManager.measureTextSync(postscriptName, 'Hello', 16);
+      assert.equal(typeof width, 'number');
+      assert(width > 0);
+      assert.equal(fontManager.measureTextSync(postscriptName, '', 16), 0);
+    });
+
+    it('should scale with the font size', function() {
+      var width = fontManager.measureTextSync(postscriptName, 'Hello', 16);
+      assert(Math.abs(fontManager.measureTextSync(postscriptName, 'Hello', 32) - width * 2) < 1e-6);
+    });
+
+    it('should return null if no font has the postscript name', function() {
+      assert.equal(fontManager.measureTextSync('NonExistentFont', 'Hello', 16), null);
+    });
+
+    it('should accept font descriptors', function() {
+      var font = fontManager.findFontSync({ postscriptName: postscriptName });
+      assert.equal(fontManager.measureTextSync(font, 'Hello', 16), fontManager.measureTextSync(postscriptName, 'Hello', 16));
+    });
+
+    it('should measure several strings', function() {
+      var widths = fontManager.measureTextSync(postscriptName, ['Hello', 'world', ''], 16);
+      assert(widths instanceof Float32Array);
+      assert.equal(widths.length, 3);
+      assert(Math.abs(widths[0] - fontManager.measureTextSync(postscriptName, 'Hello', 16)) < 1e-3);
+      assert.equal(widths[2], 0);
+    });
+
+    it('should return the advance of each code point', function() {
+      var text = 'AVA To\ud83d\ude00';
+      var advances = fontManager.measureTextSync(postscriptName, text, 16, { advances: true });
+      assert(advances instanceof Float32Array);
+      assert.equal(advances.length, 7);
+
+      var sum = 0;
+      for (var i = 0; i < advances.length; i++) {
+        sum += advances[i];
+      }
+
+      assert(Math.abs(sum - fontManager.measureTextSync(postscriptName, text, 16)) < 1e-3);
+    });
+
+    it('should only kern when asked to', function() {
+      var kerned = fontManager.measureTextSync(postscriptName, 'AVAV', 16);
+      var unkerned = fontManager.measureTextSync(postscriptName, 'AVAV', 16, { kerning: false });
+      var advances = fontManager.measureTextSync(postscriptName, 'AVAV', 16, { kerning: false, advances: true });
+      assert(kerned <= unkerned);
+      assert(Math.abs(unkerned - (advances[0] + advances[1]) * 2) < 1e-3);
+    });
+  });
+
+  describe('corrupt font files', function() {
+    var fs = require('fs');
+    var os = require('os');
+    var files = [];
+
+    // writes a modified copy of a font file, with the offset of each table
+    // record in its directory (or collection header) passed to edit
+    function writeFont(name, edit) {
+      var font = fontManager.findFontSync({ postscriptName: postscriptName });
+      var data = fs.readFileSync(font.path);
+      var directory = data.readUInt32BE(0) === 0x74746366 ? data.readUInt32BE(12) : 0;
+      var numTables = data.readUInt16BE(directory + 4);
+      for (var i = 0; i < numTables; i++) {
+        data = edit(data, directory + 12 + i * 16) || data;
+      }
+
+      var file = path.join(os.tmpdir(), 'font-manager-' + process.pid + '-' + name + path.extname(font.path));
+      fs.writeFileSync(file, data);
+      files.push(file);
+      return { path: file, postscriptName: postscriptName };
+    }
+
+    after(function() {
+      files.forEach(function(file) {
+        fs.unlinkSync(file);
+      });
+    });
+
+    it('should return null for tables that extend past the end of the file', function() {
+      var font = writeFont('length', function(data, record) {
+        data.writeUInt32BE(0xffffffff, record + 12);
+      });
+
+      assert.equal(fontManager.getFontMetricsSync(font), null);
+      assert.equal(fontManager.measureTextSync(font, 'Hello', 16), null);
+    });
+
+    it('should return null for tables at offsets past the end of the file', function() {
+      var font = writeFont('offset', function(data, record) {
+        data.writeUInt32BE(0xfffffff0, record + 8);
+      });
+
+      assert.equal(fontManager.getFontMetricsSync(font), null);
+      assert.equal(fontManager.measureTextSync(font, 'Hello', 16), null);
+    });
+
+    it('should return null for truncated files', function() {
+      var font = writeFont('truncated', function(data) {
+        return data.slice(0, 64);
+      });
+
+      assert.equal(fontManager.getFontMetricsSync(font), null);
+      assert.equal(fontManager.measureTextSync(font, 'Hello', 16), null);
+    });
+
+    it('should survive garbage in the tables', function() {
+      // a fixed seed, so failures can be reproduced
+      var seed = 1;
+      function random() {
+        seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+        return seed;
+      }
+
+      var font = writeFont('garbage', function(data, record) {
+        var offset = data.readUInt32BE(record + 8);
+        var length = Math.min(data.readUInt32BE(record + 12), data.length - offset);
+        var tag = data.toString('latin1', record, record + 4);
+        if (tag === 'head' || tag === 'name')
+          return;
+
+        for (var i = 0; i < length; i += 7) {
+          data[offset + i] = random() & 0xff;
+        }
+      });
+
+      var metrics = fontManager.getFontMetricsSync(font);
+      assert(metrics === null || typeof metrics.unitsPerEm === 'number');
+
+      var width = fontManager.measureTextSync(font, 'Hello AVA \u6c49\ud83d\ude00', 16, { kerning: true });
+      assert(width === null || typeof width === 'number');
+    });
+  });
+
+  describe('request options', function() {
+    // a minimal stand in for an AbortSignal
+    function createSignal(aborted) {
+      var signal = {
+        aborted: aborted,
+        listeners: [],
+        addEventListener: function(type, listener) {
+          signal.listeners.push(listener);
+        },
+        removeEventListener: function(type, listener) {
+          signal.listeners.splice(signal.listeners.indexOf(listener), 1);
+        },
+        abort: function() {
+          signal.aborted = true;
+          signal.listeners.slice().forEach(function(listener) {
+            listener();
+          });
+        }
+      };
+
+      return signal;
+    }
+
+    it('should accept options before the callback', function(done) {
+      fontManager.findFont({ family: standardFont }, { priority: 5, timeout: 60000 }, function(font) {
+        assertFontDescriptor(font);
+        assert.equal(font.family, standardFont);
+        done();
+      });
+    });
+
+    it('should accept scheduling options with other options', function(done) {
+      fontManager.getFallbackChain(postscriptName, { limit: 1, priority: 1 }, function(chain) {
+        assert.equal(chain.length, 1);
+        done();
+      });
+    });
+
+    it('should throw if no callback is provided after the options', function() {
+      assert.throws(function() {
+        fontManager.getAvailableFonts({ priority: 1 });
+      }, /Expected a callback/);
+    });
+
+    it('should throw if the timeout is not a non-negative number', function() {
+      [-1, NaN, Infinity, '100', null].forEach(function(timeout) {
+        assert.throws(function() {
+          fontManager.findFont({ family: standardFont }, { timeout: timeout }, function() {});
+        }, /Expected timeout to be a non-negative number/);
+      });
+    });
+
+    it('should accept timeouts longer than timers support', function(done) {
+      fontManager.findFont({ family: standardFont }, { timeout: Number.MAX_VALUE }, function(font) {
+        assertFontDescriptor(font);
+        done();
+      });
+    });
+
+    it('should drop requests that were aborted before they were made', function(done) {
+      var signal = createSignal(true);
+      fontManager.findFonts({ family: standardFont }, { signal: signal }, function(err) {
+        assert(err instanceof Error);
+        assert.equal(err.name, 'AbortError');
+        assert.equal(signal.listeners.length, 0);
+        done();
+      });
+    });
+
+    it('should call the callback with an error when aborted', function(done) {
+      var signal = createSignal(false);
+      fontManager.substituteFont(postscriptName, '汉字', { signal: signal }, function(err) {
+        assert(err instanceof Error);
+        assert.equal(err.name, 'AbortError');
+        done();
+      });
+
+      assert.equal(signal.listeners.length, 1);
+      signal.abort();
+    });
+
+    it('should stop listening to the signal when the request finishes', function(done) {
+      var signal = createSignal(false);
+      fontManager.getFamilyNames({ signal: signal }, function(names) {
+        assert(Array.isArray(names));
+        setImmediate(function() {
+          assert.equal(signal.listeners.length, 0);
+          signal.abort();
+          done();
+        });
+      });
+    });
+  });
+
+  describe('prewarm', function() {
+    it('should return a promise that resolves once the catalog is ready', function() {
+      var promise = fontManager.prewarm();
+      assert(promise instanceof Promise);
+      return promise.then(function(res) {
+        assert.equal(res, undefined);
+        assert(fontManager.getAvailableFontsSync().length > 0);
+      });
+    });
+
+    it('should resolve again after the catalog is ready', function() {
+      return fontManager.prewarm().then(function() {
+        return fontManager.prewarm();
+      });
+    });
+  });
+
+  describe('refreshCatalog', function() {
+    it('should answer queries made during the refresh', function(done) {
+      var count = fontManager.getAvailableFontsSync().length;
+      var pending = 2;
+      fontManager.refreshCatalog(function(generation) {
+        assert.equal(typeof generation, 'number');
+        if (--pending === 0)
+          done();
+      });
+
+      fontManager.getAvailableFonts(function(fonts) {
+        assert.equal(fonts.length, count);
+        if (--pending === 0)
+          done();
+      });
+    });
+  });
+
+  describe('refreshCatalogSync', function() {
+    it('should start a new generation', function() {
+      var generation = fontManager.refreshCatalogSync();
+      assert(fontManager.refreshCatalogSync() > generation);
+    });
+
+    it('should keep font IDs', function() {
+      var ids = fontManager.findFontIdsSync({ family: standardFont });
+      fontManager.refreshCatalogSync();
+      assert.deepEqual(fontManager.findFontIdsSync({ family: standardFont }), ids);
+    });
+  });
+
+  describe('result cache', function() {
+    afterEach(function() {
+      fontManager.configureCache({ maxEntries: 1024, maxFonts: 65536 });
+    });
+
+    it('should answer repeated queries from the cache', function() {
+      var query = { family: standardFont, weight: 700 };
+      var font = fontManager.findFontSync(query);
+      var stats = fontManager.getCacheStats();
+      assert.deepEqual(fontManager.findFontSync(query), font);
+      assert.equal(fontManager.getCacheStats().hits, stats.hits + 1);
+    });
+
+    it('should cache findFont and findFonts separately', function() {
+      var query = { family: standardFont, italic: true };
+      assertFontDescriptor(fontManager.findFontSync(query));
+      assert(Array.isArray(fontManager.findFontsSync(query)));
+    });
+
+    it('should evict entries to stay within the limits', function() {
+      fontManager.configureCache({ maxEntries: 2 });
+      var stats = fontManager.getCacheStats();
+      [100, 200, 300, 400].forEach(function(weight) {
+        fontManager.findFontSync({ family: standardFont, weight: weight });
+      });
+
+      var current = fontManager.getCacheStats();
+      assert.equal(current.maxEntries, 2);
+      assert(current.entries <= 2);
+      assert(current.evictions > stats.evictions);
+    });
+
+    it('should not cache anything when disabled', function() {
+      fontManager.configureCache({ maxEntries: 0 });
+      fontManager.findFontsSync({ family: standardFont });
+      assert.equal(fontManager.getCacheStats().entries, 0);
+    });
+
+    it('should be cleared when the catalog is refreshed', function() {
+      fontManager.findFontSync({ family: standardFont });
+      var stats = fontManager.getCacheStats();
+      fontManager.refreshCatalogSync();
+      fontManager.findFontSync({ family: standardFont });
+      assert.equal(fontManager.getCacheStats().invalidations, stats.invalidations + 1);
+    });
+
+    it('should throw for invalid limits', function() {
+      assert.throws(function() {
+        fontManager.configureCache({ maxEntries: -1 });
+      }, /Expected cache limits to be non-negative numbers/);
+    });
+  });
+
+  describe('getCatalogStats', function() {
+    it('should return the size of the catalog', function() {
+      var stats = fontManager.getCatalogStats();
+      assert.equal(stats.fonts, fontManager.getAvailableFontsSync().length);
+      assert.equal(stats.families, fontManager.getFamilyNamesSync().length);
+      assert(stats.paths <= stats.fonts);
+      assert(stats.pathsSize <= stats.rawPathsSize);
+      assert(stats.namesSize <= stats.rawNamesSize);
+      assert(stats.size >= stats.pathsSize + stats.namesSize);
+      assert.equal(stats.generation, fontManager.getCatalogStats().generation);
+    });
+  });
+
+  describe('requests answered from memory', function() {
+    it('should still call back asynchronously', function(done) {
+      fontManager.getFontByPostscriptNameSync(postscriptName);
+      var returned = false;
+      fontManager.getFontByPostscriptName(postscriptName, function(font) {
+        assert(returned);
+        assert.equal(font.postscriptName, postscriptName);
+        done();
+      });
+
+      returned = true;
+    });
+
+    it('should call back every request answered in the same turn', function(done) {
+      var query = { family: standardFont };
+      var expected = fontManager.findFontSync(query);
+      var count = 20;
+      var results = [];
+      for (var i = 0; i < count; i++) {
+        fontManager.findFont(query, function(font) {
+          results.push(font);
+          if (results.length === count) {
+            results.forEach(function(font) {
+              assert.deepEqual(font, expected);
+            });
+
+            done();
+          }
+        });
+      }
+
+      assert.equal(results.length, 0);
+    });
+
+    it('should report requests aborted before they were made', function(done) {
+      fontManager.getAvailableFonts({ signal: { aborted: true } }, function(err) {
+        assert(err instanceof Error);
+        assert.equal(err.name, 'AbortError');
+        done();
+      });
+    });
+  });
+
+  describe('worker threads', function() {
+    var workerThreads = null;
+    try {
+      workerThreads = require('worker_threads');
+    } catch (err) {
+      // not supported by this version of node
+    }
+
+    function createWorker(code) {
+      var script = 'var fontManager = require(' + JSON.stringify(path.resolve(__dirname, '..')) + ');\n' +
+        'var parentPort = require("worker_threads").parentPort;\n' + code;
+      return new workerThreads.Worker(script, { eval: true });
+    }
+
+    (workerThreads ? it : it.skip)('should load and query in several workers at once', function(done) {
+      var count = 4;
+      var results = [];
+      for (var i = 0; i < count; i++) {
+        var worker = createWorker(
+          'fontManager.findFont({ family: ' + JSON.stringify(standardFont) + ' }, function(font) {\n' +
+          '  parentPort.postMessage([font.postscriptName, fontManager.getAvailableFontsSync().length]);\n' +
+          '});'
+        );
+
+        worker.on('error', done);
+        worker.on('message', function(result) {
+          results.push(result);
+          if (results.length === count) {
+            var expected = [fontManager.findFontSync({ family: standardFont }).postscriptName, fontManager.getAvailableFontsSync().length];
+            results.forEach(function(result) {
+              assert.deepEqual(result, expected);
+            });
+
+            done();
+          }
+        });
+      }
+    });
+
+    (workerThreads ? it : it.skip)('should exit cleanly with requests in flight', function(done) {
+      var worker = createWorker(
+        'for (var i = 0; i < 100; i++) {\n' +
+        '  fontManager.findFonts({}, { timeout: 10000 }, function() {});\n' +
+        '}\n' +
+        'parentPort.postMessage("started");'
+      );
+
+      worker.on('error', done);
+      worker.on('message', function() {
+        worker.terminate();
+      });
+
+      worker.on('exit', function() {
+        assert(fontManager.getAvailableFontsSync().length > 0);
+        done();
+      });
+    });
+  });
+
+  if (process.platform !== 'win32') {
+    describe('publishCatalog', function() {
+      afterEach(function() {
+        fontManager.detachCatalog();
+      });
+
+      it('should throw if no name is provided', function() {
+        assert.throws(function() {
+          fontManager.publishCatalog();
+        }, /Expected a name/);
+      });
+
+      it('should return the published generation', function() {
+        var generation = fontManager.publishCatalog('font-manager-test');
+        assert.equal(typeof generation, 'number');
+        assert(generation > 0);
+        assert.equal(fontManager.publishCatalog('font-manager-test'), generation + 1);
+      });
+
+      it('should not change the available fonts', function() {
+        var fonts = fontManager.getAvailableFontsSync();
+        fontManager.publishCatalog('font-manager-test');
+        assert.deepEqual(fontManager.getAvailableFontsSync(), fonts);
+      });
+    });
+
+    describe('attachCatalog', function() {
+      it('should throw if no name is provided', function() {
+        assert.throws(function() {
+          fontManager.attachCatalog();
+        }, /Expected a name/);
+      });
+
+      it('should throw if no catalog was published', function() {
+        assert.throws(function() {
+          fontManager.attachCatalog('font-manager-missing');
+        }, /Could not attach/);
+      });
+
+      it('should read the catalog published by another process', function(done) {
+        this.timeout(30000);
+
+        // a process that publishes its catalog until it is told to exit
+        var publisher = require('child_process').spawn(process.execPath, ['-e',
+          'var fontManager = require(' + JSON.stringify(path.resolve(__dirname, '..')) + ');\n' +
+          'process.send(fontManager.publishCatalog("font-manager-roundtrip"));\n' +
+          'process.on("message", function() { fontManager.detachCatalog(); process.exit(0); });'
+        ], { stdio: ['ignore', 'inherit', 'inherit', 'ipc'] });
+
+        var fonts = fontManager.getAvailableFontsSync();
+        var families = fontManager.getFontFamiliesSync();
+        var font = fontManager.findFontSync({ family: standardFont });
+        var byName = fontManager.getFontByPostscriptNameSync(font.postscriptName);
+        var error = null;
+
+        publisher.on('error', done);
+        publisher.on('message', function(generation) {
+          try {
+            assert.equal(fontManager.attachCatalog('font-manager-roundtrip'), generation);
+            assert.deepEqual(fontManager.getAvailableFontsSync(), fonts);
+            assert.deepEqual(fontManager.getFontFamiliesSync(), families);
+            assert.deepEqual(fontManager.getFontByPostscriptNameSync(font.postscriptName), byName);
+            assert.deepEqual(fontManager.findFontSync({ family: standardFont }), font);
+
+            fontManager.detachCatalog();
+            assert.deepEqual(fontManager.getAvailableFontsSync(), fonts);
+            assert.deepEqual(fontManager.findFontSync({ family: standardFont }), font);
+          } catch (err) {
+            error = err;
+          }
+
+          fontManager.detachCatalog();
+          publisher.send('exit');
+        });
+
+        publisher.on('exit', function() {
+          done(error);
+        });
+      });
+
+      if (process.platform === 'linux') {
+        it('should read a published catalog with fonts that have no family', function(done) {
+          this.timeout(30000);
+
+          // a fontconfig setup with a copy of a standard font whose family is
+          // removed when it is scanned, next to a copy that keeps it
+          var fs = require('fs');
+          var os = require('os');
+          var dir = fs.mkdtempSync(path.join(os.tmpdir(), 'font-manager-'));
+          var font = fontManager.findFontSync({ postscriptName: postscriptName });
+          var noFamily = path.join(dir, 'nofamily' + path.extname(font.path));
+          fs.copyFileSync(font.path, path.join(dir, 'family' + path.extname(font.path)));
+          fs.copyFileSync(font.path, noFamily);
+          fs.writeFileSync(path.join(dir, 'fonts.conf'),
+            '<?xml version="1.0"?>\n<fontconfig>\n' +
+            '  <dir>' + dir + '</dir>\n  <cachedir>' + path.join(dir, 'cache') + '</cachedir>\n' +
+            '  <match target="scan"><test name="file"><string>' + noFamily + '</string></test>' +
+            '<edit name="family" mode="delete_all"/></match>\n</fontconfig>\n');
+
+          var publisher = require('child_process').spawn(process.execPath, ['-e',
+            'var fontManager = require(' + JSON.stringify(path.resolve(__dirname, '..')) + ');\n' +
+            'var generation = fontManager.publishCatalog("font-manager-nofamily");\n' +
+            'process.send({ generation: generation, fonts: fontManager.getAvailableFontsSync() });\n' +
+            'process.on("message", function() { fontManager.detachCatalog(); process.exit(0); });'
+          ], {
+            stdio: ['ignore', 'inherit', 'inherit', 'ipc'],
+            env: Object.assign({}, process.env, { FONTCONFIG_FILE: path.join(dir, 'fonts.conf') })
+          });
+
+          function describeFont(font) {
+            return font.path + ' ' + font.postscriptName + ' ' + (font.family || null);
+          }
+
+          var error = null;
+          publisher.on('error', done);
+          publisher.on('message', function(published) {
+            try {
+              assert.equal(published.fonts.length, 2);
+              assert(published.fonts.some(function(font) {
+                return !font.family;
+              }));
+
+              assert.equal(fontManager.attachCatalog('font-manager-nofamily'), published.generation);
+              assert.deepEqual(fontManager.getAvailableFontsSync().map(describeFont), published.fonts.map(describeFont));
+              assert.equal(fontManager.getFontFamiliesSync().length, 1);
+            } catch (err) {
+              error = err;
+            }
+
+            fontManager.detachCatalog();
+            publisher.send('exit');
+          });
+
+          function remove(file) {
+            if (fs.statSync(file).isDirectory()) {
+              fs.readdirSync(file).forEach(function(name) {
+                remove(path.join(file, name));
+              });
+
+              fs.rmdirSync(file);
+            } else {
+              fs.unlinkSync(file);
+            }
+          }
+
+          publisher.on('exit', function() {
+            remove(dir);
+            done(error);
+          });
+        });
+      }
+    });
+  }
 });
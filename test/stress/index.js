@@ -0,0 +1,190 @@
+// Runs every asynchronous export concurrently with randomized arguments, to
+// shake out data races in the native code. Build the addon with
+// `npm run build:tsan` or `npm run build:asan` before running it with
+// `npm run test:stress` to get reports from the sanitizers.
+process.env.UV_THREADPOOL_SIZE = process.env.UV_THREADPOOL_SIZE || 16;
+
+var fontManager = require('../../');
+var assert = require('assert');
+var path = require('path');
+
+var ITERATIONS = +process.env.STRESS_ITERATIONS || 2000;
+var CONCURRENCY = +process.env.STRESS_CONCURRENCY || 64;
+
+// a small seeded generator, so that failures can be reproduced with STRESS_SEED
+var seed = +process.env.STRESS_SEED || Date.now() % 0x7fffffff;
+function random() {
+  seed = (seed * 48271) % 0x7fffffff;
+  return seed / 0x7fffffff;
+}
+
+function pick(array) {
+  return array[Math.floor(random() * array.length)];
+}
+
+describe('stress', function() {
+  var fonts = fontManager.getAvailableFontsSync();
+  var families = fontManager.getFamilyNamesSync().concat(['sans-serif', 'monospace', 'NonExistentFont']);
+  var postscriptNames = fonts.map(function(font) { return font.postscriptName; }).filter(Boolean).concat(['NonExistentFont']);
+  var paths = fonts.map(function(font) { return font.path; }).concat(['/does/not/exist.ttf']);
+  var texts = ['abc', '汉字', 'Ωμέγα', '😀', 'العربية', 'mixed 汉字 😀 text'];
+
+  function randomDescriptor() {
+    var desc = {};
+    if (random() < 0.7) desc.family = pick(families);
+    if (random() < 0.2) desc.postscriptName = pick(postscriptNames);
+    if (random() < 0.5) desc.weight = pick([100, 200, 300, 400, 500, 600, 700, 800, 900]);
+    if (random() < 0.3) desc.width = 1 + Math.floor(random() * 9);
+    if (random() < 0.3) desc.italic = random() < 0.5;
+    if (random() < 0.2) desc.monospace = true;
+    return desc;
+  }
+
+  // each entry starts one asynchronous request and validates its result
+  var requests = [
+    function(done) {
+      fontManager.getAvailableFonts(function(res) {
+        assert.equal(res.length, fonts.length);
+        done();
+      });
+    },
+    function(done) {
+      fontManager.findFonts(randomDescriptor(), function(res) {
+        assert(Array.isArray(res));
+        done();
+      });
+    },
+    function(done) {
+      var desc = randomDescriptor();
+      desc.weight = { min: pick([0, 100, 400]), max: pick([400, 700, 1000]) };
+      if (random() < 0.5) desc.family = [pick(families), pick(families)];
+      if (random() < 0.5) desc.pathPrefix = path.dirname(pick(paths));
+      fontManager.findFonts(desc, function(res) {
+        assert(Array.isArray(res));
+        done();
+      });
+    },
+    function(done) {
+      fontManager.findFont(randomDescriptor(), function(res) {
+        assert.equal(typeof res, 'object');
+        done();
+      });
+    },
+    function(done) {
+      fontManager.substituteFont(pick(postscriptNames), pick(texts), function(res) {
+        assert.equal(typeof res, 'object');
+        done();
+      });
+    },
+    function(done) {
+      fontManager.getFontFamilies(function(res) {
+        assert(Array.isArray(res));
+        done();
+      });
+    },
+    function(done) {
+      fontManager.getFamilyNames(function(res) {
+        assert(Array.isArray(res));
+        done();
+      });
+    },
+    function(done) {
+      var stack = [pick(families), pick(families), 'sans-serif'];
+      fontManager.resolveFontStack(stack, randomDescriptor(), pick(texts), function(res) {
+        assert.equal(typeof res.font, 'object');
+        done();
+      });
+    },
+    function(done) {
+      fontManager.getFallbackChain(pick(postscriptNames), { lang: pick(['en', 'ja', 'ar']), limit: 5 }, function(res) {
+        assert(res === null || Array.isArray(res));
+        done();
+      });
+    },
+    function(done) {
+      var name = pick(postscriptNames);
+      fontManager.getFontByPostscriptName(name, function(res) {
+        assert(res === null || res.postscriptName === name);
+        done();
+      });
+    },
+    function(done) {
+      fontManager.getFontByPath([pick(paths), pick(paths)], function(res) {
+        assert.equal(res.length, 2);
+        done();
+      });
+    },
+    function(done) {
+      // swaps in a new catalog while the other requests are reading the old one
+      fontManager.refreshCatalog(function(res) {
+        assert.equal(typeof res, 'number');
+        done();
+      });
+    }
+  ];
+
+  it('should call back exactly once for cancelled requests', function(done) {
+    var pending = 0;
+    var signals = [];
+
+    for (var i = 0; i < ITERATIONS; i++) {
+      var signal = {
+        aborted: false,
+        listener: null,
+        addEventListener: function(type, listener) { this.listener = listener; },
+        removeEventListener: function() { this.listener = null; }
+      };
+
+      var options = { priority: Math.floor(random() * 10) - 5 };
+      if (random() < 0.3) options.timeout = 1 + Math.floor(random() * 5);
+      if (random() < 0.3) {
+        options.signal = signal;
+        signals.push(signal);
+      }
+
+      pending++;
+      fontManager.findFont(randomDescriptor(), options, (function() {
+        var called = false;
+        return function(res) {
+          assert(!called, 'callback called twice');
+          called = true;
+          assert(res instanceof Error || typeof res === 'object');
+          if (--pending === 0)
+            done();
+        };
+      })());
+    }
+
+    // abort some of the requests while they are queued or running
+    setImmediate(function() {
+      signals.forEach(function(signal) {
+        if (signal.listener && random() < 0.5)
+          signal.listener();
+      });
+    });
+  });
+
+  it('should handle concurrent requests to every export (seed ' + seed + ')', function(done) {
+    var started = 0;
+    var finished = 0;
+
+    function next() {
+      if (finished === ITERATIONS)
+        return done();
+
+      if (started === ITERATIONS)
+        return;
+
+      started++;
+      pick(requests)(function() {
+        finished++;
+        next();
+      });
+    }
+
+    // assertion errors thrown from callbacks are reported through mocha's uncaught handler
+    for (var i = 0; i < CONCURRENCY; i++) {
+      next();
+    }
+  });
+});